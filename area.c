@@ -0,0 +1,234 @@
+#include "area.h"
+
+#include <string.h>
+
+#include "keyframe.h"
+
+/**
+ * Get the area centered on a cell, moved as little as needed to fit on the
+ * board.
+ */
+area_t area_around(int row, int col) {
+  int top = row - AREA_HEIGHT / 2;
+  int left = col - AREA_WIDTH / 2;
+  if(top > BOARD_HEIGHT - AREA_HEIGHT) top = BOARD_HEIGHT - AREA_HEIGHT;
+  if(left > BOARD_WIDTH - AREA_WIDTH) left = BOARD_WIDTH - AREA_WIDTH;
+  if(top < 0) top = 0;
+  if(left < 0) left = 0;
+
+  area_t area = {
+    .row = top,
+    .col = left,
+    .height = AREA_HEIGHT,
+    .width = AREA_WIDTH
+  };
+  return area;
+}
+
+/**
+ * Check whether a cell is inside an area.
+ */
+bool area_contains(const area_t* area, int row, int col) {
+  return row >= area->row && row < area->row + area->height &&
+         col >= area->col && col < area->col + area->width;
+}
+
+/**
+ * Clear every cell of an old area that is not in a new one, removing them
+ * from the board's hash.
+ */
+static void area_clear_outside(int board[BOARD_HEIGHT][BOARD_WIDTH], const area_t* old,
+                               const area_t* next, uint64_t* hash) {
+  for(int r=old->row; r<old->row + old->height; r++) {
+    for(int c=old->col; c<old->col + old->width; c++) {
+      if(!area_contains(next, r, c)) {
+        *hash ^= zobrist_key(r * BOARD_WIDTH + c, board[r][c]);
+        board[r][c] = 0;
+      }
+    }
+  }
+}
+
+/**
+ * Encode the cells of a board in an area that changed since the last message
+ * on a stream, as a MSG_DELTA payload.
+ */
+size_t area_encode_delta(area_stream_t* stream, int board[BOARD_HEIGHT][BOARD_WIDTH],
+                         area_t next, uint8_t* payload) {
+  // The hash changes along with the cells, so it doesn't count as moving
+  next.hash = stream->area.hash;
+  bool moved = memcmp(&next, &stream->area, sizeof(area_t)) != 0;
+
+  // Clients forget cells that leave the area
+  area_clear_outside(stream->known, &stream->area, &next, &next.hash);
+
+  // Find the cells that differ from what the clients know, skipping whole
+  // rows that have not changed
+  cell_change_t* changes = (cell_change_t*)(payload + sizeof(area_t));
+  size_t num_changes = 0;
+  for(int r=next.row; r<next.row + next.height; r++) {
+    int* row = &board[r][next.col];
+    int* known = &stream->known[r][next.col];
+    if(memcmp(row, known, next.width * sizeof(int)) == 0) continue;
+    for(int c=0; c<next.width; c++) {
+      if(row[c] != known[c]) {
+        uint32_t index = r * BOARD_WIDTH + next.col + c;
+        changes[num_changes].index = index;
+        changes[num_changes].value = row[c];
+        num_changes++;
+        next.hash ^= zobrist_key(index, known[c]) ^ zobrist_key(index, row[c]);
+        known[c] = row[c];
+      }
+    }
+  }
+  stream->area = next;
+
+  // Nothing to send
+  if(num_changes == 0 && !moved) return 0;
+
+  memcpy(payload, &next, sizeof(area_t));
+  return sizeof(area_t) + num_changes * sizeof(cell_change_t);
+}
+
+/**
+ * Encode every cell of a board in an area as a MSG_BOARD payload.
+ */
+size_t area_encode_keyframe(area_stream_t* stream, int board[BOARD_HEIGHT][BOARD_WIDTH],
+                            area_t next, uint8_t* payload) {
+  next.hash = stream->area.hash;
+  area_clear_outside(stream->known, &stream->area, &next, &next.hash);
+
+  for(int r=next.row; r<next.row + next.height; r++) {
+    for(int c=next.col; c<next.col + next.width; c++) {
+      uint32_t index = r * BOARD_WIDTH + c;
+      next.hash ^= zobrist_key(index, stream->known[r][c]) ^ zobrist_key(index, board[r][c]);
+      stream->known[r][c] = board[r][c];
+    }
+  }
+  stream->area = next;
+
+  return area_encode_known(stream, payload);
+}
+
+/**
+ * Encode what the clients following a stream already know as a MSG_BOARD
+ * payload, without changing the stream.
+ */
+size_t area_encode_known(const area_stream_t* stream, uint8_t* payload) {
+  const area_t* area = &stream->area;
+  memcpy(payload, area, sizeof(area_t));
+  return sizeof(area_t) + keyframe_encode(&stream->known[area->row][area->col], area->height,
+                                          area->width, BOARD_WIDTH, payload + sizeof(area_t));
+}
+
+/**
+ * Apply a MSG_BOARD or MSG_DELTA payload to a client's copy of the board.
+ */
+bool area_apply(int board[BOARD_HEIGHT][BOARD_WIDTH], area_t* current, uint32_t type,
+                const uint8_t* payload, size_t length) {
+  if(length < sizeof(area_t)) return false;
+
+  area_t next;
+  memcpy(&next, payload, sizeof(area_t));
+  if(next.height > AREA_HEIGHT || next.width > AREA_WIDTH ||
+     next.row + next.height > BOARD_HEIGHT || next.col + next.width > BOARD_WIDTH) {
+    return false;
+  }
+
+  payload += sizeof(area_t);
+  length -= sizeof(area_t);
+  if(type == MSG_DELTA && length % sizeof(cell_change_t) != 0) return false;
+
+  // Decode a keyframe before touching the board, in case it is malformed
+  int cells[AREA_HEIGHT][AREA_WIDTH];
+  if(type == MSG_BOARD && !keyframe_decode(payload, length, &cells[0][0], next.height, next.width, AREA_WIDTH)) {
+    return false;
+  }
+
+  // Work out our own hash, to compare with the one the server sent
+  next.hash = current->hash;
+  area_clear_outside(board, current, &next, &next.hash);
+
+  if(type == MSG_BOARD) {
+    for(int r=0; r<next.height; r++) {
+      int* row = &board[next.row + r][next.col];
+      if(memcmp(row, cells[r], next.width * sizeof(int)) == 0) continue;
+      for(int c=0; c<next.width; c++) {
+        if(row[c] == cells[r][c]) continue;
+        uint32_t index = (next.row + r) * BOARD_WIDTH + next.col + c;
+        next.hash ^= zobrist_key(index, row[c]) ^ zobrist_key(index, cells[r][c]);
+        row[c] = cells[r][c];
+      }
+    }
+  } else {
+    const cell_change_t* changes = (const cell_change_t*)payload;
+    size_t num_changes = length / sizeof(cell_change_t);
+    for(size_t i=0; i<num_changes; i++) {
+      int r = changes[i].index / BOARD_WIDTH;
+      int c = changes[i].index % BOARD_WIDTH;
+      if(area_contains(&next, r, c)) {
+        next.hash ^= zobrist_key(changes[i].index, board[r][c]) ^
+                     zobrist_key(changes[i].index, changes[i].value);
+        board[r][c] = changes[i].value;
+      }
+    }
+  }
+  *current = next;
+  return true;
+}
+
+/**
+ * Check whether a client's board matches the server's after applying a
+ * MSG_BOARD or MSG_DELTA payload.
+ */
+bool area_in_sync(const area_t* current, const uint8_t* payload) {
+  area_t sent;
+  memcpy(&sent, payload, sizeof(area_t));
+  return sent.hash == current->hash;
+}
+
+/**
+ * Copy the cells of an area out of a board.
+ */
+void area_view_copy(area_view_t* view, int board[BOARD_HEIGHT][BOARD_WIDTH], const area_t* area) {
+  view->area = *area;
+  for(int r=0; r<area->height; r++) {
+    memcpy(view->cells[r], &board[area->row + r][area->col], area->width * sizeof(int));
+  }
+}
+
+/**
+ * Replace the cells of a board in its old area with the cells of a view.
+ */
+void area_view_apply(int board[BOARD_HEIGHT][BOARD_WIDTH], area_t* old, const area_view_t* view) {
+  const area_t* area = &view->area;
+  uint64_t hash = 0;
+  area_clear_outside(board, old, area, &hash);
+  for(int r=0; r<area->height; r++) {
+    memcpy(&board[area->row + r][area->col], view->cells[r], area->width * sizeof(int));
+  }
+  *old = *area;
+}
+
+/**
+ * Summarize a whole board in a minimap.
+ */
+void minimap_build(minimap_t* minimap, int board[BOARD_HEIGHT][BOARD_WIDTH]) {
+  memset(minimap, 0, sizeof(minimap_t));
+  for(int r=0; r<BOARD_HEIGHT; r++) {
+    uint8_t* row = minimap->cells[r * MINIMAP_HEIGHT / BOARD_HEIGHT];
+    for(int c=0; c<BOARD_WIDTH; c++) {
+      int cur = board[r][c];
+      if(cur == 0) continue;
+
+      uint8_t* cell = &row[c * MINIMAP_WIDTH / BOARD_WIDTH];
+      if(cur < 0) {
+        *cell |= MINIMAP_APPLE;
+      } else if(cur < SNAKE2_BASE) {
+        *cell |= MINIMAP_SNAKE1;
+      } else {
+        *cell |= MINIMAP_SNAKE2;
+      }
+    }
+  }
+}
@@ -0,0 +1,161 @@
+#ifndef AREA_H
+#define AREA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "protocol.h"
+
+// Largest payload of a MSG_BOARD or MSG_DELTA message
+#define AREA_PAYLOAD_MAX (sizeof(area_t) + AREA_HEIGHT * AREA_WIDTH * sizeof(cell_change_t))
+
+/**
+ * Get the Zobrist key for a value in a cell. A board's hash is the XOR of
+ * the keys of all its cells, so changing a cell updates the hash with two
+ * more XORs. Cell values range too widely for a table of random keys, so
+ * each key is a hash of the cell and value instead. Empty cells have no key,
+ * which makes an empty board's hash zero.
+ *
+ * \param index  The cell's position, as row * BOARD_WIDTH + column
+ * \param value  The cell's value
+ */
+static inline uint64_t zobrist_key(uint32_t index, int value) {
+  if(value == 0) return 0;
+
+  // The splitmix64 finalizer, which mixes every input bit into every output bit
+  uint64_t x = ((uint64_t)index << 32 | (uint32_t)value) + 0x9e3779b97f4a7c15;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+  return x ^ (x >> 31);
+}
+
+/**
+ * What the server has sent to the clients that follow one snake. Every
+ * client following the snake gets the same messages.
+ */
+typedef struct area_stream {
+  // The area last sent, which has no size before the first message. Its
+  // hash is the Zobrist hash of known.
+  area_t area;
+
+  // What those clients know about each cell. Cells outside the area are
+  // always zero, since clients clear cells that leave their area.
+  int known[BOARD_HEIGHT][BOARD_WIDTH];
+} area_stream_t;
+
+/**
+ * The cells of a client's area, handed from the thread that receives them to
+ * the one that draws them.
+ */
+typedef struct area_view {
+  area_t area;
+  int cells[AREA_HEIGHT][AREA_WIDTH];
+} area_view_t;
+
+/**
+ * Get the area centered on a cell, moved as little as needed to fit on the
+ * board.
+ *
+ * \param row   The row to center on
+ * \param col   The column to center on
+ *
+ * \returns     An area of AREA_HEIGHT rows and AREA_WIDTH columns.
+ */
+area_t area_around(int row, int col);
+
+/**
+ * Check whether a cell is inside an area.
+ */
+bool area_contains(const area_t* area, int row, int col);
+
+/**
+ * Encode the cells of a board in an area that changed since the last message
+ * on a stream, as a MSG_DELTA payload. Cells that left the stream's area are
+ * not sent, since clients clear those themselves.
+ *
+ * \param stream    The stream the message will be sent on
+ * \param board     The current board
+ * \param next      The area to send, which may have moved since the last one
+ * \param payload   Space for AREA_PAYLOAD_MAX bytes
+ *
+ * \returns         The payload length, or zero if nothing changed.
+ */
+size_t area_encode_delta(area_stream_t* stream, int board[BOARD_HEIGHT][BOARD_WIDTH],
+                         area_t next, uint8_t* payload);
+
+/**
+ * Encode every cell of a board in an area as a MSG_BOARD payload.
+ *
+ * \param stream    The stream the message will be sent on
+ * \param board     The current board
+ * \param next      The area to send
+ * \param payload   Space for AREA_PAYLOAD_MAX bytes
+ *
+ * \returns         The payload length.
+ */
+size_t area_encode_keyframe(area_stream_t* stream, int board[BOARD_HEIGHT][BOARD_WIDTH],
+                            area_t next, uint8_t* payload);
+
+/**
+ * Encode what the clients following a stream already know as a MSG_BOARD
+ * payload, without changing the stream. This brings a new or returning
+ * connection up to date.
+ *
+ * \param stream    The stream, which must have sent something already
+ * \param payload   Space for AREA_PAYLOAD_MAX bytes
+ *
+ * \returns         The payload length.
+ */
+size_t area_encode_known(const area_stream_t* stream, uint8_t* payload);
+
+/**
+ * Apply a MSG_BOARD or MSG_DELTA payload to a client's copy of the board.
+ * Cells that leave the area are cleared.
+ *
+ * \param board     The client's board
+ * \param current   The client's area, which is updated. Its hash is kept as
+ *                  the hash of the client's board, rather than copied from
+ *                  the message, so area_in_sync can compare the two.
+ * \param type      The message type
+ * \param payload   The message payload
+ * \param length    The payload length
+ *
+ * \returns         false if the payload is malformed, in which case the board
+ *                  is left unchanged.
+ */
+bool area_apply(int board[BOARD_HEIGHT][BOARD_WIDTH], area_t* current, uint32_t type,
+                const uint8_t* payload, size_t length);
+
+/**
+ * Check whether a client's board matches the server's after applying a
+ * MSG_BOARD or MSG_DELTA payload.
+ *
+ * \param current   The client's area, as updated by area_apply
+ * \param payload   The payload that was applied
+ *
+ * \returns         true if the hashes of both boards match.
+ */
+bool area_in_sync(const area_t* current, const uint8_t* payload);
+
+/**
+ * Copy the cells of an area out of a board.
+ */
+void area_view_copy(area_view_t* view, int board[BOARD_HEIGHT][BOARD_WIDTH], const area_t* area);
+
+/**
+ * Replace the cells of a board in its old area with the cells of a view.
+ * Cells in the old area that are outside the view's area are cleared.
+ *
+ * \param board   The board to update
+ * \param old     The board's area, which is updated to the view's area
+ * \param view    The new cells
+ */
+void area_view_apply(int board[BOARD_HEIGHT][BOARD_WIDTH], area_t* old, const area_view_t* view);
+
+/**
+ * Summarize a whole board in a minimap.
+ */
+void minimap_build(minimap_t* minimap, int board[BOARD_HEIGHT][BOARD_WIDTH]);
+
+#endif
@@ -0,0 +1,63 @@
+#include "arena.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#if !defined(MAP_NORESERVE)
+#define MAP_NORESERVE 0
+#endif
+
+/**
+ * Reserve a region for an arena.
+ */
+int arena_open(arena_t* arena, size_t size) {
+  // Don't ask for swap to back the whole region, since most of it is usually
+  // never touched
+  void* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if(base == MAP_FAILED) return -1;
+
+  arena->base = base;
+  arena->size = size;
+  arena->used = 0;
+  return 0;
+}
+
+/**
+ * Allocate memory from an arena.
+ */
+void* arena_alloc(arena_t* arena, size_t size) {
+  size_t start = (arena->used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  if(start > arena->size || size > arena->size - start) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  arena->used = start + size;
+  return arena->base + start;
+}
+
+/**
+ * Bring the pages the next allocations from an arena will use into memory.
+ */
+void arena_prefault(arena_t* arena, size_t size) {
+  if(size > arena->size - arena->used) size = arena->size - arena->used;
+  memset(arena->base + arena->used, 0, size);
+}
+
+/**
+ * Forget every allocation from an arena.
+ */
+void arena_reset(arena_t* arena) {
+  arena->used = 0;
+}
+
+/**
+ * Release an arena's region.
+ */
+void arena_close(arena_t* arena) {
+  if(arena->base == NULL) return;
+  munmap(arena->base, arena->size);
+  arena->base = NULL;
+  arena->size = 0;
+  arena->used = 0;
+}
@@ -0,0 +1,65 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Every allocation from an arena is aligned to this many bytes
+#define ARENA_ALIGN 16
+
+/**
+ * A region of memory that allocations are carved off the front of, and that
+ * is released all at once. Allocating never calls malloc and never takes a
+ * lock, and there is no way to free one allocation on its own.
+ */
+typedef struct arena {
+  uint8_t* base;    //< The start of the region
+  size_t size;      //< Size of the region
+  size_t used;      //< Bytes allocated so far, including alignment
+} arena_t;
+
+/**
+ * Reserve a region for an arena. The region is mapped but not touched, so it
+ * only takes up memory as allocations from it are used.
+ *
+ * \param arena   The arena to initialize
+ * \param size    The most bytes the arena can hand out
+ *
+ * \returns       0 on success, or -1 with errno set on failure.
+ */
+int arena_open(arena_t* arena, size_t size);
+
+/**
+ * Allocate memory from an arena. The memory is zeroed the first time the
+ * region is used, but not after arena_reset.
+ *
+ * \param arena   The arena to allocate from
+ * \param size    The number of bytes wanted
+ *
+ * \returns       The memory, or NULL with errno set to ENOMEM if the arena is
+ *                full.
+ */
+void* arena_alloc(arena_t* arena, size_t size);
+
+/**
+ * Bring the pages that the next allocations from an arena will use into
+ * memory now, by zeroing them, so using them later doesn't fault.
+ *
+ * \param arena   The arena
+ * \param size    The number of bytes past the allocations so far to touch,
+ *                which is cut short at the end of the region
+ */
+void arena_prefault(arena_t* arena, size_t size);
+
+/**
+ * Forget every allocation from an arena, so its region can be handed out
+ * again. Nothing allocated from it may be used afterwards.
+ */
+void arena_reset(arena_t* arena);
+
+/**
+ * Release an arena's region, along with everything allocated from it.
+ */
+void arena_close(arena_t* arena);
+
+#endif
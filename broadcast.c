@@ -0,0 +1,464 @@
+#include "broadcast.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "uring.h"
+#include "util.h"
+
+// Everything needed to stream messages to one spectator
+typedef struct spectator {
+  // The spectator's non-blocking socket
+  int fd;
+
+  // Ring of messages waiting to be sent. The message at head may have been
+  // partially sent already.
+  tick_buf_t* queue[SPECTATOR_QUEUE_LEN];
+  size_t head;
+  size_t count;
+
+  // Number of bytes of queue[head] that have already been sent
+  size_t offset;
+
+  // Set when the spectator fell behind. Lagging spectators only receive
+  // keyframes until they catch up.
+  bool lagging;
+} spectator_t;
+
+spectator_t* spectators = NULL;   //< Every connected spectator
+size_t num_spectators = 0;        //< The number of spectators in use
+size_t spectators_capacity = 0;   //< The number of spectators allocated
+uint64_t bytes_sent = 0;          //< Bytes written to spectators so far
+size_t num_lagging = 0;           //< The number of spectators waiting for a keyframe
+
+// The io_uring that batches writes to spectators, or NULL to write to each
+// one with its own system call
+static uring_t* uring = NULL;
+
+// Where tick buffers and the spectator table come from, or NULL to use
+// malloc, and the released tick buffers of each size waiting to be reused
+static arena_t* arena = NULL;
+static tick_buf_t* free_bufs[TICK_BUF_CLASSES];
+
+// The data and result of each write in the batch being sent through uring.
+// A write's result is BATCH_PENDING until the uring reports it.
+#define BATCH_PENDING INT_MIN
+static struct iovec batch_iov[SPECTATOR_BATCH][SPECTATOR_QUEUE_LEN];
+static int batch_results[SPECTATOR_BATCH];
+
+/**
+ * Take tick buffers and the spectator table out of an arena.
+ */
+void broadcast_set_arena(arena_t* next) {
+  // Move the spectators who are already connected
+  spectator_t* moved = NULL;
+  size_t capacity = 0;
+  if(num_spectators > 0) {
+    capacity = spectators_capacity;
+    moved = next != NULL ? arena_alloc(next, capacity * sizeof(spectator_t))
+                         : malloc(capacity * sizeof(spectator_t));
+    if(moved == NULL) {
+      perror("Failed to allocate spectators");
+      exit(2);
+    }
+    memcpy(moved, spectators, num_spectators * sizeof(spectator_t));
+  }
+  if(arena == NULL) free(spectators);
+  spectators = moved;
+  spectators_capacity = capacity;
+
+  memset(free_bufs, 0, sizeof(free_bufs));
+  arena = next;
+}
+
+/**
+ * Allocate a tick buffer with a single reference.
+ */
+tick_buf_t* tick_buf_create(size_t length, bool keyframe) {
+  // Find the smallest size that fits
+  int size_class = 0;
+  while(size_class < TICK_BUF_CLASSES && ((size_t)TICK_BUF_MIN << size_class) < sizeof(tick_buf_t) + length) {
+    size_class++;
+  }
+
+  tick_buf_t* buf;
+  if(arena != NULL && size_class < TICK_BUF_CLASSES) {
+    buf = free_bufs[size_class];
+    if(buf != NULL) {
+      free_bufs[size_class] = buf->next;
+    } else {
+      buf = arena_alloc(arena, (size_t)TICK_BUF_MIN << size_class);
+    }
+  } else {
+    size_class = -1;
+    buf = malloc(sizeof(tick_buf_t) + length);
+  }
+  if(buf == NULL) return NULL;
+
+  atomic_init(&buf->refs, 1);
+  buf->size_class = size_class;
+  buf->keyframe = keyframe;
+  buf->length = length;
+  return buf;
+}
+
+/**
+ * Add a reference to a tick buffer.
+ */
+tick_buf_t* tick_buf_retain(tick_buf_t* buf) {
+  atomic_fetch_add_explicit(&buf->refs, 1, memory_order_relaxed);
+  return buf;
+}
+
+/**
+ * Drop a reference to a tick buffer, freeing it if this was the last one.
+ */
+void tick_buf_release(tick_buf_t* buf) {
+  if(atomic_fetch_sub_explicit(&buf->refs, 1, memory_order_acq_rel) == 1) {
+    if(buf->size_class == -1) {
+      free(buf);
+    } else {
+      buf->next = free_bufs[buf->size_class];
+      free_bufs[buf->size_class] = buf;
+    }
+  }
+}
+
+/**
+ * Add a message to the back of a spectator's queue. The caller must make sure
+ * there is space.
+ */
+static void spectator_enqueue(spectator_t* s, tick_buf_t* buf) {
+  s->queue[(s->head + s->count) % SPECTATOR_QUEUE_LEN] = tick_buf_retain(buf);
+  s->count++;
+}
+
+/**
+ * Release the first message in a spectator's queue.
+ */
+static void spectator_dequeue(spectator_t* s) {
+  tick_buf_release(s->queue[s->head]);
+  s->head = (s->head + 1) % SPECTATOR_QUEUE_LEN;
+  s->count--;
+  s->offset = 0;
+}
+
+/**
+ * Drop every queued message that has not started sending. A partially sent
+ * message is kept so the stream stays correctly framed.
+ *
+ * \returns   The number of messages dropped
+ */
+static size_t spectator_drop_backlog(spectator_t* s) {
+  size_t keep = (s->count > 0 && s->offset > 0) ? 1 : 0;
+  size_t dropped = s->count - keep;
+  for(size_t i=keep; i<s->count; i++) {
+    tick_buf_release(s->queue[(s->head + i) % SPECTATOR_QUEUE_LEN]);
+  }
+  s->count = keep;
+  return dropped;
+}
+
+/**
+ * Queue a message to one spectator, dropping its backlog if it is lagging.
+ */
+static void spectator_publish_one(spectator_t* s, tick_buf_t* buf) {
+  if(s->lagging) {
+    // A lagging spectator can only restart from a keyframe
+    if(!buf->keyframe) return;
+
+    // Replace any unsent keyframe with this newer one. If nothing was
+    // waiting, the spectator has caught up and can take every message again.
+    if(spectator_drop_backlog(s) == 0) {
+      s->lagging = false;
+      num_lagging--;
+    }
+    spectator_enqueue(s, buf);
+
+  } else if(s->count == SPECTATOR_QUEUE_LEN) {
+    // The spectator is not keeping up. Rather than buffering without bound,
+    // throw away its backlog and wait for the next keyframe.
+    spectator_drop_backlog(s);
+    s->lagging = true;
+    num_lagging++;
+    if(buf->keyframe) {
+      spectator_enqueue(s, buf);
+    }
+
+  } else {
+    spectator_enqueue(s, buf);
+  }
+}
+
+/**
+ * Start tracking a connected spectator.
+ */
+void spectator_add(int fd, tick_buf_t** history, size_t count) {
+  if(num_spectators == MAX_SPECTATORS) {
+    close(fd);
+    return;
+  }
+
+  // Grow the spectator array if needed
+  if(num_spectators == spectators_capacity) {
+    // An arena can't grow an allocation, so the table is copied and the old
+    // one is left until the arena is released. That wastes less than the
+    // table's final size.
+    size_t new_capacity = spectators_capacity == 0 ? 16 : spectators_capacity * 2;
+    spectator_t* grown;
+    if(arena != NULL) {
+      grown = arena_alloc(arena, new_capacity * sizeof(spectator_t));
+      if(grown != NULL && num_spectators > 0) {
+        memcpy(grown, spectators, num_spectators * sizeof(spectator_t));
+      }
+    } else {
+      grown = realloc(spectators, new_capacity * sizeof(spectator_t));
+    }
+    if(grown == NULL) {
+      close(fd);
+      return;
+    }
+    spectators = grown;
+    spectators_capacity = new_capacity;
+  }
+
+  // Sends to spectators must never block a game task
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  spectators[num_spectators] = (spectator_t) {
+    .fd = fd,
+    .head = 0,
+    .count = 0,
+    .offset = 0,
+    .lagging = false
+  };
+  num_spectators++;
+
+  // Catch the new spectator up on the match so far
+  for(size_t i=0; i<count; i++) {
+    spectator_publish_one(&spectators[num_spectators - 1], history[i]);
+  }
+}
+
+/**
+ * Get the number of connected spectators.
+ */
+size_t spectator_count() {
+  return num_spectators;
+}
+
+/**
+ * Get the number of bytes sent to spectators so far.
+ */
+uint64_t spectator_bytes_sent() {
+  return bytes_sent;
+}
+
+/**
+ * Disconnect a spectator and move the last spectator into its slot.
+ */
+static void spectator_remove(size_t index) {
+  spectator_t* s = &spectators[index];
+  close(s->fd);
+  while(s->count > 0) {
+    spectator_dequeue(s);
+  }
+  if(s->lagging) num_lagging--;
+
+  num_spectators--;
+  spectators[index] = spectators[num_spectators];
+}
+
+/**
+ * Queue a message to every spectator without copying it.
+ */
+void spectator_publish(tick_buf_t* buf) {
+  for(size_t i=0; i<num_spectators; i++) {
+    spectator_publish_one(&spectators[i], buf);
+  }
+}
+
+/**
+ * Check whether any spectator is waiting for a keyframe.
+ */
+bool spectators_lagging() {
+  return num_lagging > 0;
+}
+
+/**
+ * Queue a keyframe to just the spectators waiting for one.
+ */
+void spectator_publish_keyframe(tick_buf_t* buf) {
+  for(size_t i=0; i<num_spectators && num_lagging > 0; i++) {
+    if(spectators[i].lagging) {
+      spectator_publish_one(&spectators[i], buf);
+    }
+  }
+}
+
+/**
+ * Send spectators' writes through an io_uring from now on.
+ */
+bool spectator_use_uring() {
+  if(uring == NULL) uring = uring_open(SPECTATOR_BATCH);
+  return uring != NULL;
+}
+
+/**
+ * Gather every message queued to a spectator into a single write.
+ *
+ * \returns   The number of entries filled in iov, which is zero if nothing is
+ *            queued.
+ */
+static size_t spectator_gather(spectator_t* s, struct iovec* iov) {
+  for(size_t i=0; i<s->count; i++) {
+    tick_buf_t* buf = s->queue[(s->head + i) % SPECTATOR_QUEUE_LEN];
+    size_t skip = (i == 0) ? s->offset : 0;
+    iov[i].iov_base = buf->data + skip;
+    iov[i].iov_len = buf->length - skip;
+  }
+  return s->count;
+}
+
+/**
+ * Retire every message a write to a spectator sent completely.
+ *
+ * \param s       The spectator
+ * \param result  The number of bytes written, or a negative errno value
+ *
+ * \returns       false if the connection failed.
+ */
+static bool spectator_sent(spectator_t* s, ssize_t result) {
+  // A write io_uring cancelled before it started sent nothing
+  if(result < 0) {
+    return result == -EAGAIN || result == -EWOULDBLOCK || result == -EINTR || result == -ECANCELED;
+  }
+
+  size_t sent = result;
+  bytes_sent += sent;
+  while(sent > 0) {
+    size_t remaining = s->queue[s->head]->length - s->offset;
+    if(sent < remaining) {
+      s->offset += sent;
+      return true;
+    }
+    sent -= remaining;
+    spectator_dequeue(s);
+  }
+  return true;
+}
+
+/**
+ * Send as much queued data as possible to one spectator.
+ *
+ * \returns   false if the connection failed.
+ */
+static bool spectator_send(spectator_t* s) {
+  struct iovec iov[SPECTATOR_QUEUE_LEN];
+  size_t count = spectator_gather(s, iov);
+  if(count == 0) return true;
+
+  ssize_t rc = writev(s->fd, iov, count);
+  return spectator_sent(s, rc == -1 ? -errno : rc);
+}
+
+/**
+ * Record the result of a batched write, which carries its spectator's place
+ * in the batch.
+ */
+static void spectator_batch_done(uint64_t index, int result) {
+  batch_results[index] = result;
+}
+
+/**
+ * Send each spectator's queued data through the io_uring, one batch of
+ * spectators to each system call.
+ *
+ * \returns   false if io_uring failed, in which case it has been closed,
+ *            leaving some spectators unsent.
+ */
+static bool spectator_flush_batched() {
+  // Work down from the last spectator, so one that is removed is replaced by
+  // one that has already been sent to
+  size_t end = num_spectators;
+  while(end > 0) {
+    size_t start = end > SPECTATOR_BATCH ? end - SPECTATOR_BATCH : 0;
+    for(size_t i=start; i<end; i++) {
+      size_t count = spectator_gather(&spectators[i], batch_iov[i - start]);
+      batch_results[i - start] = 0;
+      if(count > 0 && uring_writev(uring, spectators[i].fd, batch_iov[i - start], count, i - start)) {
+        batch_results[i - start] = BATCH_PENDING;
+      }
+    }
+
+    // Carry on without io_uring if it fails, once nothing it was given is
+    // still being written
+    bool submitted = uring_submit(uring, spectator_batch_done);
+    if(!submitted) {
+      perror("io_uring failed");
+      uring_close(uring);
+      uring = NULL;
+    }
+
+    // Even after a failure, each write that reported back is accounted for,
+    // so nothing is sent twice. Where a spectator's stream stands is unknown
+    // if its write never reported back, so it is disconnected.
+    for(size_t i=end; i-- > start; ) {
+      int result = batch_results[i - start];
+      if(result == BATCH_PENDING || !spectator_sent(&spectators[i], result)) {
+        spectator_remove(i);
+      }
+    }
+    if(!submitted) return false;
+    end = start;
+  }
+  return true;
+}
+
+/**
+ * Send as much queued data to each spectator as its socket will accept.
+ */
+void spectator_flush() {
+  // If io_uring fails, the spectators it didn't get to are sent to one at a
+  // time instead
+  if(uring != NULL && spectator_flush_batched()) return;
+
+  size_t i = 0;
+  while(i < num_spectators) {
+    if(spectator_send(&spectators[i])) {
+      i++;
+    } else {
+      // The last spectator moves into this slot, so check index i again
+      spectator_remove(i);
+    }
+  }
+}
+
+/**
+ * Disconnect every spectator.
+ */
+void spectator_close_all() {
+  // Give queued messages a short time to go out
+  size_t start = time_ms();
+  while(time_ms() - start < SPECTATOR_LINGER) {
+    spectator_flush();
+
+    bool empty = true;
+    for(size_t i=0; i<num_spectators; i++) {
+      if(spectators[i].count > 0) empty = false;
+    }
+    if(empty) break;
+
+    sleep_ms(1);
+  }
+
+  while(num_spectators > 0) {
+    spectator_remove(num_spectators - 1);
+  }
+}
@@ -0,0 +1,153 @@
+#ifndef BROADCAST_H
+#define BROADCAST_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+// Most messages a spectator can have waiting before it is considered lagging
+#define SPECTATOR_QUEUE_LEN 32
+
+// Upper limit on the number of spectators watching a match
+#define MAX_SPECTATORS 4096
+
+// Longest time spectator_close_all spends sending final messages
+#define SPECTATOR_LINGER 100
+
+// Most writes to spectators batched into one system call when they are sent
+// through io_uring. This must be a power of two.
+#define SPECTATOR_BATCH 256
+
+// Tick buffers from an arena come in sizes that are powers of two, from this
+// size up to TICK_BUF_CLASSES sizes above it. Larger ones use malloc.
+#define TICK_BUF_MIN 64
+#define TICK_BUF_CLASSES 16
+
+/**
+ * A reference-counted message buffer. A tick's update is encoded into one of
+ * these once, and the same buffer is queued to every connection that should
+ * receive it. The buffer is freed, or kept for reuse, when the last
+ * connection has sent it.
+ */
+typedef struct tick_buf {
+  atomic_int refs;    //< Number of outstanding references
+  bool keyframe;      //< Can a receiver start from this message alone?
+  size_t length;      //< Number of bytes in data
+
+  // The free list the buffer goes back to once released, or -1 if it came
+  // from malloc, and the next buffer on that list while this one is free
+  int size_class;
+  struct tick_buf* next;
+
+  uint8_t data[];     //< The encoded message
+} tick_buf_t;
+
+/**
+ * Take tick buffers and the spectator table out of an arena. Released tick
+ * buffers are kept for reuse instead of freed, so once a match has sent a
+ * message of each size it sends no more through malloc. Tick buffers must
+ * only be created and released by one thread while an arena is in use, and
+ * every buffer from an arena must be released before the arena changes.
+ *
+ * \param next  The arena, or NULL to go back to malloc. Spectators who are
+ *              connected keep their place.
+ */
+void broadcast_set_arena(arena_t* next);
+
+/**
+ * Allocate a tick buffer with a single reference.
+ *
+ * \param length    The number of bytes the buffer should hold
+ * \param keyframe  Whether the message will hold the complete game state
+ *
+ * \returns         The new buffer, or NULL if allocation failed.
+ */
+tick_buf_t* tick_buf_create(size_t length, bool keyframe);
+
+/**
+ * Add a reference to a tick buffer.
+ *
+ * \param buf   The buffer to retain
+ *
+ * \returns     buf, for convenience
+ */
+tick_buf_t* tick_buf_retain(tick_buf_t* buf);
+
+/**
+ * Drop a reference to a tick buffer, freeing it if this was the last one.
+ *
+ * \param buf   The buffer to release
+ */
+void tick_buf_release(tick_buf_t* buf);
+
+/**
+ * Start tracking a connected spectator. The socket is switched to non-blocking
+ * mode. If there are already MAX_SPECTATORS spectators the socket is closed.
+ *
+ * \param fd        The spectator's socket
+ * \param history   Messages that bring a new spectator up to date, starting
+ *                  with a keyframe. Each one is retained and queued.
+ * \param count     The number of messages in history
+ */
+void spectator_add(int fd, tick_buf_t** history, size_t count);
+
+/**
+ * Get the number of connected spectators.
+ */
+size_t spectator_count();
+
+/**
+ * Get the number of bytes sent to spectators so far.
+ */
+uint64_t spectator_bytes_sent();
+
+/**
+ * Queue a message to every spectator without copying it. A spectator whose
+ * queue is full has its backlog dropped and only receives keyframes until it
+ * catches up. The caller has to send those with spectator_publish_keyframe.
+ *
+ * \param buf   The message to send. Each spectator takes its own reference.
+ */
+void spectator_publish(tick_buf_t* buf);
+
+/**
+ * Check whether any spectator skipped messages because it fell behind, and
+ * is waiting for a keyframe to start over from.
+ */
+bool spectators_lagging();
+
+/**
+ * Queue a keyframe to just the spectators waiting for one. The others are
+ * up to date, so they carry on with the messages they have.
+ *
+ * \param buf   A keyframe holding the state after every message published
+ *              so far. Each spectator takes its own reference.
+ */
+void spectator_publish_keyframe(tick_buf_t* buf);
+
+/**
+ * Send writes to spectators through io_uring from now on, so each
+ * spectator_flush takes one system call per SPECTATOR_BATCH spectators
+ * instead of one per spectator. If io_uring fails later on, spectators are
+ * written to one at a time again.
+ *
+ * \returns   false if io_uring is not available, which it only is on Linux.
+ */
+bool spectator_use_uring();
+
+/**
+ * Send as much queued data to each spectator as its socket will accept
+ * without blocking. Spectators whose connection failed are removed.
+ */
+void spectator_flush();
+
+/**
+ * Disconnect every spectator and release their queued messages. Queued
+ * messages get up to SPECTATOR_LINGER milliseconds to finish sending first.
+ */
+void spectator_close_all();
+
+#endif
@@ -0,0 +1,319 @@
+#define _GNU_SOURCE
+
+#include "game.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#include "util.h"
+
+/**
+ * Put a game in its starting position.
+ */
+void game_reset(game_state_t* state, uint64_t seed) {
+  // Zero out the board contents along with everything else
+  memset(state, 0, sizeof(game_state_t));
+
+  state->snake1_dir = DIR_NORTH;
+  state->snake2_dir = DIR_NORTH;
+  state->snake1_length = INIT_snake_LENGTH;
+  state->snake2_length = INIT_snake_LENGTH;
+  state->apple_age = INIT_APPLE_AGE;
+  state->rng_state = seed;
+
+  // Put the snakes at the middle of the board
+  state->snake1_row = BOARD_HEIGHT/2;
+  state->snake1_col = (BOARD_WIDTH/2) - 2;
+  state->snake2_row = BOARD_HEIGHT/2;
+  state->snake2_col = (BOARD_WIDTH/2) + 2;
+  state->board[state->snake1_row][state->snake1_col] = 1; // head of snake1 is 1
+  state->board[state->snake2_row][state->snake2_col] = SNAKE2_BASE; // head of snake2 is half the area of board
+}
+
+/**
+ * Get the number of ticks a snake waits between moves in a given direction.
+ * Vertical moves are slower to deal with rectangular cursors.
+ */
+static int snake_interval(int dir) {
+  if(dir == DIR_NORTH || dir == DIR_SOUTH) {
+    return snake_VERTICAL_INTERVAL / GAME_TICK_INTERVAL;
+  } else {
+    return snake_HORIZONTAL_INTERVAL / GAME_TICK_INTERVAL;
+  }
+}
+
+/**
+ * Move player 1's snake one space on the board.
+ *
+ * \returns   false if the snake crashed into an edge or a snake.
+ */
+static bool move_snake1(game_state_t* state) {
+  // "Age" each existing segment of the snake
+  for(int r=0; r<BOARD_HEIGHT; r++) {
+    for(int c=0; c<BOARD_WIDTH; c++) {
+      if(state->board[r][c] == 1) {  // Found the head of the snake. Save position
+        state->snake1_row = r;
+        state->snake1_col = c;
+      }
+
+      // Add 1 to the age of the snake segment
+      if(state->board[r][c] > 0 && state->board[r][c] < SNAKE2_BASE) {
+        state->board[r][c]++;
+
+        // Remove the snake segment if it is too old
+        if(state->board[r][c] > state->snake1_length) {
+          state->board[r][c] = 0;
+        }
+      }
+    }
+  }
+
+  // Move the snake into a new space
+  if(state->snake1_dir == DIR_NORTH) {
+    state->snake1_row--;
+  } else if(state->snake1_dir == DIR_SOUTH) {
+    state->snake1_row++;
+  } else if(state->snake1_dir == DIR_EAST) {
+    state->snake1_col++;
+  } else if(state->snake1_dir == DIR_WEST) {
+    state->snake1_col--;
+  }
+
+  int row = state->snake1_row;
+  int col = state->snake1_col;
+
+  // Check for edge collisions
+  if(row < 0 || row >= BOARD_HEIGHT || col < 0 || col >= BOARD_WIDTH) {
+    return false;
+  }
+
+  // Check for snake collisions
+  if(state->board[row][col] > 0) {
+    return false;
+  }
+
+  // Check for apple collisions
+  if(state->board[row][col] < 0) {
+    // snake gets longer
+    state->snake1_length++;
+  }
+
+  // Add the snake's new position
+  state->board[row][col] = 1;
+  return true;
+}
+
+/**
+ * Move player 2's snake one space on the board.
+ *
+ * \returns   false if the snake crashed into an edge or a snake.
+ */
+static bool move_snake2(game_state_t* state) {
+  // "Age" each existing segment of the snake
+  for(int r=0; r<BOARD_HEIGHT; r++) {
+    for(int c=0; c<BOARD_WIDTH; c++) {
+      if(state->board[r][c] == SNAKE2_BASE) {  // Found the head of the snake. Save position
+        state->snake2_row = r;
+        state->snake2_col = c;
+      }
+
+      // Add 1 to the age of the snake segment
+      if(state->board[r][c] >= SNAKE2_BASE) {
+        state->board[r][c]++;
+
+        // Remove the snake segment if it is too old
+        if((state->board[r][c] - (SNAKE2_BASE - 1)) > state->snake2_length) {
+          state->board[r][c] = 0;
+        }
+      }
+    }
+  }
+
+  // Move the snake into a new space
+  if(state->snake2_dir == DIR_NORTH) {
+    state->snake2_row--;
+  } else if(state->snake2_dir == DIR_SOUTH) {
+    state->snake2_row++;
+  } else if(state->snake2_dir == DIR_EAST) {
+    state->snake2_col++;
+  } else if(state->snake2_dir == DIR_WEST) {
+    state->snake2_col--;
+  }
+
+  int row = state->snake2_row;
+  int col = state->snake2_col;
+
+  // Check for edge collisions
+  if(row < 0 || row >= BOARD_HEIGHT || col < 0 || col >= BOARD_WIDTH) {
+    return false;
+  }
+
+  // Check for snake collisions
+  if(state->board[row][col] > 0) {
+    return false;
+  }
+
+  // Check for apple collisions
+  if(state->board[row][col] < 0) {
+    // snake gets longer
+    state->snake2_length++;
+  }
+
+  // Add the snake's new position
+  state->board[row][col] = SNAKE2_BASE;
+  return true;
+}
+
+/**
+ * "Age" every apple on the board.
+ */
+static void age_apples(game_state_t* state) {
+  for(int r=0; r<BOARD_HEIGHT; r++) {
+    for(int c=0; c<BOARD_WIDTH; c++) {
+      if(state->board[r][c] < 0) {  // Add one to each apple cell
+        state->board[r][c]++;
+      }
+    }
+  }
+}
+
+/**
+ * Add an apple at a random empty cell.
+ */
+static void generate_apple(game_state_t* state) {
+  bool inserted = false;
+  // Repeatedly try to insert an apple at a random empty cell
+  while(!inserted) {
+    int r = rng_next(&state->rng_state) % BOARD_HEIGHT;
+    int c = rng_next(&state->rng_state) % BOARD_WIDTH;
+
+    // If the cell is empty, add an apple
+    if(state->board[r][c] == 0) {
+      // Pick a random age between apple_age/2 and apple_age*1.5
+      // Negative numbers represent apples, so negate the whole value
+      int apple_age = state->apple_age;
+      state->board[r][c] = -((rng_next(&state->rng_state) % apple_age) + apple_age / 2);
+      inserted = true;
+    }
+  }
+}
+
+/**
+ * Advance a game by one tick.
+ */
+bool game_step(game_state_t* state, const game_inputs_t* inputs) {
+  if(state->over) return false;
+
+  state->snake1_dir = inputs->snake1_dir;
+  state->snake2_dir = inputs->snake2_dir;
+
+  bool changed = false;
+
+  if(state->snake1_timer == 0) {
+    if(!move_snake1(state)) state->over = true;
+    state->snake1_timer = snake_interval(state->snake1_dir);
+    changed = true;
+  }
+
+  if(!state->over && state->snake2_timer == 0) {
+    if(!move_snake2(state)) state->over = true;
+    state->snake2_timer = snake_interval(state->snake2_dir);
+    changed = true;
+  }
+
+  if(!state->over && state->apple_timer == 0) {
+    age_apples(state);
+    state->apple_timer = APPLE_UPDATE_INTERVAL / GAME_TICK_INTERVAL;
+    changed = true;
+  }
+
+  if(!state->over && state->generate_apple_timer == 0) {
+    generate_apple(state);
+    state->generate_apple_timer = GENERATE_APPLE_INTERVAL / GAME_TICK_INTERVAL;
+    changed = true;
+  }
+
+  state->snake1_timer--;
+  state->snake2_timer--;
+  state->apple_timer--;
+  state->generate_apple_timer--;
+  state->game_tick++;
+
+  return changed;
+}
+
+/**
+ * Start taking copy-on-write forks of a game.
+ */
+void game_cow_open(game_cow_t* cow, const game_state_t* state) {
+  cow->fd = -1;
+  cow->mapped = false;
+  cow->source = state;
+
+#if defined(__linux__)
+  // Forks map whole pages
+  size_t page = sysconf(_SC_PAGESIZE);
+  cow->size = (sizeof(game_state_t) + page - 1) / page * page;
+
+  int fd = memfd_create("snake-game", MFD_CLOEXEC);
+  if(fd == -1) return;
+
+  if(ftruncate(fd, cow->size) == -1 || pwrite(fd, state, sizeof(game_state_t), 0) != sizeof(game_state_t)) {
+    close(fd);
+    return;
+  }
+  cow->fd = fd;
+  cow->mapped = true;
+#else
+  cow->size = sizeof(game_state_t);
+#endif
+}
+
+/**
+ * Fork a game.
+ */
+game_state_t* game_cow_fork(game_cow_t* cow) {
+#if defined(__linux__)
+  if(cow->mapped) {
+    void* fork = mmap(NULL, cow->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, cow->fd, 0);
+    return fork == MAP_FAILED ? NULL : fork;
+  }
+#endif
+
+  game_state_t* fork = malloc(sizeof(game_state_t));
+  if(fork != NULL) {
+    game_snapshot(cow->source, fork);
+  }
+  return fork;
+}
+
+/**
+ * Throw away a fork.
+ */
+void game_cow_release(game_cow_t* cow, game_state_t* fork) {
+  if(fork == NULL) return;
+
+#if defined(__linux__)
+  if(cow->mapped) {
+    munmap(fork, cow->size);
+    return;
+  }
+#endif
+
+  free(fork);
+}
+
+/**
+ * Stop taking forks of a game.
+ */
+void game_cow_close(game_cow_t* cow) {
+  if(cow->fd != -1) {
+    close(cow->fd);
+    cow->fd = -1;
+  }
+}
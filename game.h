@@ -0,0 +1,149 @@
+#ifndef GAME_H
+#define GAME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "protocol.h"
+
+// Game parameters, in milliseconds where they are a time
+#define GAME_TICK_INTERVAL 10
+#define INIT_snake_LENGTH 4
+#define snake_HORIZONTAL_INTERVAL 200
+#define snake_VERTICAL_INTERVAL 300
+#define APPLE_UPDATE_INTERVAL 120
+#define GENERATE_APPLE_INTERVAL 2000
+#define INIT_APPLE_AGE 120
+
+/**
+ * Everything about a match that the game logic reads or writes. It holds no
+ * pointers, so copying it with memcpy gives an independent game that can be
+ * stepped without affecting the original.
+ *
+ * The board is a grid of cells. Zero represents an empty cell. Positive
+ * numbers represent snake cells, which count up at each move until they reach
+ * the snake's length. Negative numbers represent apple cells, which count up
+ * as they age.
+ */
+typedef struct game_state {
+  int board[BOARD_HEIGHT][BOARD_WIDTH];
+
+  // snake parameters. The rows and columns are where each head was put by
+  // its most recent move.
+  int snake1_dir;
+  int snake2_dir;
+  int snake1_length;
+  int snake2_length;
+  int snake1_row;
+  int snake1_col;
+  int snake2_row;
+  int snake2_col;
+
+  // Number of ticks until each part of the game next updates
+  int snake1_timer;
+  int snake2_timer;
+  int apple_timer;
+  int generate_apple_timer;
+
+  // Apple parameters
+  int apple_age;
+
+  // The number of ticks the game has advanced
+  uint32_t game_tick;
+
+  // State of the random number generator used to place apples
+  uint64_t rng_state;
+
+  // Has a snake crashed? Stepping a game that is over does nothing.
+  bool over;
+} game_state_t;
+
+/**
+ * The directions the players have chosen for one tick.
+ */
+typedef struct game_inputs {
+  int snake1_dir;
+  int snake2_dir;
+} game_inputs_t;
+
+/**
+ * Put a game in its starting position, with both snakes in the middle of the
+ * board heading north.
+ *
+ * \param state   The game to reset
+ * \param seed    The seed for the random number generator that places apples
+ */
+void game_reset(game_state_t* state, uint64_t seed);
+
+/**
+ * Advance a game by one tick. Each part of the game updates on the ticks
+ * where its timer runs out. Everything here depends only on the state and the
+ * inputs, so stepping the same inputs from the same state always produces
+ * the same game.
+ *
+ * \param state   The game to advance
+ * \param inputs  The directions the snakes head in from this tick on
+ *
+ * \returns       true if the board changed during this tick.
+ */
+bool game_step(game_state_t* state, const game_inputs_t* inputs);
+
+/**
+ * Take a copy of a game that can be restored later.
+ */
+static inline void game_snapshot(const game_state_t* state, game_state_t* snapshot) {
+  *snapshot = *state;
+}
+
+/**
+ * Put a game back the way it was when a snapshot was taken.
+ */
+static inline void game_restore(game_state_t* state, const game_state_t* snapshot) {
+  *state = *snapshot;
+}
+
+/**
+ * A game that many short-lived forks are taken from. On Linux the state is
+ * kept in a memory file, and each fork maps it copy-on-write, so a fork only
+ * copies the pages its steps write to. That is cheaper than a copy when the
+ * board is large and each fork is only stepped a few times. Elsewhere, or if
+ * the memory file can't be made, each fork is a plain copy.
+ */
+typedef struct game_cow {
+  int fd;                       //< The memory file, or -1 once closed
+  bool mapped;                  //< Are forks mappings of the memory file?
+  size_t size;                  //< Size of each fork's mapping
+  const game_state_t* source;   //< The game that forks are copied from without one
+} game_cow_t;
+
+/**
+ * Start taking copy-on-write forks of a game. Forks from the memory file
+ * start from the game as it is now, whatever happens to it later. Without
+ * the memory file, each fork is copied from the game when it is taken, so
+ * the game must not change until game_cow_close is called.
+ *
+ * \param cow     The forks' source to set up
+ * \param state   The game to fork
+ */
+void game_cow_open(game_cow_t* cow, const game_state_t* state);
+
+/**
+ * Fork a game. The fork can be stepped like any other game.
+ *
+ * \returns   The fork, or NULL if there is no memory for it.
+ */
+game_state_t* game_cow_fork(game_cow_t* cow);
+
+/**
+ * Throw away a fork.
+ */
+void game_cow_release(game_cow_t* cow, game_state_t* fork);
+
+/**
+ * Stop taking forks of a game. Forks that have not been released stay valid,
+ * and must still be released with game_cow_release.
+ */
+void game_cow_close(game_cow_t* cow);
+
+#endif
@@ -0,0 +1,245 @@
+#include "keyframe.h"
+
+#include <limits.h>
+#include <string.h>
+
+#include "protocol.h"
+
+// How far a step in each direction moves, indexed by the DIR_ values
+static const int step_rows[4] = { -1, 0, 1, 0 };
+static const int step_cols[4] = { 0, 1, 0, -1 };
+
+// Most rows of a board are empty, so they are compared with this to skip them
+static const int empty_row[AREA_WIDTH];
+
+/**
+ * Bytes being written, which stop at the end of the space for them.
+ */
+typedef struct writer {
+  uint8_t* pos;
+  uint8_t* end;
+} writer_t;
+
+/**
+ * Bytes being read.
+ */
+typedef struct reader {
+  const uint8_t* pos;
+  const uint8_t* end;
+} reader_t;
+
+/**
+ * Write a varint.
+ *
+ * \returns   false if there is no space for it.
+ */
+static bool put_varint(writer_t* w, uint32_t value) {
+  do {
+    if(w->pos == w->end) return false;
+    uint8_t byte = value & 0x7f;
+    value >>= 7;
+    *w->pos++ = byte | (value != 0 ? 0x80 : 0);
+  } while(value != 0);
+  return true;
+}
+
+/**
+ * Read a varint.
+ *
+ * \returns   false if it runs past the end, or doesn't fit in 32 bits.
+ */
+static bool get_varint(reader_t* r, uint32_t* value) {
+  *value = 0;
+  for(int shift=0; shift<35; shift+=7) {
+    if(r->pos == r->end) return false;
+    uint8_t byte = *r->pos++;
+    if(shift == 28 && byte > 0x0f) return false;
+    *value |= (uint32_t)(byte & 0x7f) << shift;
+    if((byte & 0x80) == 0) return true;
+  }
+  return false;
+}
+
+/**
+ * Encode every cell as an int.
+ */
+static size_t keyframe_encode_raw(const int* cells, int height, int width, int stride, uint8_t* out) {
+  out[0] = KEYFRAME_RAW;
+  for(int r=0; r<height; r++) {
+    memcpy(out + 1 + r * width * sizeof(int), &cells[r * stride], width * sizeof(int));
+  }
+  return KEYFRAME_MAX_SIZE(height * width);
+}
+
+/**
+ * Encode the chain that starts at a cell, marking the cells it covers.
+ *
+ * \returns   false if there is no space for it.
+ */
+static bool put_chain(writer_t* w, const int* cells, int height, int width, int stride,
+                      uint8_t* covered, int row, int col) {
+  int value = cells[row * stride + col];
+  covered[(row * width + col) / 8] |= 1 << ((row * width + col) % 8);
+  if(!put_varint(w, row * width + col + 1) || !put_varint(w, value)) return false;
+
+  int dir = -1;
+  uint32_t steps = 0;
+  while(value < INT_MAX) {
+    // Look for the next cell straight ahead first, to keep the run going
+    int next = -1;
+    for(int i=-1; i<4 && next == -1; i++) {
+      int d = (i == -1) ? dir : i;
+      if(d == -1) continue;
+      int r = row + step_rows[d];
+      int c = col + step_cols[d];
+      if(r < 0 || r >= height || c < 0 || c >= width) continue;
+      bool done = covered[(r * width + c) / 8] & (1 << ((r * width + c) % 8));
+      if(!done && cells[r * stride + c] == value + 1) next = d;
+    }
+    if(next == -1) break;
+
+    if(next != dir && steps > 0) {
+      if(!put_varint(w, steps << 2 | dir)) return false;
+      steps = 0;
+    }
+    dir = next;
+    steps++;
+    row += step_rows[dir];
+    col += step_cols[dir];
+    value++;
+    covered[(row * width + col) / 8] |= 1 << ((row * width + col) % 8);
+  }
+
+  if(steps > 0 && !put_varint(w, steps << 2 | dir)) return false;
+  return put_varint(w, 0);
+}
+
+/**
+ * Encode the snakes as chains and the apples as a list.
+ *
+ * \returns   The length of the encoding, or zero if it doesn't fit before
+ *            the end.
+ */
+static size_t keyframe_encode_packed(const int* cells, int height, int width, int stride,
+                                     uint8_t* out, uint8_t* end) {
+  // Which cells a chain has already covered
+  uint8_t covered[(AREA_HEIGHT * AREA_WIDTH + 7) / 8];
+  memset(covered, 0, (height * width + 7) / 8);
+
+  writer_t w = { .pos = out, .end = end };
+  if(!put_varint(&w, KEYFRAME_PACKED)) return 0;
+
+  // Start a chain at each cell that doesn't follow on from a neighbor, like
+  // a snake's head or where a snake enters the block. Then start one at any
+  // cell that is left over, which a board from a game never has.
+  for(int pass=0; pass<2; pass++) {
+    for(int r=0; r<height; r++) {
+      if(memcmp(&cells[r * stride], empty_row, width * sizeof(int)) == 0) continue;
+      for(int c=0; c<width; c++) {
+        int value = cells[r * stride + c];
+        if(value <= 0 || (covered[(r * width + c) / 8] & (1 << ((r * width + c) % 8)))) continue;
+
+        bool start = true;
+        for(int d=0; d<4 && pass == 0 && start; d++) {
+          int nr = r + step_rows[d];
+          int nc = c + step_cols[d];
+          if(nr >= 0 && nr < height && nc >= 0 && nc < width && cells[nr * stride + nc] == value - 1) {
+            start = false;
+          }
+        }
+        if(start && !put_chain(&w, cells, height, width, stride, covered, r, c)) return 0;
+      }
+    }
+  }
+  if(!put_varint(&w, 0)) return 0;
+
+  uint32_t next = 0;
+  for(int r=0; r<height; r++) {
+    if(memcmp(&cells[r * stride], empty_row, width * sizeof(int)) == 0) continue;
+    for(int c=0; c<width; c++) {
+      int value = cells[r * stride + c];
+      if(value >= 0) continue;
+
+      uint32_t pos = r * width + c;
+      if(!put_varint(&w, pos - next) || !put_varint(&w, (uint32_t)-(int64_t)value)) return 0;
+      next = pos + 1;
+    }
+  }
+
+  return w.pos - out;
+}
+
+/**
+ * Encode a block of board cells as compactly as possible.
+ */
+size_t keyframe_encode(const int* cells, int height, int width, int stride, uint8_t* out) {
+  // Only pack the cells if that comes out smaller
+  uint8_t* end = out + KEYFRAME_MAX_SIZE(height * width) - 1;
+  size_t length = keyframe_encode_packed(cells, height, width, stride, out, end);
+  if(length == 0) {
+    length = keyframe_encode_raw(cells, height, width, stride, out);
+  }
+  return length;
+}
+
+/**
+ * Decode a block of board cells encoded by keyframe_encode.
+ */
+bool keyframe_decode(const uint8_t* in, size_t length, int* cells, int height, int width, int stride) {
+  if(length == 0) return false;
+
+  uint32_t size = height * width;
+  if(in[0] == KEYFRAME_RAW) {
+    if(length != KEYFRAME_MAX_SIZE(size)) return false;
+    for(int r=0; r<height; r++) {
+      memcpy(&cells[r * stride], in + 1 + r * width * sizeof(int), width * sizeof(int));
+    }
+    return true;
+  }
+  if(in[0] != KEYFRAME_PACKED) return false;
+
+  for(int r=0; r<height; r++) {
+    memset(&cells[r * stride], 0, width * sizeof(int));
+  }
+
+  reader_t rd = { .pos = in + 1, .end = in + length };
+  while(true) {
+    uint32_t start;
+    if(!get_varint(&rd, &start)) return false;
+    if(start == 0) break;
+    if(start > size) return false;
+
+    uint32_t value;
+    if(!get_varint(&rd, &value) || value == 0 || value > INT_MAX) return false;
+    int row = (start - 1) / width;
+    int col = (start - 1) % width;
+    cells[row * stride + col] = value;
+
+    while(true) {
+      uint32_t run;
+      if(!get_varint(&rd, &run)) return false;
+      if(run == 0) break;
+
+      int dir = run & 3;
+      for(uint32_t step=0; step<(run >> 2); step++) {
+        row += step_rows[dir];
+        col += step_cols[dir];
+        if(row < 0 || row >= height || col < 0 || col >= width || value == INT_MAX) return false;
+        cells[row * stride + col] = ++value;
+      }
+    }
+  }
+
+  uint32_t next = 0;
+  while(rd.pos != rd.end) {
+    uint32_t gap;
+    uint32_t age;
+    if(!get_varint(&rd, &gap) || !get_varint(&rd, &age)) return false;
+    if(gap >= size - next || age == 0 || age > (uint32_t)INT_MAX + 1) return false;
+
+    uint32_t pos = next + gap;
+    cells[(pos / width) * stride + pos % width] = (int)-(int64_t)age;
+    next = pos + 1;
+  }
+  return true;
+}
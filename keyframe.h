@@ -0,0 +1,59 @@
+#ifndef KEYFRAME_H
+#define KEYFRAME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Ways the cells of a keyframe can be encoded, which its first byte gives
+#define KEYFRAME_RAW 0      //< Every cell as an int, row by row
+#define KEYFRAME_PACKED 1   //< Snake chains and a list of apples, described below
+
+// Largest encoding of a keyframe with a number of cells. The packed encoding
+// is only used when it is smaller than the raw one.
+#define KEYFRAME_MAX_SIZE(cells) (1 + (cells) * sizeof(int))
+
+/**
+ * Encode a block of board cells as compactly as possible. Almost every cell
+ * of a board is empty, so the packed encoding only describes the others,
+ * using varints (seven bits to a byte, least significant first):
+ *
+ * - Chains of cells, each starting with the position of its first cell
+ *   (row * width + column) plus one, then that cell's value, then its runs,
+ *   each as steps << 2 | direction, and then a zero. Each step moves one cell
+ *   in a DIR_ direction to a cell whose value is one more. A snake's
+ *   segments count up from its head, so a snake is one chain with a run for
+ *   each straight stretch of its body. A zero ends the chains.
+ * - Apples in row order until the end of the encoding, each as the number of
+ *   cells since the one after the previous apple, then the apple's value
+ *   negated.
+ *
+ * Every other cell is empty. A block where that comes out bigger than the
+ * raw encoding, such as one that isn't from a game, is sent raw instead.
+ *
+ * \param cells   The first cell of the block
+ * \param height  Number of rows in the block, at most AREA_HEIGHT
+ * \param width   Number of columns in the block, at most AREA_WIDTH
+ * \param stride  Number of cells from the start of one row to the next
+ * \param out     Space for KEYFRAME_MAX_SIZE(height * width) bytes
+ *
+ * \returns       The length of the encoding.
+ */
+size_t keyframe_encode(const int* cells, int height, int width, int stride, uint8_t* out);
+
+/**
+ * Decode a block of board cells encoded by keyframe_encode.
+ *
+ * \param in      The encoding
+ * \param length  The length of the encoding
+ * \param cells   The first cell of the block to write
+ * \param height  Number of rows in the block
+ * \param width   Number of columns in the block
+ * \param stride  Number of cells from the start of one row to the next
+ *
+ * \returns       false if the encoding is malformed or doesn't fit the block,
+ *                in which case some cells may have been written.
+ */
+bool keyframe_decode(const uint8_t* in, size_t length, int* cells, int height, int width, int stride);
+
+#endif
@@ -0,0 +1,1124 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "area.h"
+#include "protocol.h"
+#include "socket.h"
+#include "udp.h"
+#include "util.h"
+
+// Default test configuration
+#define DEFAULT_CLIENTS 1000
+#define DEFAULT_DURATION 10
+#define DEFAULT_LATE_MS 10      // One game tick
+#define DEFAULT_SERVER "./snake"
+
+// The startup benchmark gives up on a match that hasn't started or ended
+// after this many milliseconds
+#define MATCH_TIMEOUT_MS 30000
+
+// Latencies are counted in buckets of this many microseconds, up to one second
+#define LATENCY_BUCKET_US 10
+#define LATENCY_BUCKETS 100000
+
+// Largest payload the server sends: a full area of the board
+#define MAX_PAYLOAD AREA_PAYLOAD_MAX
+
+// Amount read from a socket at a time
+#define READ_SIZE 65536
+
+// How long a lost TCP segment holds up the stream. Linux never waits less
+// than 200 ms to retransmit, and the few small messages sent each tick rarely
+// give fast retransmit enough to go on.
+#define DEFAULT_RETRANSMIT_MS 200
+
+// Players ask for a keyframe again if the last one they asked for is this
+// many milliseconds late
+#define KEYFRAME_RETRY_MS 100
+
+/**
+ * Data held back by a simulated link, to be delivered once it is ready.
+ */
+typedef struct delayed {
+  struct delayed* next;
+  uint64_t ready_us;    //< When the data arrives, from time_us
+  size_t length;
+  uint8_t data[];
+} delayed_t;
+
+/**
+ * One direction of a player's simulated link to the server. Data that goes
+ * over it arrives late by the configured delay, and some of it is lost. A
+ * lost datagram is gone, but a lost TCP segment is retransmitted, so it and
+ * everything behind it arrive late instead.
+ */
+typedef struct link {
+  delayed_t* head;
+  delayed_t* tail;
+  uint64_t last_ready_us;   //< When the newest data on a TCP link arrives
+} link_t;
+
+/**
+ * One simulated client. The first two clients are players driven by a simple
+ * bot, and the rest are spectators.
+ */
+typedef struct client {
+  // The client's non-blocking socket, or -1 once it has disconnected
+  int fd;
+
+  // Is this client playing, and which snake does it control?
+  bool player;
+  int snake;
+
+  // The message being received. The payload is only kept for players.
+  msg_header_t header;
+  size_t header_got;
+  size_t payload_got;
+
+  // Players track their area of the board so the bot can steer
+  uint8_t* payload;
+  int (*board)[BOARD_WIDTH];
+  area_t area;
+  int dir;
+
+  // Board updates and bytes received, and the ticks of the first and latest
+  // updates
+  size_t updates;
+  size_t bytes;
+  uint32_t first_update_tick;
+  uint32_t last_update_tick;
+
+  // When the player last asked for a keyframe, or zero if none is on its way
+  uint64_t keyframe_requested_us;
+
+  // Players using UDP have a datagram socket, or -1. Their commands are
+  // repeated until the server acknowledges them, and datagrams older than
+  // the last one used are thrown away.
+  int udp_fd;
+  udp_inputs_t inputs;
+  uint32_t udp_seq;
+
+  // What the player receives and sends, when the link is simulated. TCP and
+  // UDP share each direction, since they would share the same network.
+  link_t tcp_down;
+  link_t udp_down;
+  link_t tcp_up;
+  link_t udp_up;
+} client_t;
+
+client_t* clients;
+size_t num_clients;
+
+// Every message's delivery latency, and the number that took too long
+uint64_t latency[LATENCY_BUCKETS + 1];
+size_t late_updates = 0;
+uint64_t late_us;
+
+// The latency of the board updates players received, and of their turns
+// from being sent to being applied by the server
+uint64_t player_latency[LATENCY_BUCKETS + 1];
+uint64_t turn_latency[LATENCY_BUCKETS + 1];
+
+// Do players send and receive over UDP?
+bool use_udp = false;
+
+// The players' simulated link: the fraction of packets lost each way, the
+// delay each way, and how long a lost TCP segment takes to be retransmitted.
+// The link is only simulated if something is lost or delayed.
+double link_loss = 0;
+uint64_t link_delay_us = 0;
+uint64_t retransmit_us = DEFAULT_RETRANSMIT_MS * 1000;
+bool link_simulated = false;
+uint64_t link_rng;
+
+// Totals across all clients
+size_t total_messages = 0;
+size_t total_bytes = 0;
+size_t disconnects = 0;
+
+// Updates that left a player's board different from the server's
+size_t desyncs = 0;
+
+// The tick of every update player 1 received, which spectators should get too
+uint32_t* stream_ticks = NULL;
+size_t num_stream_ticks = 0;
+size_t stream_ticks_capacity = 0;
+
+// The first and last server ticks any update came from
+uint32_t first_tick = UINT32_MAX;
+uint32_t last_tick = 0;
+
+// Set once the server says the match is over
+bool game_over = false;
+
+/**
+ * Send data over a simulated link. It arrives after the link's delay, unless
+ * it is lost. A lost datagram never arrives, and a lost TCP segment is
+ * retransmitted, which holds up everything sent after it as well.
+ *
+ * \param link      The link
+ * \param data      The data
+ * \param length    The number of bytes
+ * \param datagram  Is this a UDP datagram, rather than part of a TCP stream?
+ */
+void link_push(link_t* link, const void* data, size_t length, bool datagram) {
+  bool lost = rng_next(&link_rng) < link_loss * UINT32_MAX;
+  if(lost && datagram) return;
+
+  uint64_t ready_us = time_us() + link_delay_us;
+  if(lost) ready_us += retransmit_us;
+  if(!datagram) {
+    // A stream arrives in order
+    if(ready_us < link->last_ready_us) ready_us = link->last_ready_us;
+    link->last_ready_us = ready_us;
+  }
+
+  delayed_t* d = malloc(sizeof(delayed_t) + length);
+  if(d == NULL) {
+    perror("malloc");
+    exit(2);
+  }
+  d->next = NULL;
+  d->ready_us = ready_us;
+  d->length = length;
+  memcpy(d->data, data, length);
+
+  // Everything on a link has the same delay, so it arrives in the order sent
+  // unless a lost segment holds it up, which keeps the order anyway
+  if(link->tail == NULL) {
+    link->head = d;
+  } else {
+    link->tail->next = d;
+  }
+  link->tail = d;
+}
+
+/**
+ * Take the next data off a simulated link if it has arrived.
+ *
+ * \returns   The data, to be freed by the caller, or NULL if nothing is ready.
+ */
+delayed_t* link_pop(link_t* link, uint64_t now) {
+  delayed_t* d = link->head;
+  if(d == NULL || d->ready_us > now) return NULL;
+
+  link->head = d->next;
+  if(link->head == NULL) link->tail = NULL;
+  return d;
+}
+
+/**
+ * Get the time the next data on a link arrives, or UINT64_MAX if it's empty.
+ */
+uint64_t link_next(const link_t* link) {
+  return link->head == NULL ? UINT64_MAX : link->head->ready_us;
+}
+
+/**
+ * Send data to the server from a player, over the simulated link if there is
+ * one.
+ */
+void client_write(client_t* c, const void* data, size_t length, bool datagram) {
+  if(link_simulated) {
+    link_push(datagram ? &c->udp_up : &c->tcp_up, data, length, datagram);
+  } else if(datagram) {
+    send(c->udp_fd, data, length, MSG_DONTWAIT);
+  } else if(write(c->fd, data, length) != (ssize_t)length) {
+    perror("Failed to send direction");
+  }
+}
+
+/**
+ * Send a player's packet of unacknowledged commands.
+ */
+void client_send_inputs(client_t* c) {
+  c->inputs.sent_us = time_us();
+  client_write(c, &c->inputs.packet, udp_input_size(&c->inputs.packet), true);
+}
+
+/**
+ * Send a command from a player, as a datagram once the server has welcomed
+ * a player using UDP.
+ */
+void client_send(client_t* c, const client_msg_t* msg) {
+  if(c->udp_fd != -1 && c->inputs.packet.token != 0) {
+    udp_inputs_add(&c->inputs, msg);
+    client_send_inputs(c);
+  } else {
+    client_write(c, msg, sizeof(client_msg_t), false);
+  }
+}
+
+/**
+ * Get the cell a snake would move into heading in a direction.
+ */
+void step(int dir, int* row, int* col) {
+  if(dir == DIR_NORTH) {
+    (*row)--;
+  } else if(dir == DIR_SOUTH) {
+    (*row)++;
+  } else if(dir == DIR_EAST) {
+    (*col)++;
+  } else {
+    (*col)--;
+  }
+}
+
+/**
+ * Check whether a snake can safely move into a cell.
+ */
+bool open_cell(int (*board)[BOARD_WIDTH], int row, int col) {
+  return row >= 0 && row < BOARD_HEIGHT && col >= 0 && col < BOARD_WIDTH &&
+         board[row][col] <= 0;
+}
+
+/**
+ * Pick a direction for a player's snake and send it if it changed. The bot
+ * heads for the closest apple while avoiding walls, snakes, and dead ends.
+ */
+void steer(client_t* c) {
+  // Find our snake's head and the closest apple
+  int head = (c->snake == 1) ? 1 : SNAKE2_BASE;
+  int head_row = -1;
+  int head_col = -1;
+  for(int r=0; r<BOARD_HEIGHT; r++) {
+    for(int col=0; col<BOARD_WIDTH; col++) {
+      if(c->board[r][col] == head) {
+        head_row = r;
+        head_col = col;
+      }
+    }
+  }
+  if(head_row == -1) return;
+
+  int best_dir = c->dir;
+  int best_score = INT32_MIN;
+  for(int dir=DIR_NORTH; dir<=DIR_WEST; dir++) {
+    // Turning straight back is never allowed
+    if(dir == (c->dir + 2) % 4) continue;
+
+    int row = head_row;
+    int col = head_col;
+    step(dir, &row, &col);
+    if(!open_cell(c->board, row, col)) continue;
+
+    // Prefer cells with room to keep moving, then cells closer to an apple
+    int exits = 0;
+    for(int next=DIR_NORTH; next<=DIR_WEST; next++) {
+      int next_row = row;
+      int next_col = col;
+      step(next, &next_row, &next_col);
+      if(open_cell(c->board, next_row, next_col)) exits++;
+    }
+
+    int nearest = BOARD_WIDTH + BOARD_HEIGHT;
+    for(int r=0; r<BOARD_HEIGHT; r++) {
+      for(int col2=0; col2<BOARD_WIDTH; col2++) {
+        if(c->board[r][col2] < 0) {
+          int distance = abs(r - row) + abs(col2 - col);
+          if(distance < nearest) nearest = distance;
+        }
+      }
+    }
+
+    int score = (exits > 1 ? 1000 : exits * 100) - nearest;
+    if(score > best_score) {
+      best_score = score;
+      best_dir = dir;
+    }
+  }
+
+  if(best_dir != c->dir) {
+    c->dir = best_dir;
+    client_msg_t turn = {
+      .type = CMSG_TURN,
+      .dir = best_dir,
+      .time_us = time_us()
+    };
+    client_send(c, &turn);
+  }
+}
+
+/**
+ * Remember that player 1 received an update from a tick.
+ */
+void record_stream_tick(uint32_t tick) {
+  if(num_stream_ticks == stream_ticks_capacity) {
+    stream_ticks_capacity = stream_ticks_capacity == 0 ? 1024 : stream_ticks_capacity * 2;
+    stream_ticks = realloc(stream_ticks, stream_ticks_capacity * sizeof(uint32_t));
+    if(stream_ticks == NULL) {
+      perror("realloc");
+      exit(2);
+    }
+  }
+  stream_ticks[num_stream_ticks++] = tick;
+}
+
+/**
+ * Count a latency in a histogram.
+ */
+void record_latency(uint64_t* histogram, uint64_t elapsed) {
+  size_t bucket = elapsed / LATENCY_BUCKET_US;
+  histogram[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS]++;
+}
+
+/**
+ * Record the delivery of a complete message.
+ *
+ * \param c        The client that received it
+ * \param header   The message's header
+ * \param payload  The message's payload, which is only kept for players
+ */
+void handle_message(client_t* c, const msg_header_t* header, const uint8_t* payload) {
+  total_messages++;
+
+  // The server stamps each message with the monotonic clock it shares with us
+  uint64_t elapsed = time_us() - header->time_us;
+  record_latency(latency, elapsed);
+
+  if(header->type == MSG_BOARD || header->type == MSG_DELTA) {
+    if(c->updates == 0) c->first_update_tick = header->tick;
+    c->last_update_tick = header->tick;
+    c->updates++;
+    if(elapsed > late_us) late_updates++;
+    if(header->tick < first_tick) first_tick = header->tick;
+    if(header->tick > last_tick) last_tick = header->tick;
+  }
+
+  if(!c->player) {
+    if(header->type == MSG_GAME_OVER) game_over = true;
+    return;
+  }
+
+  if(header->type == MSG_WELCOME && header->length == sizeof(welcome_t)) {
+    c->snake = ((welcome_t*)payload)->player;
+
+    // Commands go out as datagrams from now on, starting with an empty one
+    // that tells the server where to send updates
+    if(c->udp_fd != -1) {
+      udp_inputs_init(&c->inputs, ((welcome_t*)payload)->token);
+      client_send_inputs(c);
+    }
+
+  } else if((header->type == MSG_BOARD || header->type == MSG_DELTA) &&
+            area_apply(c->board, &c->area, header->type, payload, header->length)) {
+    record_latency(player_latency, elapsed);
+    if(header->type == MSG_BOARD) c->keyframe_requested_us = 0;
+
+    // Ask for a keyframe when the board goes wrong, which happens when a
+    // datagram is lost
+    if(!area_in_sync(&c->area, payload)) {
+      desyncs++;
+      uint64_t now = time_us();
+      if(c->keyframe_requested_us == 0 || now - c->keyframe_requested_us >= KEYFRAME_RETRY_MS * 1000) {
+        client_msg_t request = {
+          .type = CMSG_KEYFRAME,
+          .time_us = now
+        };
+        client_send(c, &request);
+        c->keyframe_requested_us = now;
+      }
+    }
+    if(c->snake == 1) record_stream_tick(header->tick);
+    steer(c);
+
+  } else if(header->type == MSG_PONG && header->length == sizeof(pong_t)) {
+    // The server answers each turn once it has been applied
+    const pong_t* pong = (const pong_t*)payload;
+    if(pong->type == CMSG_TURN) record_latency(turn_latency, time_us() - pong->time_us);
+
+  } else if(header->type == MSG_GAME_OVER) {
+    game_over = true;
+  }
+}
+
+/**
+ * Split data from a client's connection into messages, and handle each one
+ * that is complete.
+ *
+ * \returns   false if the server sent a bad message.
+ */
+bool client_parse(client_t* c, const uint8_t* data, size_t length) {
+  size_t pos = 0;
+  while(pos < length) {
+    size_t available = length - pos;
+    if(c->header_got < sizeof(msg_header_t)) {
+      size_t n = sizeof(msg_header_t) - c->header_got;
+      if(n > available) n = available;
+      memcpy((uint8_t*)&c->header + c->header_got, data + pos, n);
+      c->header_got += n;
+      pos += n;
+      if(c->header_got < sizeof(msg_header_t)) break;
+      if(c->header.length > MAX_PAYLOAD) return false;
+      available -= n;
+    }
+
+    size_t n = c->header.length - c->payload_got;
+    if(n > available) n = available;
+    if(c->player) {
+      memcpy(c->payload + c->payload_got, data + pos, n);
+    }
+    c->payload_got += n;
+    pos += n;
+
+    if(c->payload_got == c->header.length) {
+      handle_message(c, &c->header, c->payload);
+      c->header_got = 0;
+      c->payload_got = 0;
+    }
+  }
+  return true;
+}
+
+/**
+ * Handle a datagram the server sent a player using UDP. Datagrams older than
+ * the last one used are thrown away, just as the game does.
+ */
+void client_datagram(client_t* c, const uint8_t* data, size_t length) {
+  const udp_header_t* udp = (const udp_header_t*)data;
+  const msg_header_t* header = (const msg_header_t*)(data + sizeof(udp_header_t));
+  if(length < sizeof(udp_header_t) + sizeof(msg_header_t) ||
+     length != sizeof(udp_header_t) + sizeof(msg_header_t) + header->length) {
+    return;
+  }
+
+  udp_inputs_ack(&c->inputs, udp->ack);
+  if(udp->seq <= c->udp_seq) return;
+  c->udp_seq = udp->seq;
+
+  handle_message(c, header, (const uint8_t*)(header + 1));
+}
+
+/**
+ * Read everything waiting on a client's socket and handle each complete
+ * message. A player's data is held back first if the link is simulated.
+ *
+ * \returns   false if the connection closed or the server sent a bad message.
+ */
+bool client_receive(client_t* c) {
+  static uint8_t data[READ_SIZE];
+
+  while(true) {
+    ssize_t rc = read(c->fd, data, sizeof(data));
+    if(rc == 0) return false;
+    if(rc == -1) {
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    c->bytes += rc;
+    total_bytes += rc;
+
+    if(c->player && link_simulated) {
+      link_push(&c->tcp_down, data, rc, false);
+    } else if(!client_parse(c, data, rc)) {
+      return false;
+    }
+  }
+}
+
+/**
+ * Read every datagram waiting for a player using UDP.
+ */
+void client_receive_datagrams(client_t* c) {
+  static uint8_t data[UDP_DATAGRAM_MAX];
+
+  while(true) {
+    ssize_t rc = recv(c->udp_fd, data, sizeof(data), MSG_DONTWAIT);
+    if(rc == -1) {
+      if(errno == EINTR) continue;
+      return;
+    }
+    c->bytes += rc;
+    total_bytes += rc;
+
+    if(link_simulated) {
+      link_push(&c->udp_down, data, rc, true);
+    } else {
+      client_datagram(c, data, rc);
+    }
+  }
+}
+
+/**
+ * Deliver whatever a player's simulated links are ready to deliver.
+ *
+ * \returns   false if the server sent a bad message.
+ */
+bool client_deliver(client_t* c) {
+  uint64_t now = time_us();
+  delayed_t* d;
+  while((d = link_pop(&c->udp_down, now)) != NULL) {
+    client_datagram(c, d->data, d->length);
+    free(d);
+  }
+  while((d = link_pop(&c->udp_up, now)) != NULL) {
+    send(c->udp_fd, d->data, d->length, MSG_DONTWAIT);
+    free(d);
+  }
+  while((d = link_pop(&c->tcp_up, now)) != NULL) {
+    if(write(c->fd, d->data, d->length) != (ssize_t)d->length) {
+      perror("Failed to send direction");
+    }
+    free(d);
+  }
+
+  bool ok = true;
+  while((d = link_pop(&c->tcp_down, now)) != NULL) {
+    ok = ok && client_parse(c, d->data, d->length);
+    free(d);
+  }
+  return ok;
+}
+
+/**
+ * Connect a client and send its hello. Sockets are connected in blocking
+ * mode, then switched to non-blocking for the test.
+ */
+bool client_connect(client_t* c, char* host, unsigned short port, bool player) {
+  memset(c, 0, sizeof(client_t));
+  c->fd = socket_connect(host, port);
+  if(c->fd == -1) return false;
+
+  hello_t hello = {
+    .magic = PROTOCOL_MAGIC,
+    .role = player ? ROLE_PLAYER : ROLE_SPECTATOR
+  };
+  if(write(c->fd, &hello, sizeof(hello)) != sizeof(hello)) {
+    close(c->fd);
+    return false;
+  }
+  fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+
+  c->player = player;
+  c->dir = DIR_NORTH;
+  c->udp_fd = -1;
+  if(player && use_udp) {
+    c->udp_fd = udp_socket_connect(host, port);
+    if(c->udp_fd == -1) {
+      close(c->fd);
+      return false;
+    }
+  }
+  if(player) {
+    c->payload = malloc(MAX_PAYLOAD);
+    c->board = calloc(BOARD_HEIGHT, sizeof(*c->board));
+    if(c->payload == NULL || c->board == NULL) {
+      perror("malloc");
+      exit(2);
+    }
+  }
+  return true;
+}
+
+/**
+ * Start a dedicated server with recording turned off and read the port it
+ * is listening on.
+ *
+ * \param path  The snake binary to run
+ * \param port  The server's port is written here
+ *
+ * \returns     The server's process id, or -1 on failure.
+ */
+pid_t start_server(const char* path, unsigned short* port) {
+  int fds[2];
+  if(pipe(fds) == -1) return -1;
+
+  pid_t pid = fork();
+  if(pid == -1) return -1;
+
+  if(pid == 0) {
+    dup2(fds[1], STDOUT_FILENO);
+    close(fds[0]);
+    close(fds[1]);
+    setenv("SNAKE_REPLAY", "", 1);
+    setenv("SNAKE_RESULTS", "", 1);
+    execl(path, path, "serve", "0", NULL);
+    perror("Failed to run server");
+    exit(2);
+  }
+
+  close(fds[1]);
+  FILE* out = fdopen(fds[0], "r");
+  char line[128];
+  if(out == NULL || fgets(line, sizeof(line), out) == NULL ||
+     sscanf(line, "Server listening on port %hu", port) != 1) {
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return -1;
+  }
+
+  // The server's final result line is not needed, so stop reading
+  fclose(out);
+  return pid;
+}
+
+/**
+ * Get the CPU time a process has used, in seconds. This reads /proc, so it is
+ * only available on Linux.
+ *
+ * \returns   The CPU time, or -1 if it is not available.
+ */
+double process_cpu_time(pid_t pid) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  FILE* stat = fopen(path, "r");
+  if(stat == NULL) return -1;
+
+  // Skip past the command name, which may contain spaces, to the fields after
+  char buffer[1024];
+  size_t length = fread(buffer, 1, sizeof(buffer) - 1, stat);
+  fclose(stat);
+  buffer[length] = '\0';
+  char* fields = strrchr(buffer, ')');
+  if(fields == NULL) return -1;
+
+  // utime and stime are the 12th and 13th fields after the command name
+  unsigned long utime;
+  unsigned long stime;
+  if(sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+            &utime, &stime) != 2) {
+    return -1;
+  }
+  return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+/**
+ * Get the number of latencies in a histogram.
+ */
+uint64_t latency_count(const uint64_t* histogram) {
+  uint64_t count = 0;
+  for(size_t i=0; i<=LATENCY_BUCKETS; i++) {
+    count += histogram[i];
+  }
+  return count;
+}
+
+/**
+ * Get the latency below which a fraction of the latencies in a histogram
+ * fall.
+ */
+double latency_percentile(const uint64_t* histogram, double fraction) {
+  uint64_t count = latency_count(histogram);
+  uint64_t target = count * fraction;
+  uint64_t seen = 0;
+  for(size_t i=0; i<=LATENCY_BUCKETS; i++) {
+    seen += histogram[i];
+    if(seen > target) return (i + 1) * LATENCY_BUCKET_US / 1000.0;
+  }
+  return LATENCY_BUCKETS * LATENCY_BUCKET_US / 1000.0;
+}
+
+/**
+ * Get a percentile of a histogram, in milliseconds, no higher than the
+ * largest latency counted in it. Percentiles are rounded up to the end of
+ * their bucket, which can otherwise put them above it.
+ */
+double percentile_at_most(const uint64_t* histogram, double fraction, uint64_t max_us) {
+  double percentile = latency_percentile(histogram, fraction);
+  return percentile < max_us / 1000.0 ? percentile : max_us / 1000.0;
+}
+
+/**
+ * Connect two players to a server and wait for the first update of their
+ * match. Their messages are parsed as a spectator's are, so no bot steers
+ * them. Once the match has started, the first player turns toward the
+ * second player's snake, so the match is over within a few seconds, and the
+ * players stay until it is.
+ *
+ * \returns   The microseconds from the second player connecting to the first
+ *            update reaching either player, or 0 if the match didn't start
+ *            and end in time.
+ */
+uint64_t time_match_start(char* host, unsigned short port) {
+  client_t players[2];
+  uint64_t connected = 0;
+  for(int i=0; i<2; i++) {
+    memset(&players[i], 0, sizeof(client_t));
+    players[i].udp_fd = -1;
+    connected = time_us();
+    players[i].fd = socket_connect(host, port);
+    hello_t hello = {
+      .magic = PROTOCOL_MAGIC,
+      .role = ROLE_PLAYER
+    };
+    if(players[i].fd == -1 || write(players[i].fd, &hello, sizeof(hello)) != sizeof(hello)) {
+      if(players[i].fd != -1) close(players[i].fd);
+      if(i == 1) close(players[0].fd);
+      return 0;
+    }
+    fcntl(players[i].fd, F_SETFL, fcntl(players[i].fd, F_GETFL) | O_NONBLOCK);
+  }
+
+  uint64_t started = 0;
+  uint64_t deadline = time_ms() + MATCH_TIMEOUT_MS;
+  game_over = false;
+  bool connected_both = true;
+  while(!game_over && connected_both && time_ms() < deadline) {
+    struct pollfd fds[2] = {
+      { .fd = players[0].fd, .events = POLLIN },
+      { .fd = players[1].fd, .events = POLLIN }
+    };
+    if(poll(fds, 2, 10) == -1 && errno != EINTR) break;
+    for(int i=0; i<2; i++) {
+      if(fds[i].revents != 0 && !client_receive(&players[i])) connected_both = false;
+    }
+
+    if(started == 0 && players[0].updates + players[1].updates > 0) {
+      started = time_us();
+      client_msg_t turn = {
+        .type = CMSG_TURN,
+        .dir = DIR_EAST,
+        .time_us = started
+      };
+      client_send(&players[0], &turn);
+    }
+  }
+
+  close(players[0].fd);
+  close(players[1].fd);
+  return game_over && started != 0 ? started - connected : 0;
+}
+
+/**
+ * Play matches one after another, and report how long each took to start.
+ * A server that keeps a pool of rooms plays every match. Without one, a new
+ * server is started for each match, as a server plays only one, and the
+ * time it takes to start listening is reported too.
+ *
+ * \param matches      The number of matches
+ * \param server_path  The snake binary to run, if no server was given
+ * \param host         The server's host, if one was given
+ * \param port         The server's port, or 0 to start one
+ */
+void startup_benchmark(size_t matches, const char* server_path, char* host, unsigned short port) {
+  const char* rooms = getenv("SNAKE_ROOMS");
+  bool pooled = port != 0 || (rooms != NULL && atoi(rooms) > 0);
+  bool own_server = port == 0;
+  pid_t server_pid = -1;
+
+  static uint64_t server_latency[LATENCY_BUCKETS + 1];
+  static uint64_t start_latency[LATENCY_BUCKETS + 1];
+  uint64_t server_max = 0;
+  uint64_t start_max = 0;
+  size_t failed = 0;
+
+  for(size_t i=0; i<matches; i++) {
+    if(own_server && (!pooled || server_pid == -1)) {
+      uint64_t spawned = time_us();
+      server_pid = start_server(server_path, &port);
+      if(server_pid == -1) {
+        fprintf(stderr, "Failed to start a server with %s\n", server_path);
+        exit(2);
+      }
+      uint64_t elapsed = time_us() - spawned;
+      record_latency(server_latency, elapsed);
+      if(elapsed > server_max) server_max = elapsed;
+    }
+
+    uint64_t elapsed = time_match_start(host, port);
+    if(elapsed == 0) {
+      failed++;
+    } else {
+      record_latency(start_latency, elapsed);
+      if(elapsed > start_max) start_max = elapsed;
+    }
+
+    if(own_server && !pooled) {
+      kill(server_pid, SIGTERM);
+      waitpid(server_pid, NULL, 0);
+    }
+  }
+
+  printf("%zu matches in a row, %s\n", matches,
+         pooled ? "on one server with a pool of rooms" : "each on a new server");
+  if(own_server && !pooled) {
+    printf("Server start (ms):  p50 %.2f  p90 %.2f  max %.2f\n",
+           percentile_at_most(server_latency, 0.5, server_max), percentile_at_most(server_latency, 0.9, server_max),
+           server_max / 1000.0);
+  }
+  if(latency_count(start_latency) > 0) {
+    printf("First update (ms):  p50 %.2f  p90 %.2f  max %.2f, after the second player connected\n",
+           percentile_at_most(start_latency, 0.5, start_max), percentile_at_most(start_latency, 0.9, start_max),
+           start_max / 1000.0);
+  }
+  printf("Failed:             %zu\n", failed);
+
+  if(own_server && pooled) {
+    kill(server_pid, SIGTERM);
+    waitpid(server_pid, NULL, 0);
+  }
+}
+
+void usage(const char* name) {
+  fprintf(stderr, "Usage: %s [-c clients] [-d seconds] [-l late ms] [-x server binary] [link options]\n", name);
+  fprintf(stderr, "       %s -s host:port [-p server pid] [-c clients] [-d seconds] [-l late ms] [link options]\n", name);
+  fprintf(stderr, "       %s -m matches [-x server binary | -s host:port]\n", name);
+  fprintf(stderr, "\nWithout -s, a dedicated server is started from the server binary (default %s).\n",
+          DEFAULT_SERVER);
+  fprintf(stderr, "The first two clients play, and the rest watch.\n");
+  fprintf(stderr, "\nWith -m, two players play that many short matches in a row instead, and the\n");
+  fprintf(stderr, "time from connecting to each match's first update is reported. A server is\n");
+  fprintf(stderr, "started for each match unless SNAKE_ROOMS gives it a pool of rooms.\n");
+  fprintf(stderr, "\nLink options:\n");
+  fprintf(stderr, "  -u          Players send and receive over UDP\n");
+  fprintf(stderr, "  -L percent  Lose this share of the players' packets each way\n");
+  fprintf(stderr, "  -D ms       Delay the players' packets each way\n");
+  fprintf(stderr, "  -R ms       Time a lost TCP segment takes to be retransmitted (default %d)\n",
+          DEFAULT_RETRANSMIT_MS);
+  exit(1);
+}
+
+// Entry point: Starts or connects to a server, connects every client, then
+// receives updates for the length of the test and reports what it measured
+int main(int argc, char** argv) {
+  size_t clients_wanted = DEFAULT_CLIENTS;
+  size_t duration = DEFAULT_DURATION;
+  size_t late_ms = DEFAULT_LATE_MS;
+  const char* server_path = DEFAULT_SERVER;
+  char* host = "127.0.0.1";
+  unsigned short port = 0;
+  pid_t server_pid = -1;
+  size_t matches = 0;
+
+  int opt;
+  while((opt = getopt(argc, argv, "c:d:l:x:s:p:uL:D:R:m:")) != -1) {
+    if(opt == 'c') {
+      clients_wanted = atoi(optarg);
+    } else if(opt == 'd') {
+      duration = atoi(optarg);
+    } else if(opt == 'l') {
+      late_ms = atoi(optarg);
+    } else if(opt == 'x') {
+      server_path = optarg;
+    } else if(opt == 's') {
+      char* colon = strrchr(optarg, ':');
+      if(colon == NULL) usage(argv[0]);
+      *colon = '\0';
+      host = optarg;
+      port = atoi(colon + 1);
+    } else if(opt == 'p') {
+      server_pid = atoi(optarg);
+    } else if(opt == 'u') {
+      use_udp = true;
+    } else if(opt == 'L') {
+      link_loss = atof(optarg) / 100;
+    } else if(opt == 'D') {
+      link_delay_us = atoi(optarg) * 1000;
+    } else if(opt == 'R') {
+      retransmit_us = atoi(optarg) * 1000;
+    } else if(opt == 'm') {
+      matches = atoi(optarg);
+    } else {
+      usage(argv[0]);
+    }
+  }
+  if(clients_wanted < 2 || duration == 0 || link_loss < 0 || link_loss > 1) usage(argv[0]);
+  late_us = late_ms * 1000;
+  link_simulated = link_loss > 0 || link_delay_us > 0;
+  link_rng = time_us();
+
+  // Every client needs its own socket
+  raise_fd_limit();
+  signal(SIGPIPE, SIG_IGN);
+
+  if(matches > 0) {
+    startup_benchmark(matches, server_path, host, port);
+    return 0;
+  }
+
+  bool own_server = port == 0;
+  if(own_server) {
+    server_pid = start_server(server_path, &port);
+    if(server_pid == -1) {
+      fprintf(stderr, "Failed to start a server with %s\n", server_path);
+      exit(2);
+    }
+  }
+
+  // Players using UDP also poll their datagram sockets, after every client
+  clients = malloc(clients_wanted * sizeof(client_t));
+  struct pollfd* fds = malloc((clients_wanted + 2) * sizeof(struct pollfd));
+  if(clients == NULL || fds == NULL) {
+    perror("malloc");
+    exit(2);
+  }
+
+  // Spectators connect first so they see the match from its first tick. The
+  // match starts as soon as both players have joined.
+  size_t start_connect = time_ms();
+  for(size_t i=0; i<clients_wanted; i++) {
+    bool player = i >= clients_wanted - 2;
+    if(!client_connect(&clients[num_clients], host, port, player)) {
+      perror("Failed to connect");
+      if(player) exit(2);
+      continue;
+    }
+    fds[num_clients].fd = clients[num_clients].fd;
+    fds[num_clients].events = POLLIN;
+    num_clients++;
+  }
+  printf("Connected %zu of %zu clients in %zu ms\n", num_clients, clients_wanted,
+         time_ms() - start_connect);
+
+  // The players are the last two clients
+  client_t* players = &clients[num_clients - 2];
+  size_t num_fds = num_clients;
+  for(int i=0; i<2 && use_udp; i++) {
+    fds[num_fds].fd = players[i].udp_fd;
+    fds[num_fds].events = POLLIN;
+    num_fds++;
+  }
+
+  double cpu_start = server_pid == -1 ? -1 : process_cpu_time(server_pid);
+  uint64_t start = time_us();
+  uint64_t finish = start + duration * 1000000;
+
+  while(!game_over && time_us() < finish) {
+    // Wake up in time for the next data a simulated link delivers
+    int timeout = 10;
+    uint64_t now = time_us();
+    for(int i=0; i<2 && link_simulated; i++) {
+      link_t* links[] = {&players[i].tcp_down, &players[i].udp_down, &players[i].tcp_up, &players[i].udp_up};
+      for(int n=0; n<4; n++) {
+        uint64_t next = link_next(links[n]);
+        if(next <= now) {
+          timeout = 0;
+        } else if(next - now < (uint64_t)timeout * 1000) {
+          timeout = (next - now + 999) / 1000;
+        }
+      }
+    }
+
+    if(poll(fds, num_fds, timeout) == -1 && errno != EINTR) {
+      perror("poll");
+      break;
+    }
+
+    for(int i=0; i<2 && use_udp; i++) {
+      client_t* c = &players[i];
+      if(fds[num_clients + i].revents != 0) client_receive_datagrams(c);
+
+      // Resend commands the server hasn't acknowledged, and the empty packet
+      // that tells it where to send updates until it has sent one
+      if(c->inputs.packet.token != 0 && (c->inputs.packet.count > 0 || c->udp_seq == 0) &&
+         time_us() - c->inputs.sent_us >= UDP_RESEND_INTERVAL * 1000) {
+        client_send_inputs(c);
+      }
+    }
+
+    for(size_t i=0; i<num_clients; i++) {
+      if(fds[i].fd == -1 || fds[i].revents == 0) continue;
+      if(!client_receive(&clients[i])) {
+        close(clients[i].fd);
+        clients[i].fd = -1;
+        fds[i].fd = -1;
+        disconnects++;
+      }
+    }
+
+    for(int i=0; i<2 && link_simulated; i++) {
+      if(players[i].fd != -1 && !client_deliver(&players[i])) {
+        close(players[i].fd);
+        players[i].fd = -1;
+        fds[num_clients - 2 + i].fd = -1;
+        disconnects++;
+      }
+    }
+  }
+
+  double elapsed = (time_us() - start) / 1000000.0;
+  double cpu_end = server_pid == -1 ? -1 : process_cpu_time(server_pid);
+
+  for(size_t i=0; i<num_clients; i++) {
+    if(clients[i].fd != -1) close(clients[i].fd);
+  }
+
+  // Ticks run on a fixed schedule, so the test can stop between an update
+  // reaching player 1 and reaching the spectators. Updates newer than any
+  // spectator received were still on their way, not dropped.
+  uint32_t newest = 0;
+  for(size_t i=0; i<num_clients; i++) {
+    client_t* c = &clients[i];
+    if(!c->player && c->updates > 0 && c->last_update_tick > newest) newest = c->last_update_tick;
+  }
+
+  // Players are written to with blocking sends and never skip an update,
+  // unless they use UDP. Spectators follow the same updates as player 1,
+  // starting with a keyframe that stands in for every update before it, so
+  // anything a spectator has fewer of since then was dropped.
+  size_t dropped = 0;
+  size_t delivered = 0;
+  for(size_t i=0; i<num_clients; i++) {
+    client_t* c = &clients[i];
+    delivered += c->updates;
+    if(c->player || c->updates == 0) continue;
+
+    size_t expected = 1;
+    for(size_t n=0; n<num_stream_ticks; n++) {
+      if(stream_ticks[n] > c->first_update_tick && stream_ticks[n] <= newest) expected++;
+    }
+    if(expected > c->updates) dropped += expected - c->updates;
+  }
+
+  uint32_t ticks = last_tick > first_tick ? last_tick - first_tick : 1;
+
+  printf("\n%zu clients for %.1f s%s\n", num_clients, elapsed,
+         game_over ? " (the match ended early)" : "");
+  printf("Throughput:   %.0f messages/sec, %.2f MB/sec\n",
+         total_messages / elapsed, total_bytes / elapsed / 1e6);
+  printf("Bytes/tick:   %.0f total, %.1f per client over %u ticks\n",
+         (double)total_bytes / ticks, (double)total_bytes / ticks / num_clients, ticks);
+  printf("Latency (ms): p50 %.2f  p90 %.2f  p99 %.2f  p99.9 %.2f\n",
+         latency_percentile(latency, 0.5), latency_percentile(latency, 0.9),
+         latency_percentile(latency, 0.99), latency_percentile(latency, 0.999));
+  // Players' updates are counted in the latency above as well, but the link
+  // only affects the players, so theirs are shown on their own
+  const char* names[] = {"Player (ms): ", "Turns (ms):  "};
+  const uint64_t* histograms[] = {player_latency, turn_latency};
+  for(int i=0; i<2; i++) {
+    if(latency_count(histograms[i]) == 0) {
+      printf("%s none\n", names[i]);
+    } else {
+      printf("%s p50 %.2f  p90 %.2f  p99 %.2f  p99.9 %.2f\n", names[i],
+             latency_percentile(histograms[i], 0.5), latency_percentile(histograms[i], 0.9),
+             latency_percentile(histograms[i], 0.99), latency_percentile(histograms[i], 0.999));
+    }
+  }
+  printf("Link:         players use %s", use_udp ? "UDP" : "TCP");
+  if(link_simulated) {
+    printf(", %.1f%% lost and %.0f ms delay each way", link_loss * 100, link_delay_us / 1000.0);
+  }
+  printf("\n");
+  printf("Updates:      %zu delivered, %zu dropped (%.2f%%), %zu later than %zu ms\n",
+         delivered, dropped, 100.0 * dropped / (delivered + dropped + (delivered + dropped == 0)),
+         late_updates, late_ms);
+  printf("Disconnects:  %zu\n", disconnects);
+  printf("Desyncs:      %zu\n", desyncs);
+
+  if(cpu_start >= 0 && cpu_end >= 0) {
+    double usage = (cpu_end - cpu_start) / elapsed;
+    printf("Server CPU:   %.1f%% of one core", usage * 100);
+    if(usage > 0) {
+      printf(", about %.0f clients per core at this load", num_clients / usage);
+    }
+    printf("\n");
+  } else {
+    printf("Server CPU:   not available\n");
+  }
+
+  if(own_server) {
+    kill(server_pid, SIGTERM);
+    waitpid(server_pid, NULL, 0);
+  }
+  return 0;
+}
@@ -0,0 +1,326 @@
+#include "metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "util.h"
+
+// Histogram buckets run from 2^METRICS_FIRST_BUCKET to 2^METRICS_LAST_BUCKET
+// microseconds, which is 16 us to about a second
+#define METRICS_FIRST_BUCKET 4
+#define METRICS_LAST_BUCKET 20
+
+// Everything needed to answer one monitoring connection
+typedef struct metrics_client {
+  // The client's non-blocking socket
+  int fd;
+
+  // When the connection was accepted
+  size_t opened_at;
+
+  // The request read so far
+  char request[METRICS_REQUEST_MAX];
+  size_t request_length;
+
+  // The reply, once the whole request has arrived, and how much has been sent
+  metrics_page_t reply;
+  size_t sent;
+} metrics_client_t;
+
+// The listening socket, or -1 if metrics are not being served
+static int listen_fd = -1;
+
+// Connections being served
+static metrics_client_t clients[METRICS_MAX_CLIENTS];
+static size_t num_clients = 0;
+
+/**
+ * Make room for more text on a page.
+ *
+ * \returns   false if there is no memory for it.
+ */
+static bool metrics_reserve(metrics_page_t* page, size_t length) {
+  if(page->length + length < page->capacity) return true;
+
+  size_t capacity = page->capacity == 0 ? 4096 : page->capacity;
+  while(page->length + length >= capacity) capacity *= 2;
+
+  char* text = realloc(page->text, capacity);
+  if(text == NULL) return false;
+  page->text = text;
+  page->capacity = capacity;
+  return true;
+}
+
+/**
+ * Add formatted text to a page.
+ */
+static void metrics_printf(metrics_page_t* page, const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(NULL, 0, format, args);
+  va_end(args);
+
+  if(length < 0 || !metrics_reserve(page, length)) return;
+
+  va_start(args, format);
+  vsnprintf(page->text + page->length, page->capacity - page->length, format, args);
+  va_end(args);
+  page->length += length;
+}
+
+/**
+ * Add the help and type lines that start a metric.
+ */
+void metrics_family(metrics_page_t* page, const char* name, const char* type, const char* help) {
+  metrics_printf(page, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/**
+ * Add a sample of a metric.
+ */
+void metrics_sample(metrics_page_t* page, const char* name, const char* labels, double value) {
+  if(labels == NULL) {
+    metrics_printf(page, "%s %.17g\n", name, value);
+  } else {
+    metrics_printf(page, "%s{%s} %.17g\n", name, labels, value);
+  }
+}
+
+/**
+ * Add a histogram of times recorded in microseconds, shown in seconds.
+ * Times are whole microseconds, and each bucket counts the times below its
+ * bound, so only a time exactly equal to a bound lands a bucket too high.
+ */
+void metrics_histogram_us(metrics_page_t* page, const char* name, const char* help,
+                          stats_hist_t* hist) {
+  metrics_family(page, name, "histogram", help);
+
+  // Read the total first, so no bucket can show more than the total
+  uint64_t total = stats_count_below(hist, UINT64_MAX);
+  for(int i=METRICS_FIRST_BUCKET; i<=METRICS_LAST_BUCKET; i++) {
+    uint64_t count = stats_count_below(hist, (uint64_t)1 << i);
+    metrics_printf(page, "%s_bucket{le=\"%.9g\"} %llu\n", name, (double)((uint64_t)1 << i) / 1000000,
+                   (unsigned long long)(count < total ? count : total));
+  }
+  metrics_printf(page, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)total);
+  metrics_printf(page, "%s_sum %.6f\n", name, stats_get(&hist->sum) / 1000000.0);
+  metrics_printf(page, "%s_count %llu\n", name, (unsigned long long)total);
+}
+
+/**
+ * Open a listening Unix socket at a path.
+ */
+static int metrics_open_unix(const char* path) {
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  if(strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  // A socket left behind by an earlier server would stop us binding, but
+  // anything else at that path is not ours to remove
+  struct stat info;
+  if(stat(path, &info) == 0 && S_ISSOCK(info.st_mode)) {
+    unlink(path);
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd == -1) return -1;
+
+  if(bind(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * Open a listening TCP socket on [host:]port.
+ */
+static int metrics_open_tcp(const char* address) {
+  char host[256] = "127.0.0.1";
+  const char* port = address;
+  const char* colon = strrchr(address, ':');
+  if(colon != NULL) {
+    size_t length = colon - address;
+    if(length >= sizeof(host)) {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+    memcpy(host, address, length);
+    host[length] = '\0';
+    port = colon + 1;
+  }
+
+  struct addrinfo hints = {
+    .ai_family = AF_INET,
+    .ai_socktype = SOCK_STREAM,
+    .ai_flags = AI_PASSIVE
+  };
+  struct addrinfo* info;
+  if(getaddrinfo(host, port, &hints, &info) != 0) {
+    // Set errno, since getaddrinfo does not
+    errno = EADDRNOTAVAIL;
+    return -1;
+  }
+
+  int fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+  if(fd != -1) {
+    // Let a restarted server take its port back right away
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    if(bind(fd, info->ai_addr, info->ai_addrlen)) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(info);
+  return fd;
+}
+
+/**
+ * Start listening for monitoring connections.
+ */
+bool metrics_open(const char* address) {
+  int fd = strchr(address, '/') != NULL ? metrics_open_unix(address) : metrics_open_tcp(address);
+  if(fd == -1) return false;
+
+  if(listen(fd, METRICS_MAX_CLIENTS)) {
+    close(fd);
+    return false;
+  }
+
+  // Scrapes must never block a game task
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  listen_fd = fd;
+  return true;
+}
+
+/**
+ * Close a monitoring connection and move the last connection into its slot.
+ */
+static void metrics_remove(size_t index) {
+  metrics_client_t* c = &clients[index];
+  close(c->fd);
+  free(c->reply.text);
+
+  num_clients--;
+  clients[index] = clients[num_clients];
+}
+
+/**
+ * Read as much of a request as has arrived, and build the reply once the
+ * request is complete.
+ *
+ * \returns   false if the connection failed.
+ */
+static bool metrics_read(metrics_client_t* c, metrics_fn_t write_metrics) {
+  while(c->reply.length == 0) {
+    if(c->request_length == METRICS_REQUEST_MAX - 1) return false;
+
+    ssize_t rc = read(c->fd, c->request + c->request_length, METRICS_REQUEST_MAX - 1 - c->request_length);
+    if(rc == 0) return false;
+    if(rc == -1) {
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    c->request_length += rc;
+    c->request[c->request_length] = '\0';
+
+    // Every path gets the metrics, so only the end of the headers matters
+    if(strstr(c->request, "\r\n\r\n") == NULL && strstr(c->request, "\n\n") == NULL) continue;
+
+    metrics_page_t body = {0};
+    write_metrics(&body);
+
+    metrics_printf(&c->reply,
+                   "HTTP/1.0 200 OK\r\n"
+                   "Content-Type: text/plain; version=0.0.4\r\n"
+                   "Content-Length: %zu\r\n"
+                   "Connection: close\r\n\r\n",
+                   body.length);
+    if(metrics_reserve(&c->reply, body.length)) {
+      memcpy(c->reply.text + c->reply.length, body.text, body.length);
+      c->reply.length += body.length;
+    }
+    free(body.text);
+  }
+  return true;
+}
+
+/**
+ * Send as much of a reply as the socket will take.
+ *
+ * \returns   false once the connection is finished with, or has failed.
+ */
+static bool metrics_send(metrics_client_t* c) {
+  while(c->sent < c->reply.length) {
+    ssize_t rc = write(c->fd, c->reply.text + c->sent, c->reply.length - c->sent);
+    if(rc == -1) {
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    c->sent += rc;
+  }
+  return false;
+}
+
+/**
+ * Accept monitoring connections, read their requests, and send each one a
+ * page of metrics.
+ */
+void metrics_serve(metrics_fn_t write_metrics) {
+  if(listen_fd == -1) return;
+
+  // Take new connections while there is room for them
+  while(num_clients < METRICS_MAX_CLIENTS) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if(fd == -1) break;
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    clients[num_clients] = (metrics_client_t) {
+      .fd = fd,
+      .opened_at = time_ms()
+    };
+    num_clients++;
+  }
+
+  size_t now = time_ms();
+  size_t i = 0;
+  while(i < num_clients) {
+    metrics_client_t* c = &clients[i];
+    bool open = now - c->opened_at < METRICS_TIMEOUT && metrics_read(c, write_metrics);
+    if(open && c->reply.length > 0) {
+      open = metrics_send(c);
+    }
+
+    if(open) {
+      i++;
+    } else {
+      metrics_remove(i);
+    }
+  }
+}
+
+/**
+ * Stop listening and close every monitoring connection.
+ */
+void metrics_close() {
+  while(num_clients > 0) {
+    metrics_remove(num_clients - 1);
+  }
+  if(listen_fd != -1) {
+    close(listen_fd);
+    listen_fd = -1;
+  }
+}
@@ -0,0 +1,92 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "stats.h"
+
+// Most monitoring connections served at once. More wait to be accepted.
+#define METRICS_MAX_CLIENTS 8
+
+// Connections that haven't sent a request and read the reply in this many
+// milliseconds are closed
+#define METRICS_TIMEOUT 5000
+
+// Largest request read from a monitoring connection
+#define METRICS_REQUEST_MAX 1024
+
+/**
+ * A page of metrics in Prometheus' text exposition format, as it is built.
+ */
+typedef struct metrics_page {
+  char* text;
+  size_t length;
+  size_t capacity;
+} metrics_page_t;
+
+/// This is the type of a function that writes the current metrics to a page
+typedef void (*metrics_fn_t)(metrics_page_t* page);
+
+/**
+ * Start listening for monitoring connections. Scrapes are answered by
+ * metrics_serve, so nothing happens until it is called.
+ *
+ * \param address   Either [host:]port for TCP, where the host defaults to
+ *                  127.0.0.1 so only this machine can connect, or the path
+ *                  of a Unix socket, which must contain a '/'.
+ *
+ * \returns         true on success. On failure errno is set by the POSIX call
+ *                  that failed.
+ */
+bool metrics_open(const char* address);
+
+/**
+ * Accept monitoring connections, read their requests, and send each one a
+ * page of metrics. This never blocks, and only does what each socket is ready
+ * for, so call it every so often from a scheduler task.
+ *
+ * \param write_metrics   Writes the page each request is answered with
+ */
+void metrics_serve(metrics_fn_t write_metrics);
+
+/**
+ * Stop listening and close every monitoring connection.
+ */
+void metrics_close();
+
+/**
+ * Add the help and type lines that start a metric.
+ *
+ * \param page    The page to add to
+ * \param name    The metric's name
+ * \param type    "counter", "gauge", or "histogram"
+ * \param help    What the metric measures
+ */
+void metrics_family(metrics_page_t* page, const char* name, const char* type, const char* help);
+
+/**
+ * Add a sample of a metric.
+ *
+ * \param page    The page to add to
+ * \param name    The metric's name
+ * \param labels  Labels such as state="SLEEPING", or NULL for none
+ * \param value   The value
+ */
+void metrics_sample(metrics_page_t* page, const char* name, const char* labels, double value);
+
+/**
+ * Add a histogram of times recorded in microseconds, shown in seconds. The
+ * buckets are powers of two microseconds, where a stats_hist_t's buckets
+ * start, so reading them needs no estimates.
+ *
+ * \param page    The page to add to
+ * \param name    The metric's name
+ * \param help    What the metric measures
+ * \param hist    The recorded times
+ */
+void metrics_histogram_us(metrics_page_t* page, const char* name, const char* help,
+                          stats_hist_t* hist);
+
+#endif
@@ -0,0 +1,206 @@
+#if !defined(PROTOCOL_H)
+#define PROTOCOL_H
+
+#include <stdint.h>
+
+// Every connection starts with a hello carrying this value
+#define PROTOCOL_MAGIC 0x534e4b31 // "SNK1"
+
+// Roles a client can ask for in its hello
+#define ROLE_PLAYER 1
+#define ROLE_SPECTATOR 2
+#define ROLE_RESUME 3     //< A player reconnecting with its session token
+
+// Longest player name. Names this long have no terminating zero.
+#define PLAYER_NAME_MAX 16
+
+// Size of the board. Build with -DBOARD_WIDTH= and -DBOARD_HEIGHT= to play
+// on a different board; every program in a match has to agree on the size.
+#ifndef BOARD_WIDTH
+#define BOARD_WIDTH 50
+#endif
+#ifndef BOARD_HEIGHT
+#define BOARD_HEIGHT 25
+#endif
+
+// Board cells from snake 1's head up to this value are snake 1. Snake 2's
+// head is this value and its segments count up from there.
+#define SNAKE2_BASE (BOARD_WIDTH * BOARD_HEIGHT / 2)
+
+// Largest area of the board around a snake that a client is sent. This is a
+// generous terminal size, so clients see everything on screen without paying
+// for boards bigger than that.
+#ifndef AOI_WIDTH
+#define AOI_WIDTH 120
+#endif
+#ifndef AOI_HEIGHT
+#define AOI_HEIGHT 50
+#endif
+
+// Size of the area actually sent, which is smaller on small boards
+#define AREA_WIDTH (BOARD_WIDTH < AOI_WIDTH ? BOARD_WIDTH : AOI_WIDTH)
+#define AREA_HEIGHT (BOARD_HEIGHT < AOI_HEIGHT ? BOARD_HEIGHT : AOI_HEIGHT)
+
+// Size of the coarse overview of the whole board sent alongside the area
+#define MINIMAP_WIDTH 24
+#define MINIMAP_HEIGHT 12
+
+// What can be in a minimap cell. A cell holds any combination.
+#define MINIMAP_SNAKE1 1
+#define MINIMAP_SNAKE2 2
+#define MINIMAP_APPLE 4
+
+// Directions a player sends to turn their snake
+#define DIR_NORTH 0
+#define DIR_EAST 1
+#define DIR_SOUTH 2
+#define DIR_WEST 3
+
+// Types of messages the server sends
+#define MSG_BOARD 1       //< Every cell of the client's area of the board, compressed
+#define MSG_WELCOME 2     //< The session token for a player who just joined
+#define MSG_DELTA 3       //< The cells that changed since the previous message
+#define MSG_GAME_OVER 4   //< The match has ended
+#define MSG_MINIMAP 5     //< A coarse overview of the whole board
+#define MSG_PONG 6        //< The answer to a player's ping or turn
+#define MSG_STATS 7       //< How long the server's recent ticks took
+
+// Types of messages players send
+#define CMSG_TURN 1       //< Turn the player's snake
+#define CMSG_PING 2       //< Ask for a pong, to measure the round trip time
+#define CMSG_KEYFRAME 3   //< Ask for a MSG_BOARD, after the player's board went wrong
+
+// Number of a player's latest unacknowledged commands each UDP input packet
+// carries, so a lost packet is covered by any of the next few
+#define UDP_REDUNDANCY 4
+
+// Message flags
+#define MSG_FLAG_KEYFRAME 1 //< The message holds the complete game state
+
+/**
+ * The first thing a client sends after connecting. Values are in host byte
+ * order, just like the rest of the protocol.
+ */
+typedef struct hello {
+  uint32_t magic;
+  uint32_t role;
+  uint64_t token;   //< The session token, when the role is ROLE_RESUME
+  char name[PLAYER_NAME_MAX]; //< The player's name, which their results are kept under
+} hello_t;
+
+/**
+ * The payload of a MSG_WELCOME message. A player who loses its connection can
+ * present this token to take its place in the match back.
+ */
+typedef struct welcome {
+  uint64_t token;
+  uint32_t player;  //< Which snake the player controls, 1 or 2
+  uint32_t pad;
+} welcome_t;
+
+/**
+ * The area of the board a client is sent, which follows one of the snakes.
+ * MSG_BOARD and MSG_DELTA payloads start with this. Cells outside the area
+ * are unknown to the client, so it clears any cell that leaves its area.
+ */
+typedef struct area {
+  uint16_t row;     //< The area's top row
+  uint16_t col;     //< The area's leftmost column
+  uint16_t height;  //< Number of rows in the area
+  uint16_t width;   //< Number of columns in the area
+
+  // Lengths of both snakes, which may not be entirely inside the area
+  uint32_t snake1_length;
+  uint32_t snake2_length;
+
+  // The Zobrist hash of the client's board once this message is applied,
+  // which a client compares with its own to find out it has gone wrong
+  uint64_t hash;
+} area_t;
+
+/**
+ * After its area, the payload of a MSG_BOARD message holds every cell in the
+ * area, encoded by keyframe_encode. The payload of a MSG_DELTA message is an
+ * array of these, one for each board cell that changed.
+ */
+typedef struct cell_change {
+  uint32_t index;   //< The cell's position, as row * BOARD_WIDTH + column
+  int32_t value;    //< The cell's new value
+} cell_change_t;
+
+/**
+ * The payload of a MSG_MINIMAP message. Each cell summarizes a block of the
+ * board with a combination of the MINIMAP_ values.
+ */
+typedef struct minimap {
+  uint8_t cells[MINIMAP_HEIGHT][MINIMAP_WIDTH];
+} minimap_t;
+
+/**
+ * Everything a player sends is one of these.
+ */
+typedef struct client_msg {
+  uint32_t type;    //< One of the CMSG_ values
+  uint32_t dir;     //< The direction to turn, for CMSG_TURN
+  uint64_t time_us; //< The player's monotonic clock when the message was sent
+} client_msg_t;
+
+/**
+ * A datagram from a player using UDP. Commands are numbered from 1, and each
+ * packet repeats every command the server hasn't acknowledged yet, up to
+ * UDP_REDUNDANCY of them. Only the first count commands are sent.
+ */
+typedef struct udp_input {
+  uint32_t magic;       //< PROTOCOL_MAGIC
+  uint32_t count;       //< Number of commands in the packet, which may be zero
+  uint64_t token;       //< The player's session token, which says who sent it
+  uint32_t first_seq;   //< The sequence number of the first command
+  uint32_t pad;
+  client_msg_t commands[UDP_REDUNDANCY];
+} udp_input_t;
+
+/**
+ * Every datagram the server sends to a player starts with this, followed by
+ * a message exactly as it would be sent over TCP.
+ */
+typedef struct udp_header {
+  uint32_t seq;     //< Counts up with every datagram sent to the player
+  uint32_t ack;     //< Sequence number of the last command the server applied
+} udp_header_t;
+
+/**
+ * The payload of a MSG_PONG message. The server answers each ping and the
+ * latest turn it applied, once per tick at most, so the player can tell how
+ * long the round trip and the turn took.
+ */
+typedef struct pong {
+  uint32_t type;    //< The CMSG_ type of the message being answered
+  uint32_t pad;
+  uint64_t time_us; //< The time_us of the message being answered
+  uint64_t held_us; //< How long the server held the message before answering
+} pong_t;
+
+/**
+ * The payload of a MSG_STATS message, which the server sends about once a
+ * second.
+ */
+typedef struct server_stats {
+  uint32_t tick_p50_us;   //< Median time to run a tick and send its updates
+  uint32_t tick_p99_us;   //< 99th percentile of the same
+  uint32_t tick_max_us;   //< Slowest tick, to within an eighth
+  uint32_t spectators;    //< Number of spectators watching
+} server_stats_t;
+
+/**
+ * Every message from the server starts with this header. The payload of
+ * length bytes follows immediately after it.
+ */
+typedef struct msg_header {
+  uint32_t type;    //< One of the MSG_ values
+  uint32_t flags;   //< A combination of MSG_FLAG_ values
+  uint32_t tick;    //< The server tick that produced this message
+  uint32_t length;  //< Number of payload bytes after the header
+  uint64_t time_us; //< The server's monotonic clock when the message was sent
+} msg_header_t;
+
+#endif
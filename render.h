@@ -0,0 +1,73 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdbool.h>
+
+// Colors things can be drawn in. The curses renderer uses these as its color
+// pair numbers.
+#define SNAKE1_PAIR 1
+#define SNAKE2_PAIR 2
+#define TEXT_PAIR 3
+#define APPLE_PAIR 4
+#define BORDER_PAIR 6
+#define EMPTY_PAIR 7
+
+// Line drawing characters, which each renderer draws its own way. Characters
+// below 256 are drawn as themselves.
+#define CHAR_DIAMOND 256
+#define CHAR_ULCORNER 257
+#define CHAR_URCORNER 258
+#define CHAR_LLCORNER 259
+#define CHAR_LRCORNER 260
+#define CHAR_HLINE 261
+#define CHAR_VLINE 262
+
+/**
+ * A way of drawing the game on the terminal. Curses must already be
+ * initialized, since it is always used to read input, but a renderer may
+ * write to the terminal on its own.
+ */
+typedef struct renderer {
+  // The name used to pick this renderer
+  const char* name;
+
+  /**
+   * Prepare the terminal for drawing.
+   *
+   * \returns   false if the terminal does not support color.
+   */
+  bool (*init)();
+
+  /**
+   * Draw a single character.
+   *
+   * \param row   The screen row
+   * \param col   The screen column
+   * \param pair  One of the _PAIR colors
+   * \param ch    An ASCII character or one of the CHAR_ line drawing values
+   */
+  void (*put)(int row, int col, int pair, int ch);
+
+  /**
+   * Draw a string of ASCII characters on one row.
+   */
+  void (*text)(int row, int col, int pair, const char* text);
+
+  /**
+   * Show everything drawn since the last call on the terminal.
+   */
+  void (*present)();
+
+  /**
+   * Put the terminal back the way init found it, before curses ends.
+   */
+  void (*end)();
+} renderer_t;
+
+// Draws through curses, which keeps its own copy of the screen
+extern const renderer_t curses_renderer;
+
+// Writes ANSI escape sequences directly, with one write per frame
+extern const renderer_t ansi_renderer;
+
+#endif
@@ -0,0 +1,152 @@
+#define _XOPEN_SOURCE
+#define _XOPEN_SOURCE_EXTENDED
+
+#include "render.h"
+
+#include <curses.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// Size of the buffer a frame is built in. A larger frame is written in pieces.
+#define FRAME_BUFFER_SIZE 65536
+
+// The frame being built, which ansi_present writes to the terminal
+static char frame[FRAME_BUFFER_SIZE];
+static size_t frame_length = 0;
+
+// Where the cursor will be and which color and character set will be in use
+// once the frame so far is written. A cursor position of -1 is unknown.
+static int cursor_row = -1;
+static int cursor_col = -1;
+static int current_pair = -1;
+static bool line_drawing = false;
+
+// The foreground and background for each color pair, as SGR parameters
+static const char* pair_colors[] = {
+  [SNAKE1_PAIR] = "34;43",  // Blue on yellow
+  [SNAKE2_PAIR] = "35;43",  // Magenta on yellow
+  [TEXT_PAIR] = "30;43",    // Black on yellow
+  [APPLE_PAIR] = "31;43",   // Red on yellow
+  [BORDER_PAIR] = "36;43",  // Cyan on yellow
+  [EMPTY_PAIR] = "33;43"    // Yellow on yellow
+};
+
+/**
+ * Write the whole frame buffer to the terminal.
+ */
+static void ansi_flush() {
+  size_t written = 0;
+  while(written < frame_length) {
+    ssize_t rc = write(STDOUT_FILENO, frame + written, frame_length - written);
+    if(rc == -1) {
+      if(errno == EINTR) continue;
+      break;
+    }
+    written += rc;
+  }
+  frame_length = 0;
+}
+
+/**
+ * Add bytes to the frame, writing the frame out first if they don't fit.
+ */
+static void ansi_append(const char* data, size_t length) {
+  if(frame_length + length > FRAME_BUFFER_SIZE) {
+    ansi_flush();
+  }
+  memcpy(frame + frame_length, data, length);
+  frame_length += length;
+}
+
+/**
+ * Add a string to the frame.
+ */
+static void ansi_append_string(const char* data) {
+  ansi_append(data, strlen(data));
+}
+
+/**
+ * Hide the cursor and clear the screen. Curses draws its own first frame the
+ * first time it reads input, so that is done now to keep it from clearing the
+ * screen later on.
+ */
+static bool ansi_init() {
+  refresh();
+  leaveok(stdscr, TRUE);
+
+  ansi_append_string("\x1b[?25l\x1b[0m\x1b[2J");
+  cursor_row = -1;
+  current_pair = -1;
+  line_drawing = false;
+  ansi_flush();
+  return true;
+}
+
+/**
+ * Add a character to the frame, moving the cursor and changing the color
+ * only if they are not already right.
+ */
+static void ansi_put(int row, int col, int pair, int ch) {
+  char sequence[32];
+  if(row != cursor_row || col != cursor_col) {
+    snprintf(sequence, sizeof(sequence), "\x1b[%d;%dH", row + 1, col + 1);
+    ansi_append_string(sequence);
+  }
+
+  if(pair != current_pair) {
+    snprintf(sequence, sizeof(sequence), "\x1b[%sm", pair_colors[pair]);
+    ansi_append_string(sequence);
+    current_pair = pair;
+  }
+
+  // Line drawing characters come from the DEC special graphics set
+  char glyph = ch;
+  bool special = ch >= CHAR_DIAMOND;
+  if(special) {
+    const char* dec = "`lkmjqx";
+    glyph = dec[ch - CHAR_DIAMOND];
+  }
+  if(special != line_drawing) {
+    ansi_append_string(special ? "\x1b(0" : "\x1b(B");
+    line_drawing = special;
+  }
+
+  ansi_append(&glyph, 1);
+  cursor_row = row;
+  cursor_col = col + 1;
+}
+
+/**
+ * Add a string to the frame.
+ */
+static void ansi_text(int row, int col, int pair, const char* text) {
+  for(int i=0; text[i] != '\0'; i++) {
+    ansi_put(row, col + i, pair, text[i]);
+  }
+}
+
+/**
+ * Write the frame to the terminal with a single write.
+ */
+static void ansi_present() {
+  ansi_flush();
+}
+
+/**
+ * Reset the colors and character set, and show the cursor again.
+ */
+static void ansi_end() {
+  ansi_append_string("\x1b(B\x1b[0m\x1b[?25h");
+  ansi_flush();
+}
+
+const renderer_t ansi_renderer = {
+  .name = "ansi",
+  .init = ansi_init,
+  .put = ansi_put,
+  .text = ansi_text,
+  .present = ansi_present,
+  .end = ansi_end
+};
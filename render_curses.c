@@ -0,0 +1,82 @@
+#define _XOPEN_SOURCE
+#define _XOPEN_SOURCE_EXTENDED
+
+#include "render.h"
+
+#include <curses.h>
+
+/**
+ * Set up the color pairs for the game.
+ */
+static bool curses_init() {
+  // Check if machine supports ncurses colors
+  if(has_colors() == FALSE) {
+    return false;
+  }
+
+  // Initialize game pair colors
+  start_color();
+  init_pair(SNAKE1_PAIR, COLOR_BLUE, COLOR_YELLOW);
+  init_pair(SNAKE2_PAIR, COLOR_MAGENTA, COLOR_YELLOW);
+  init_pair(TEXT_PAIR, COLOR_BLACK, COLOR_YELLOW);
+  init_pair(APPLE_PAIR, COLOR_RED, COLOR_YELLOW);
+  init_pair(BORDER_PAIR, COLOR_CYAN, COLOR_YELLOW);
+  init_pair(EMPTY_PAIR, COLOR_YELLOW, COLOR_YELLOW);
+  return true;
+}
+
+/**
+ * Draw a single character with curses.
+ */
+static void curses_put(int row, int col, int pair, int ch) {
+  chtype glyph = ch;
+  if(ch == CHAR_DIAMOND) {
+    glyph = ACS_DIAMOND;
+  } else if(ch == CHAR_ULCORNER) {
+    glyph = ACS_ULCORNER;
+  } else if(ch == CHAR_URCORNER) {
+    glyph = ACS_URCORNER;
+  } else if(ch == CHAR_LLCORNER) {
+    glyph = ACS_LLCORNER;
+  } else if(ch == CHAR_LRCORNER) {
+    glyph = ACS_LRCORNER;
+  } else if(ch == CHAR_HLINE) {
+    glyph = ACS_HLINE;
+  } else if(ch == CHAR_VLINE) {
+    glyph = ACS_VLINE;
+  }
+
+  attron(COLOR_PAIR(pair));
+  mvaddch(row, col, glyph);
+  attroff(COLOR_PAIR(pair));
+}
+
+/**
+ * Draw a string with curses.
+ */
+static void curses_text(int row, int col, int pair, const char* text) {
+  attron(COLOR_PAIR(pair));
+  mvprintw(row, col, "%s", text);
+  attroff(COLOR_PAIR(pair));
+}
+
+/**
+ * Let curses work out what changed on screen and send it to the terminal.
+ */
+static void curses_present() {
+  refresh();
+}
+
+/**
+ * Curses puts the terminal back itself in endwin.
+ */
+static void curses_end() {}
+
+const renderer_t curses_renderer = {
+  .name = "curses",
+  .init = curses_init,
+  .put = curses_put,
+  .text = curses_text,
+  .present = curses_present,
+  .end = curses_end
+};
@@ -0,0 +1,231 @@
+#include "replay.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Size of the stdio buffer used while recording, so ticks rarely hit the disk
+#define REPLAY_BUFFER_SIZE 65536
+
+/**
+ * Create a replay file and write its header.
+ */
+int replay_writer_open(replay_writer_t* writer, const char* path, replay_header_t* header) {
+  writer->file = fopen(path, "wb");
+  if(writer->file == NULL) return -1;
+  setvbuf(writer->file, NULL, _IOFBF, REPLAY_BUFFER_SIZE);
+
+  header->magic = REPLAY_MAGIC;
+  header->version = REPLAY_VERSION;
+  writer->state_size = header->state_size;
+
+  // No directions have been written yet, so the first input is always recorded
+  writer->last_dir1 = -1;
+  writer->last_dir2 = -1;
+
+  if(fwrite(header, sizeof(replay_header_t), 1, writer->file) != 1) {
+    fclose(writer->file);
+    writer->file = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Record the players' directions for a tick, if they changed.
+ */
+void replay_write_input(replay_writer_t* writer, uint32_t tick, int dir1, int dir2) {
+  if(writer->file == NULL) return;
+  if(dir1 == writer->last_dir1 && dir2 == writer->last_dir2) return;
+
+  replay_record_t record = {
+    .type = REPLAY_INPUT,
+    .dir1 = dir1,
+    .dir2 = dir2,
+    .tick = tick
+  };
+  fwrite(&record, sizeof(record), 1, writer->file);
+
+  writer->last_dir1 = dir1;
+  writer->last_dir2 = dir2;
+}
+
+/**
+ * Record the complete game state at the start of a tick.
+ */
+void replay_write_keyframe(replay_writer_t* writer, uint32_t tick, const void* state) {
+  if(writer->file == NULL) return;
+
+  replay_record_t record = {
+    .type = REPLAY_KEYFRAME,
+    .tick = tick
+  };
+  fwrite(&record, sizeof(record), 1, writer->file);
+  fwrite(state, writer->state_size, 1, writer->file);
+
+  // Push everything up to this keyframe out, so a crash loses at most one
+  // keyframe interval of the match
+  fflush(writer->file);
+}
+
+/**
+ * Mark the end of the match and close the file.
+ */
+void replay_writer_close(replay_writer_t* writer, uint32_t tick) {
+  if(writer->file == NULL) return;
+
+  replay_record_t record = {
+    .type = REPLAY_END,
+    .tick = tick
+  };
+  fwrite(&record, sizeof(record), 1, writer->file);
+  fclose(writer->file);
+  writer->file = NULL;
+}
+
+/**
+ * Get the total size of the record at offset, or zero if it is incomplete.
+ */
+static size_t replay_record_size(const replay_t* replay, size_t offset) {
+  if(offset + sizeof(replay_record_t) > replay->size) return 0;
+
+  const replay_record_t* record = (const replay_record_t*)(replay->data + offset);
+  size_t size = sizeof(replay_record_t);
+  if(record->type == REPLAY_KEYFRAME) {
+    size += replay->header->state_size;
+  }
+
+  if(offset + size > replay->size) return 0;
+  return size;
+}
+
+/**
+ * Map a replay file into memory and index its keyframes.
+ */
+int replay_open(replay_t* replay, const char* path) {
+  memset(replay, 0, sizeof(replay_t));
+
+  int fd = open(path, O_RDONLY);
+  if(fd == -1) return -1;
+
+  struct stat info;
+  if(fstat(fd, &info) == -1) {
+    close(fd);
+    return -1;
+  }
+
+  if((size_t)info.st_size < sizeof(replay_header_t)) {
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+
+  void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED) return -1;
+
+  replay->data = data;
+  replay->size = info.st_size;
+  replay->header = data;
+
+  if(replay->header->magic != REPLAY_MAGIC || replay->header->version != REPLAY_VERSION) {
+    replay_close(replay);
+    errno = EINVAL;
+    return -1;
+  }
+
+  // Walk the records once to find every keyframe. Records are small and
+  // fixed-size, so this only touches a fraction of the file.
+  size_t capacity = 16;
+  replay->keyframes = malloc(capacity * sizeof(size_t));
+  if(replay->keyframes == NULL) {
+    replay_close(replay);
+    return -1;
+  }
+
+  size_t offset = sizeof(replay_header_t);
+  size_t size;
+  while((size = replay_record_size(replay, offset)) != 0) {
+    const replay_record_t* record = (const replay_record_t*)(replay->data + offset);
+    if(record->type == REPLAY_KEYFRAME) {
+      if(replay->num_keyframes == capacity) {
+        capacity *= 2;
+        size_t* grown = realloc(replay->keyframes, capacity * sizeof(size_t));
+        if(grown == NULL) {
+          replay_close(replay);
+          return -1;
+        }
+        replay->keyframes = grown;
+      }
+      replay->keyframes[replay->num_keyframes++] = offset;
+    }
+
+    replay->last_tick = record->tick;
+    offset += size;
+  }
+  replay->end = offset;
+
+  // Playback has to start from a keyframe
+  if(replay->num_keyframes == 0) {
+    replay_close(replay);
+    errno = EINVAL;
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Unmap a replay file and free its index.
+ */
+void replay_close(replay_t* replay) {
+  if(replay->data != NULL) {
+    munmap((void*)replay->data, replay->size);
+  }
+  free(replay->keyframes);
+  memset(replay, 0, sizeof(replay_t));
+}
+
+/**
+ * Find the keyframe to start from in order to reach a tick.
+ */
+size_t replay_seek(const replay_t* replay, uint32_t tick) {
+  // Binary search for the last keyframe at or before tick
+  size_t low = 0;
+  size_t high = replay->num_keyframes;
+  while(high - low > 1) {
+    size_t mid = (low + high) / 2;
+    if(replay_record(replay, replay->keyframes[mid])->tick <= tick) {
+      low = mid;
+    } else {
+      high = mid;
+    }
+  }
+  return replay->keyframes[low];
+}
+
+/**
+ * Get the record at an offset.
+ */
+const replay_record_t* replay_record(const replay_t* replay, size_t offset) {
+  if(offset >= replay->end) return NULL;
+  return (const replay_record_t*)(replay->data + offset);
+}
+
+/**
+ * Get the offset of the record after the one at offset.
+ */
+size_t replay_next(const replay_t* replay, size_t offset) {
+  return offset + replay_record_size(replay, offset);
+}
+
+/**
+ * Get the game state stored after a keyframe record.
+ */
+const void* replay_keyframe_state(const replay_record_t* record) {
+  return record + 1;
+}
@@ -0,0 +1,178 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Every replay file starts with this value
+#define REPLAY_MAGIC 0x52534e4b // "KNSR"
+#define REPLAY_VERSION 1
+
+// Types of records in a replay file
+#define REPLAY_INPUT 1      //< The players' directions changed on this tick
+#define REPLAY_KEYFRAME 2   //< The complete game state follows this record
+#define REPLAY_END 3        //< The match ended on this tick
+
+/**
+ * The header at the start of every replay file. It holds everything needed
+ * to re-create the match besides the player inputs.
+ */
+typedef struct replay_header {
+  uint32_t magic;
+  uint32_t version;
+
+  // Size of the board the match was played on
+  uint32_t board_width;
+  uint32_t board_height;
+
+  // Game configuration, in milliseconds where it is a time
+  uint32_t tick_interval;
+  uint32_t horizontal_interval;
+  uint32_t vertical_interval;
+  uint32_t apple_interval;
+  uint32_t generate_apple_interval;
+  uint32_t init_length;
+
+  // How often keyframes were written, in ticks
+  uint32_t keyframe_interval;
+
+  // Number of bytes of game state in each keyframe
+  uint32_t state_size;
+
+  // The seed for the game's random number generator
+  uint64_t seed;
+} replay_header_t;
+
+/**
+ * A single entry in the replay log. Keyframe records are immediately
+ * followed by state_size bytes of game state.
+ */
+typedef struct replay_record {
+  uint8_t type;   //< One of the REPLAY_ record types
+  uint8_t dir1;   //< Player 1's direction, for input records
+  uint8_t dir2;   //< Player 2's direction, for input records
+  uint8_t pad;
+  uint32_t tick;  //< The tick this record applies to
+} replay_record_t;
+
+/**
+ * Appends records to a replay file as a match is played.
+ */
+typedef struct replay_writer {
+  FILE* file;
+  uint32_t state_size;
+
+  // The most recently written directions, so unchanged inputs are skipped
+  int last_dir1;
+  int last_dir2;
+} replay_writer_t;
+
+/**
+ * A replay file mapped into memory for playback.
+ */
+typedef struct replay {
+  // The mapped file
+  const uint8_t* data;
+  size_t size;
+
+  // The file's header, at the start of data
+  const replay_header_t* header;
+
+  // Offsets of every keyframe record, in tick order
+  size_t* keyframes;
+  size_t num_keyframes;
+
+  // Offset just past the last complete record
+  size_t end;
+
+  // The tick of the last complete record
+  uint32_t last_tick;
+} replay_t;
+
+/**
+ * Create a replay file and write its header.
+ *
+ * \param writer  The writer to initialize
+ * \param path    The file to create
+ * \param header  The header to write. The magic and version are filled in.
+ *
+ * \returns       0 on success, or -1 with errno set on failure.
+ */
+int replay_writer_open(replay_writer_t* writer, const char* path, replay_header_t* header);
+
+/**
+ * Record the players' directions for a tick. Nothing is written unless a
+ * direction changed since the last call.
+ *
+ * \param writer  The replay being written
+ * \param tick    The tick these directions apply to
+ * \param dir1    Player 1's direction
+ * \param dir2    Player 2's direction
+ */
+void replay_write_input(replay_writer_t* writer, uint32_t tick, int dir1, int dir2);
+
+/**
+ * Record the complete game state at the start of a tick.
+ *
+ * \param writer  The replay being written
+ * \param tick    The tick the state was captured at
+ * \param state   state_size bytes of game state
+ */
+void replay_write_keyframe(replay_writer_t* writer, uint32_t tick, const void* state);
+
+/**
+ * Mark the end of the match and close the file.
+ *
+ * \param writer  The replay being written
+ * \param tick    The tick the match ended on
+ */
+void replay_writer_close(replay_writer_t* writer, uint32_t tick);
+
+/**
+ * Map a replay file into memory and index its keyframes. A file that was cut
+ * off part way through a record can still be played up to that point.
+ *
+ * \param replay  The replay to initialize
+ * \param path    The file to open
+ *
+ * \returns       0 on success, or -1 on failure. errno is set to EINVAL if the
+ *                file is not a replay or has no keyframes.
+ */
+int replay_open(replay_t* replay, const char* path);
+
+/**
+ * Unmap a replay file and free its index.
+ */
+void replay_close(replay_t* replay);
+
+/**
+ * Find the keyframe to start from in order to reach a tick.
+ *
+ * \param replay  The replay to search
+ * \param tick    The tick to reach
+ *
+ * \returns       The offset of the last keyframe record at or before tick, or
+ *                the first keyframe if tick comes before all of them.
+ */
+size_t replay_seek(const replay_t* replay, uint32_t tick);
+
+/**
+ * Get the record at an offset.
+ *
+ * \returns   The record, or NULL if offset is past the last complete record.
+ */
+const replay_record_t* replay_record(const replay_t* replay, size_t offset);
+
+/**
+ * Get the offset of the record after the one at offset.
+ */
+size_t replay_next(const replay_t* replay, size_t offset);
+
+/**
+ * Get the game state stored after a keyframe record.
+ */
+const void* replay_keyframe_state(const replay_record_t* record);
+
+#endif
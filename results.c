@@ -0,0 +1,271 @@
+#include "results.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Where the player index starts, leaving room for the header to grow
+#define RESULTS_PLAYERS_OFFSET 64
+
+// Where the matches start
+#define RESULTS_MATCHES_OFFSET (RESULTS_PLAYERS_OFFSET + RESULTS_MAX_PLAYERS * sizeof(player_record_t))
+
+_Static_assert(sizeof(results_header_t) <= RESULTS_PLAYERS_OFFSET, "The results header is too big");
+_Static_assert((RESULTS_MAX_PLAYERS & (RESULTS_MAX_PLAYERS - 1)) == 0, "RESULTS_MAX_PLAYERS must be a power of two");
+
+/**
+ * Get the size of a results file with room for a number of matches.
+ */
+static size_t results_file_size(uint32_t capacity) {
+  return RESULTS_MATCHES_OFFSET + (size_t)capacity * sizeof(match_result_t);
+}
+
+/**
+ * Write the header of a new results file, and make room for its first matches.
+ * The caller holds the lock.
+ */
+static int results_create(int fd) {
+  if(ftruncate(fd, results_file_size(RESULTS_GROW)) == -1) return -1;
+
+  results_header_t header = {
+    .magic = RESULTS_MAGIC,
+    .version = RESULTS_VERSION,
+    .match_size = sizeof(match_result_t),
+    .player_size = sizeof(player_record_t),
+    .capacity = RESULTS_GROW
+  };
+  if(pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) return -1;
+  return 0;
+}
+
+/**
+ * Open a results file and map it into memory.
+ */
+int results_open(results_t* results, const char* path, bool writable) {
+  results->writable = writable;
+  results->fd = open(path, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+  if(results->fd == -1) return -1;
+
+  // A file another server is creating may not have its header yet
+  flock(results->fd, LOCK_EX);
+  struct stat info;
+  bool ok = fstat(results->fd, &info) == 0;
+  if(ok && info.st_size == 0 && writable) {
+    ok = results_create(results->fd) == 0;
+  }
+  flock(results->fd, LOCK_UN);
+
+  results_header_t header;
+  if(ok && pread(results->fd, &header, sizeof(header), 0) != sizeof(header)) {
+    errno = EINVAL;
+    ok = false;
+  }
+  if(ok && (header.magic != RESULTS_MAGIC || header.version != RESULTS_VERSION ||
+            header.match_size != sizeof(match_result_t) ||
+            header.player_size != sizeof(player_record_t))) {
+    errno = EINVAL;
+    ok = false;
+  }
+  if(!ok) {
+    close(results->fd);
+    return -1;
+  }
+
+  // Map the largest the file can get, so it never has to be mapped again as
+  // it grows. Only the part inside the file is ever touched.
+  results->size = results_file_size(RESULTS_MAX_MATCHES);
+  int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+  results->data = mmap(NULL, results->size, prot, MAP_SHARED, results->fd, 0);
+  if(results->data == MAP_FAILED) {
+    close(results->fd);
+    return -1;
+  }
+
+  results->header = (results_header_t*)results->data;
+  results->players = (player_record_t*)(results->data + RESULTS_PLAYERS_OFFSET);
+  results->matches = (match_result_t*)(results->data + RESULTS_MATCHES_OFFSET);
+  return 0;
+}
+
+/**
+ * Unmap a results file and close it.
+ */
+void results_close(results_t* results) {
+  munmap(results->data, results->size);
+  close(results->fd);
+}
+
+/**
+ * Find a player's slot in the index.
+ *
+ * \param name    The player's name
+ * \param add     Should an empty slot be claimed if the player has none?
+ *
+ * \returns       The slot, or NULL if there is none.
+ */
+static player_record_t* results_find(results_t* results, const char* name, bool add) {
+  // FNV-1a hash of the name
+  uint32_t hash = 2166136261u;
+  for(size_t i=0; i<PLAYER_NAME_MAX && name[i] != '\0'; i++) {
+    hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+  }
+
+  for(size_t probe=0; probe<RESULTS_MAX_PLAYERS; probe++) {
+    player_record_t* player = &results->players[(hash + probe) & (RESULTS_MAX_PLAYERS - 1)];
+    if(player->name[0] == '\0') {
+      if(!add) return NULL;
+      strncpy(player->name, name, PLAYER_NAME_MAX);
+      player->last_match = RESULTS_NONE;
+      return player;
+    }
+    if(strncmp(player->name, name, PLAYER_NAME_MAX) == 0) return player;
+  }
+  return NULL;
+}
+
+/**
+ * Count a match towards a player's record.
+ */
+static void results_score(player_record_t* player, uint32_t match, int32_t score, int outcome) {
+  if(player->matches == 0 || score > player->best_score) {
+    player->best_score = score;
+  }
+  player->matches++;
+  player->total_score += score;
+  player->last_match = match;
+  if(outcome > 0) {
+    player->wins++;
+  } else if(outcome < 0) {
+    player->losses++;
+  } else {
+    player->ties++;
+  }
+}
+
+/**
+ * Add a finished match, and update both players in the index.
+ */
+int results_append(results_t* results, const match_result_t* result) {
+  if(!results->writable) {
+    errno = EBADF;
+    return -1;
+  }
+
+  flock(results->fd, LOCK_EX);
+  results_header_t* header = results->header;
+  uint32_t index = atomic_load_explicit(&header->count, memory_order_relaxed);
+
+  // Make room for more matches if the file is full
+  if(index >= RESULTS_MAX_MATCHES) {
+    flock(results->fd, LOCK_UN);
+    errno = ENOSPC;
+    return -1;
+  }
+  if(index >= header->capacity) {
+    uint32_t capacity = header->capacity + RESULTS_GROW;
+    if(capacity > RESULTS_MAX_MATCHES) capacity = RESULTS_MAX_MATCHES;
+    if(ftruncate(results->fd, results_file_size(capacity)) == -1) {
+      int error = errno;
+      flock(results->fd, LOCK_UN);
+      errno = error;
+      return -1;
+    }
+    header->capacity = capacity;
+  }
+
+  player_record_t* player1 = results_find(results, result->name1, true);
+  player_record_t* player2 = results_find(results, result->name2, true);
+
+  // Link the match into each player's chain, then count it
+  match_result_t* match = &results->matches[index];
+  *match = *result;
+  match->prev1 = player1 != NULL ? player1->last_match : RESULTS_NONE;
+  match->prev2 = player2 != NULL ? player2->last_match : RESULTS_NONE;
+
+  int outcome = result->winner == 1 ? 1 : result->winner == 2 ? -1 : 0;
+  if(player1 != NULL) results_score(player1, index, result->score1, outcome);
+  if(player2 != NULL) results_score(player2, index, result->score2, -outcome);
+
+  atomic_store_explicit(&header->count, index + 1, memory_order_release);
+  flock(results->fd, LOCK_UN);
+  return 0;
+}
+
+/**
+ * Get the number of matches recorded.
+ */
+uint32_t results_count(const results_t* results) {
+  return atomic_load_explicit(&results->header->count, memory_order_acquire);
+}
+
+/**
+ * Does one player rank above another on the leaderboard?
+ */
+static bool results_ranks_above(const player_record_t* a, const player_record_t* b) {
+  if(a->wins != b->wins) return a->wins > b->wins;
+  if(a->matches != b->matches) return a->matches < b->matches;
+  return a->best_score > b->best_score;
+}
+
+/**
+ * Find the players with the most wins.
+ */
+size_t results_leaderboard(results_t* results, player_record_t* top, size_t n) {
+  size_t found = 0;
+  if(n == 0) return 0;
+
+  // The index is small next to the matches, so look at every slot and keep
+  // the best n in order
+  flock(results->fd, LOCK_SH);
+  for(size_t i=0; i<RESULTS_MAX_PLAYERS; i++) {
+    player_record_t* player = &results->players[i];
+    if(player->name[0] == '\0') continue;
+
+    size_t pos = found;
+    while(pos > 0 && results_ranks_above(player, &top[pos - 1])) pos--;
+    if(pos == n) continue;
+
+    size_t last = found < n ? found : n - 1;
+    memmove(&top[pos + 1], &top[pos], (last - pos) * sizeof(player_record_t));
+    top[pos] = *player;
+    if(found < n) found++;
+  }
+  flock(results->fd, LOCK_UN);
+
+  return found;
+}
+
+/**
+ * Find a player in the index.
+ */
+bool results_player(results_t* results, const char* name, player_record_t* player) {
+  flock(results->fd, LOCK_SH);
+  player_record_t* slot = results_find(results, name, false);
+  if(slot != NULL) *player = *slot;
+  flock(results->fd, LOCK_UN);
+  return slot != NULL;
+}
+
+/**
+ * Get a player's most recent matches, newest first.
+ */
+size_t results_history(results_t* results, const char* name, match_result_t* history, size_t n) {
+  player_record_t player;
+  if(!results_player(results, name, &player)) return 0;
+
+  // Follow the player's chain back through the matches. Matches are never
+  // changed once counted, so this needs no lock.
+  uint32_t count = results_count(results);
+  uint32_t match = player.last_match;
+  size_t found = 0;
+  while(found < n && match != RESULTS_NONE && match < count) {
+    const match_result_t* result = &results->matches[match];
+    history[found++] = *result;
+    match = strncmp(result->name1, name, PLAYER_NAME_MAX) == 0 ? result->prev1 : result->prev2;
+  }
+  return found;
+}
@@ -0,0 +1,171 @@
+#ifndef RESULTS_H
+#define RESULTS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "protocol.h"
+
+// Every results file starts with this value
+#define RESULTS_MAGIC 0x52534e53 // "SNSR"
+#define RESULTS_VERSION 1
+
+// Number of slots in the player index. This must be a power of two, and
+// players beyond it have their matches recorded but not indexed.
+#define RESULTS_MAX_PLAYERS 4096
+
+// Most matches a results file can hold. This much address space is reserved
+// when the file is opened, but the file only grows as matches are added.
+#define RESULTS_MAX_MATCHES (1 << 20)
+
+// Number of matches the file grows by when it fills up
+#define RESULTS_GROW 4096
+
+// Marks the end of a player's chain of matches
+#define RESULTS_NONE UINT32_MAX
+
+/**
+ * One finished match. Every record is the same size, so match n is found
+ * without reading the ones before it.
+ */
+typedef struct match_result {
+  uint64_t finished;                //< When the match ended, in ms since UNIX epoch
+  uint32_t ticks;                   //< How many ticks the match lasted
+  uint32_t winner;                  //< 1 or 2, or 0 for a tie
+  int32_t score1;
+  int32_t score2;
+  char name1[PLAYER_NAME_MAX];      //< Player 1's name, which may fill the array
+  char name2[PLAYER_NAME_MAX];
+
+  // The previous match each player played, or RESULTS_NONE, so a player's
+  // history is read by following the chain back from their latest match
+  uint32_t prev1;
+  uint32_t prev2;
+} match_result_t;
+
+/**
+ * A player's slot in the index, which sums up every match they played.
+ */
+typedef struct player_record {
+  char name[PLAYER_NAME_MAX];       //< Empty if the slot is unused
+  uint32_t matches;
+  uint32_t wins;
+  uint32_t losses;
+  uint32_t ties;
+  int32_t best_score;
+  uint32_t last_match;              //< The player's most recent match
+  uint64_t total_score;
+} player_record_t;
+
+/**
+ * The header at the start of every results file. The player index follows
+ * it, then the matches.
+ */
+typedef struct results_header {
+  uint32_t magic;
+  uint32_t version;
+
+  // Sizes of the records, to catch a file written by a different build
+  uint32_t match_size;
+  uint32_t player_size;
+
+  // Number of matches the file has room for
+  uint32_t capacity;
+
+  // Number of matches recorded. Each match is written before this counts
+  // it, so readers never need the lock to read the matches it covers.
+  _Atomic uint32_t count;
+} results_header_t;
+
+/**
+ * A results file mapped into memory.
+ */
+typedef struct results {
+  int fd;
+  bool writable;
+
+  // The mapping, which covers the largest file there can be
+  uint8_t* data;
+  size_t size;
+
+  // Where the parts of the file are in the mapping
+  results_header_t* header;
+  player_record_t* players;
+  match_result_t* matches;
+} results_t;
+
+/**
+ * Open a results file and map it into memory. This only reads the header, so
+ * it takes the same time however many matches the file holds.
+ *
+ * \param results   The results to initialize
+ * \param path      The file to open
+ * \param writable  Should matches be added? If so, the file is created if it
+ *                  doesn't exist.
+ *
+ * \returns         0 on success, or -1 with errno set on failure. errno is
+ *                  EINVAL if the file is not a results file from this build.
+ */
+int results_open(results_t* results, const char* path, bool writable);
+
+/**
+ * Unmap a results file and close it.
+ */
+void results_close(results_t* results);
+
+/**
+ * Add a finished match, and update both players in the index. Other servers
+ * may add to the same file at once, so this briefly holds a lock on it, but
+ * it never waits for the disk.
+ *
+ * \param results   The results to add to
+ * \param result    The match. Its chain of previous matches is filled in.
+ *
+ * \returns         0 on success, or -1 with errno set on failure.
+ */
+int results_append(results_t* results, const match_result_t* result);
+
+/**
+ * Get the number of matches recorded.
+ */
+uint32_t results_count(const results_t* results);
+
+/**
+ * Find the players with the most wins. Ties are broken by the fewest matches
+ * played, then the best score.
+ *
+ * \param results   The results to search
+ * \param top       The best players are written here, best first
+ * \param n         The number of players wanted
+ *
+ * \returns         The number of players written, which is less than n if
+ *                  fewer have played.
+ */
+size_t results_leaderboard(results_t* results, player_record_t* top, size_t n);
+
+/**
+ * Find a player in the index.
+ *
+ * \param results   The results to search
+ * \param name      The player's name
+ * \param player    The player's record is copied here
+ *
+ * \returns         false if the player has no matches indexed.
+ */
+bool results_player(results_t* results, const char* name, player_record_t* player);
+
+/**
+ * Get a player's most recent matches, newest first.
+ *
+ * \param results   The results to search
+ * \param name      The player's name
+ * \param history   The matches are written here
+ * \param n         The most matches wanted
+ *
+ * \returns         The number of matches written.
+ */
+size_t results_history(results_t* results, const char* name, match_result_t* history, size_t n);
+
+#endif
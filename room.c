@@ -0,0 +1,253 @@
+#include "room.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * Start a room's process, with a pair of sockets between it and the lobby.
+ */
+static int room_start(room_pool_t* pool, int index) {
+  // Messages go over a stream, so the lobby hears when a room exits
+  int channel[2];
+  int datagrams[2];
+  if(socketpair(AF_UNIX, SOCK_STREAM, 0, channel) == -1) return -1;
+  if(socketpair(AF_UNIX, SOCK_DGRAM, 0, datagrams) == -1) {
+    close(channel[0]);
+    close(channel[1]);
+    return -1;
+  }
+
+  pid_t pid = fork();
+  if(pid == -1) {
+    close(channel[0]);
+    close(channel[1]);
+    close(datagrams[0]);
+    close(datagrams[1]);
+    return -1;
+  }
+
+  if(pid == 0) {
+    // The room only keeps its own ends of its own sockets
+    for(int i=0; i<pool->count; i++) {
+      if(i != index && pool->rooms[i].pid > 0) {
+        close(pool->rooms[i].channel);
+        close(pool->rooms[i].datagrams);
+      }
+    }
+    close(channel[0]);
+    close(datagrams[0]);
+    pool->run(index, channel[1], datagrams[1]);
+    exit(0);
+  }
+
+  close(channel[1]);
+  close(datagrams[1]);
+  pool->rooms[index] = (room_t){
+    .pid = pid,
+    .channel = channel[0],
+    .datagrams = datagrams[0],
+    .state = ROOM_IDLE
+  };
+  return 0;
+}
+
+/**
+ * Start a process for each room.
+ */
+int room_pool_open(room_pool_t* pool, int count, room_fn_t run) {
+  pool->count = 0;
+  pool->num_idle = 0;
+  pool->filling = -1;
+  pool->latest = -1;
+  pool->run = run;
+
+  for(int i=0; i<count; i++) {
+    if(room_start(pool, i) == -1) return -1;
+    pool->count++;
+  }
+
+  // Hand out the first room first
+  for(int i=count-1; i>=0; i--) {
+    pool->idle[pool->num_idle++] = i;
+  }
+  return 0;
+}
+
+/**
+ * Get the room new players go to.
+ */
+int room_pool_filling(room_pool_t* pool) {
+  if(pool->filling == -1 && pool->num_idle > 0) {
+    pool->filling = pool->idle[--pool->num_idle];
+    pool->rooms[pool->filling].state = ROOM_FILLING;
+  }
+  return pool->filling;
+}
+
+/**
+ * Note that a room's match has started.
+ */
+void room_pool_started(room_pool_t* pool, int index) {
+  pool->rooms[index].state = ROOM_PLAYING;
+  if(pool->filling == index) pool->filling = -1;
+  pool->latest = index;
+}
+
+/**
+ * Give a room whose match is over back to the pool.
+ */
+void room_pool_ready(room_pool_t* pool, int index) {
+  if(pool->rooms[index].state == ROOM_IDLE) return;
+  if(pool->filling == index) pool->filling = -1;
+  if(pool->latest == index) pool->latest = -1;
+  pool->rooms[index].state = ROOM_IDLE;
+  pool->idle[pool->num_idle++] = index;
+}
+
+/**
+ * Start a new process for a room whose process has exited.
+ */
+int room_pool_restart(room_pool_t* pool, int index) {
+  room_t* room = &pool->rooms[index];
+  close(room->channel);
+  close(room->datagrams);
+  waitpid(room->pid, NULL, 0);
+  room->pid = 0;
+
+  // The new process starts out idle, like the old one did
+  room_pool_ready(pool, index);
+  return room_start(pool, index);
+}
+
+/**
+ * Send a message between the lobby and a room.
+ */
+int room_send(int channel, uint32_t type, int fd, const hello_t* hello) {
+  room_msg_t msg = { .type = type };
+  if(hello != NULL) msg.hello = *hello;
+
+  struct iovec part = { .iov_base = &msg, .iov_len = sizeof(msg) };
+  union {
+    struct cmsghdr header;
+    char space[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct msghdr header = {
+    .msg_iov = &part,
+    .msg_iovlen = 1
+  };
+
+  // The connection goes along with the message
+  if(fd != -1) {
+    memset(&control, 0, sizeof(control));
+    header.msg_control = control.space;
+    header.msg_controllen = sizeof(control.space);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&header);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  }
+
+  ssize_t rc;
+  do {
+    rc = sendmsg(channel, &header, 0);
+  } while(rc == -1 && errno == EINTR);
+  if(rc == -1) return -1;
+
+  // Send whatever didn't fit the first time
+  size_t sent = rc;
+  while(sent < sizeof(msg)) {
+    rc = write(channel, (uint8_t*)&msg + sent, sizeof(msg) - sent);
+    if(rc == -1 && errno == EINTR) continue;
+    if(rc <= 0) return -1;
+    sent += rc;
+  }
+  return 0;
+}
+
+/**
+ * Receive a message between the lobby and a room.
+ */
+int room_receive(int channel, room_msg_t* msg, int* fd, bool wait) {
+  *fd = -1;
+
+  struct iovec part = { .iov_base = msg, .iov_len = sizeof(room_msg_t) };
+  union {
+    struct cmsghdr header;
+    char space[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct msghdr header = {
+    .msg_iov = &part,
+    .msg_iovlen = 1,
+    .msg_control = control.space,
+    .msg_controllen = sizeof(control.space)
+  };
+
+  ssize_t rc;
+  do {
+    rc = recvmsg(channel, &header, wait ? 0 : MSG_DONTWAIT);
+  } while(rc == -1 && errno == EINTR);
+  if(rc == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+  if(rc <= 0) return -1;
+
+  for(struct cmsghdr* cmsg = CMSG_FIRSTHDR(&header); cmsg != NULL; cmsg = CMSG_NXTHDR(&header, cmsg)) {
+    if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+  }
+
+  // The rest of a message that arrived in pieces is on its way
+  size_t got = rc;
+  while(got < sizeof(room_msg_t)) {
+    rc = read(channel, (uint8_t*)msg + got, sizeof(room_msg_t) - got);
+    if(rc == -1 && errno == EINTR) continue;
+    if(rc <= 0) {
+      if(*fd != -1) close(*fd);
+      *fd = -1;
+      return -1;
+    }
+    got += rc;
+  }
+  return 1;
+}
+
+/**
+ * Pass a player's datagram on to a room.
+ */
+void room_send_datagram(int datagrams, const struct sockaddr_in* from, const void* data, size_t length) {
+  struct iovec parts[] = {
+    { .iov_base = (void*)from, .iov_len = sizeof(struct sockaddr_in) },
+    { .iov_base = (void*)data, .iov_len = length }
+  };
+  struct msghdr header = {
+    .msg_iov = parts,
+    .msg_iovlen = 2
+  };
+  sendmsg(datagrams, &header, MSG_DONTWAIT);
+}
+
+/**
+ * Wait for a datagram the lobby passed on.
+ */
+ssize_t room_receive_datagram(int datagrams, void* data, size_t size, struct sockaddr_in* from) {
+  struct iovec parts[] = {
+    { .iov_base = from, .iov_len = sizeof(struct sockaddr_in) },
+    { .iov_base = data, .iov_len = size }
+  };
+  struct msghdr header = {
+    .msg_iov = parts,
+    .msg_iovlen = 2
+  };
+
+  ssize_t rc;
+  do {
+    rc = recvmsg(datagrams, &header, 0);
+  } while(rc == -1 && errno == EINTR);
+  if(rc == -1) return -1;
+  return (size_t)rc < sizeof(struct sockaddr_in) ? 0 : rc - (ssize_t)sizeof(struct sockaddr_in);
+}
@@ -0,0 +1,175 @@
+#ifndef ROOM_H
+#define ROOM_H
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "protocol.h"
+
+// Each room puts its number in the low bits of the session tokens it gives
+// out, so the lobby can tell which room a reconnecting player or a datagram
+// belongs to without asking. This also limits how many rooms there can be.
+#define ROOM_BITS 8
+#define MAX_ROOMS (1 << ROOM_BITS)
+
+// Messages between the lobby and its rooms
+#define ROOM_CONNECTION 1   //< A connection and its hello, passed to a room, or back from a room that can't seat a player
+#define ROOM_STARTED 2      //< The room's match has both its players
+#define ROOM_READY 3        //< The room's match is over, and the room is set up for the next one
+
+// What a room is doing, as far as the lobby knows
+#define ROOM_IDLE 0         //< Waiting to be handed players
+#define ROOM_FILLING 1      //< Taking players as they arrive
+#define ROOM_PLAYING 2      //< Playing a match
+
+/**
+ * A message between the lobby and a room. A ROOM_CONNECTION message carries
+ * the connection's file descriptor with it.
+ */
+typedef struct room_msg {
+  uint32_t type;    //< One of the ROOM_ message types
+  uint32_t pad;
+  hello_t hello;    //< The hello the connection sent, for ROOM_CONNECTION
+} room_msg_t;
+
+/**
+ * A process that plays one match after another, as the lobby hands it
+ * players.
+ */
+typedef struct room {
+  pid_t pid;
+  int channel;      //< The lobby's end of the socket room_msg_t messages go over
+  int datagrams;    //< The lobby's end of the socket players' datagrams are passed on through
+  int state;        //< One of the ROOM_ states
+} room_t;
+
+/**
+ * Run in each room's process, which exits when it returns.
+ *
+ * \param index      The room's number
+ * \param channel    The room's end of the socket room_msg_t messages go over
+ * \param datagrams  The room's end of the socket players' datagrams arrive on
+ */
+typedef void (*room_fn_t)(int index, int channel, int datagrams);
+
+/**
+ * The rooms a dedicated server keeps ready, and which of them players and
+ * spectators are sent to. Idle rooms are kept on a stack, so handing one
+ * out or getting one back takes constant time.
+ */
+typedef struct room_pool {
+  room_t rooms[MAX_ROOMS];
+  int count;
+  int idle[MAX_ROOMS];  //< The idle rooms, the most recently used on top
+  int num_idle;
+  int filling;          //< The room taking players, or -1
+  int latest;           //< The room whose match started last, while it is playing, or -1
+  room_fn_t run;
+} room_pool_t;
+
+/**
+ * Start a process for each room. Each one inherits everything the lobby has
+ * open, such as its listening sockets.
+ *
+ * \param pool   The pool to fill
+ * \param count  The number of rooms, at most MAX_ROOMS
+ * \param run    The function each room's process runs
+ *
+ * \returns      0 on success, or -1 with errno set if a room couldn't be
+ *               started.
+ */
+int room_pool_open(room_pool_t* pool, int count, room_fn_t run);
+
+/**
+ * Get the room new players go to. When no room is taking players, an idle
+ * one starts to.
+ *
+ * \returns   The room, or -1 if every room is playing.
+ */
+int room_pool_filling(room_pool_t* pool);
+
+/**
+ * Note that a room's match has started, so it takes no more players.
+ */
+void room_pool_started(room_pool_t* pool, int index);
+
+/**
+ * Give a room whose match is over back to the pool.
+ */
+void room_pool_ready(room_pool_t* pool, int index);
+
+/**
+ * Start a new process for a room whose process has exited, and treat it as
+ * idle.
+ *
+ * \returns   0 on success, or -1 with errno set on failure.
+ */
+int room_pool_restart(room_pool_t* pool, int index);
+
+/**
+ * Put a room's number in a session token.
+ */
+static inline uint64_t room_token(uint64_t token, int index) {
+  return (token & ~(uint64_t)(MAX_ROOMS - 1)) | (uint64_t)index;
+}
+
+/**
+ * Get the number of the room that gave out a session token.
+ */
+static inline int token_room(uint64_t token) {
+  return token & (MAX_ROOMS - 1);
+}
+
+/**
+ * Send a message between the lobby and a room.
+ *
+ * \param channel  Either end of the socket between them
+ * \param type     One of the ROOM_ message types
+ * \param fd       The connection to pass along, or -1. The sender still has
+ *                 to close its own copy.
+ * \param hello    The hello the connection sent, or NULL
+ *
+ * \returns        0 on success, or -1 with errno set on failure.
+ */
+int room_send(int channel, uint32_t type, int fd, const hello_t* hello);
+
+/**
+ * Receive a message between the lobby and a room.
+ *
+ * \param channel  Either end of the socket between them
+ * \param msg      The message is written here
+ * \param fd       The connection passed along with it is written here, or -1
+ * \param wait     Should this block until a message arrives?
+ *
+ * \returns        1 if a message was received, 0 if none was waiting, or -1
+ *                 if the other end has gone away.
+ */
+int room_receive(int channel, room_msg_t* msg, int* fd, bool wait);
+
+/**
+ * Pass a player's datagram on to a room. Datagrams are dropped rather than
+ * held up if the room is behind, just as the network would.
+ *
+ * \param datagrams  The lobby's end of the room's datagram socket
+ * \param from       Where the datagram came from
+ * \param data       The datagram
+ * \param length     Its length
+ */
+void room_send_datagram(int datagrams, const struct sockaddr_in* from, const void* data, size_t length);
+
+/**
+ * Wait for a datagram the lobby passed on.
+ *
+ * \param datagrams  The room's end of its datagram socket
+ * \param data       The datagram is written here
+ * \param size       The most bytes to write
+ * \param from       Where the datagram came from is written here
+ *
+ * \returns          The datagram's length, or -1 with errno set on failure.
+ */
+ssize_t room_receive_datagram(int datagrams, void* data, size_t size, struct sockaddr_in* from);
+
+#endif
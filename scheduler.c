@@ -1,12 +1,25 @@
 #define _XOPEN_SOURCE
 #define _XOPEN_SOURCE_EXTENDED
 
+// For ppoll, which waits with nanosecond precision
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
 #include "scheduler.h"
 
 #include <assert.h>
 #include <curses.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <ucontext.h>
+#include <unistd.h>
 
+#include "stats.h"
+#include "trace.h"
 #include "util.h"
 
 // This is an upper limit on the number of tasks we can create.
@@ -19,9 +32,14 @@
 #define WAITING_ON_INPUT 3
 #define SLEEPING 4
 #define RUNNING 5
+#define WAITING_ON_EVENT 6
 
 // This is the size of each task's stack memory
 #define STACK_SIZE 65536
+
+// New stacks are filled with this byte, so the part a task has never touched
+// can be told apart from the part it has used
+#define STACK_FILL 0xA5
 void schedule();
 
 
@@ -44,19 +62,69 @@ typedef struct task_info {
   // This stores the state of the task
   int state;
   
-  // This stores the time the task should wake up
-  size_t wakeup_time;
+  // This stores the time the task should wake up, from time_ns
+  uint64_t wakeup_ns;
   // This stores a task that this task is dependant on
   task_t dependant_task;
   
   int input;  //Char isn't going to work
 
+  // This stores the event the task is waiting for, and the count it last saw
+  task_event_t* event;
+  unsigned event_seen;
+
+  // The name monitoring and traces show for the task
+  const char* name;
+
+  // When tracing, these store when the task last started running and last
+  // stopped, in trace time
+  uint64_t trace_running_since;
+  uint64_t trace_blocked_since;
 
 } task_info_t;
 
 int current_task = 0; //< The handle of the currently-executing task
 int num_tasks = 1;    //< The number of tasks created so far
 task_info_t tasks[MAX_TASKS]; //< Information for every task
+uint64_t switches = 0; //< The number of times the scheduler has switched tasks
+
+// How long before a wakeup the scheduler stops sleeping and checks the time
+// in a loop instead, in nanoseconds. Zero means it always sleeps.
+uint64_t spin_ns = 0;
+
+// Where new tasks' stacks come from, or NULL to use malloc
+arena_t* stack_arena = NULL;
+
+// How late sleeping tasks woke up, in microseconds
+stats_hist_t wake_late_us;
+
+// Signalling an event writes to this pipe, so an idle scheduler can wait for
+// events, input, and the next wakeup time all at once
+int wake_pipe[2] = {-1, -1};
+
+// Traces show the scheduler's idle waits on this track
+#define IDLE_TRACK MAX_TASKS
+
+// What monitoring calls each state
+const char* state_ids[TASK_STATES] = {
+  [READY_TO_RUN] = "READY_TO_RUN",
+  [EXITED] = "EXITED",
+  [WAITING_ON_TASK] = "WAITING_ON_TASK",
+  [WAITING_ON_INPUT] = "WAITING_ON_INPUT",
+  [SLEEPING] = "SLEEPING",
+  [RUNNING] = "RUNNING",
+  [WAITING_ON_EVENT] = "WAITING_ON_EVENT"
+};
+
+// What traces call the time a task spends in each state before running again
+const char* state_names[] = {
+  [READY_TO_RUN] = "ready",
+  [WAITING_ON_TASK] = "waiting on task",
+  [WAITING_ON_INPUT] = "waiting on input",
+  [SLEEPING] = "sleeping",
+  [RUNNING] = "yielded",
+  [WAITING_ON_EVENT] = "waiting on event"
+};
 
 void print_current_task() {
   printf("Task info: State is %d\n", tasks[current_task].state);
@@ -68,6 +136,27 @@ void print_current_task() {
 void scheduler_init() {
   // TODO: Initialize the state of the scheduler
   tasks[current_task].state = READY_TO_RUN;
+
+  // The scheduler's thread records its own events, with each task on a track
+  trace_thread("scheduler");
+  task_set_name(current_task, "main");
+  trace_name_track(IDLE_TRACK, "idle");
+  trace_set_track(current_task);
+  tasks[current_task].trace_running_since = trace_now();
+
+  // Both ends are non-blocking: a full pipe already means a wakeup is pending
+  if(pipe(wake_pipe) == 0) {
+    fcntl(wake_pipe[0], F_SETFL, fcntl(wake_pipe[0], F_GETFL) | O_NONBLOCK);
+    fcntl(wake_pipe[1], F_SETFL, fcntl(wake_pipe[1], F_GETFL) | O_NONBLOCK);
+  }
+}
+
+/**
+ * Check whether a task waiting on an event can run again.
+ */
+bool event_ready(task_info_t* task) {
+  return atomic_load(&task->event->count) != task->event_seen ||
+         time_ns() >= task->wakeup_ns;
 }
 
 
@@ -82,26 +171,129 @@ void task_exit() {
   schedule();
 }
 
+/**
+ * Wait until a task may be able to run, if none can right now. The scheduler
+ * sleeps until the next wakeup time, new input on stdin, or a signal on the
+ * wake pipe, whichever comes first. When spinning is turned on, it stops
+ * sleeping a little before the wakeup time and returns so the caller can
+ * check again.
+ */
+void schedule_idle() {
+  uint64_t now = time_ns();
+  uint64_t wait = 1000000000;
+  bool input = false;
+  for(int i=0; i<num_tasks; i++) {
+    int state = tasks[i].state;
+    if(state == READY_TO_RUN ||
+       (state == WAITING_ON_TASK && tasks[tasks[i].dependant_task].state == EXITED) ||
+       (state == WAITING_ON_EVENT && event_ready(&tasks[i]))) {
+      return;
+    } else if(state == WAITING_ON_INPUT) {
+      input = true;
+    }
+
+    if(state == SLEEPING || state == WAITING_ON_EVENT) {
+      uint64_t until = tasks[i].wakeup_ns > now ? tasks[i].wakeup_ns - now : 0;
+      if(until < wait) wait = until;
+    }
+  }
+
+  // Spin through the last stretch before a wakeup instead of trusting the
+  // kernel to wake us on time
+  if(wait <= spin_ns) return;
+  wait -= spin_ns;
+
+  struct pollfd fds[2] = {
+    { .fd = wake_pipe[0], .events = POLLIN },
+    { .fd = input ? STDIN_FILENO : -1, .events = POLLIN }
+  };
+  uint64_t idle_start = trace_now();
+#if defined(__linux__)
+  struct timespec timeout = {
+    .tv_sec = wait / 1000000000,
+    .tv_nsec = wait % 1000000000
+  };
+  int rc = ppoll(fds, 2, &timeout, NULL);
+#else
+  // poll only takes milliseconds, so round up rather than wake early
+  int rc = poll(fds, 2, (wait + 999999) / 1000000);
+#endif
+  if(rc > 0 && (fds[0].revents & POLLIN)) {
+    // Empty the pipe so the next idle wait blocks again
+    char drain[64];
+    while(read(wake_pipe[0], drain, sizeof(drain)) > 0) {}
+  }
+  if(trace_enabled) {
+    trace_span_on(IDLE_TRACK, "idle", idle_start, trace_now(), "timeout_us", wait / 1000);
+  }
+}
+
+/**
+ * Record a switch from one task to another in the trace. The first task's
+ * time running ends, and the second task's wait ends. A sleeping task's wait
+ * shows how late it woke up.
+ *
+ * \param from  The task giving up the processor
+ * \param to    The task about to run, which has not been marked running yet
+ */
+void trace_switch(int from, int to) {
+  uint64_t now = trace_now();
+  task_info_t* task = &tasks[from];
+  trace_span_on(from, "running", task->trace_running_since, now, NULL, 0);
+  task->trace_blocked_since = now;
+
+  task = &tasks[to];
+  if(task->state == SLEEPING) {
+    int64_t late_us = ((int64_t)now - (int64_t)task->wakeup_ns) / 1000;
+    trace_span_on(to, state_names[task->state], task->trace_blocked_since, now, "late_us", late_us);
+  } else {
+    trace_span_on(to, state_names[task->state], task->trace_blocked_since, now, NULL, 0);
+  }
+  task->trace_running_since = now;
+  trace_set_track(to);
+}
+
+/**
+ * Check whether a task can run now. A task waiting on input takes the input
+ * here, if there is any.
+ */
+bool task_runnable(task_info_t* task) {
+  int state = task->state;
+  if(state == READY_TO_RUN) { // Check if task is ready to run
+    return true;
+  } else if(state == SLEEPING) { // Check if task is done sleeping
+    uint64_t now = time_ns();
+    if(now < task->wakeup_ns) return false;
+    stats_record(&wake_late_us, (now - task->wakeup_ns) / 1000);
+    return true;
+  } else if(state == WAITING_ON_TASK) { // Check if dependant task is complete
+    return tasks[task->dependant_task].state == EXITED;
+  } else if(state == WAITING_ON_INPUT) { // Check if task waiting on input has input to process
+    return (task->input = getch()) != ERR;
+  } else if(state == WAITING_ON_EVENT) { // Check if the event was signalled or the wait timed out
+    return event_ready(task);
+  }
+  return false;
+}
+
 void schedule() {
   // Save current context
+  int previous_task = current_task;
   ucontext_t * temp = &(tasks[current_task].context);
+  int checked = 0;
   while(1) {
+    // After a full pass with nothing to run, wait instead of spinning
+    if(checked == num_tasks) {
+      schedule_idle();
+      checked = 0;
+    }
+    checked++;
+
     //Increment current task
     current_task = (current_task + 1) % num_tasks;
-    int current_state = tasks[current_task].state;
-    if(current_state == READY_TO_RUN) { // Check if task is ready to run
-      tasks[current_task].state = RUNNING;
-      swapcontext(temp, &tasks[current_task].context);
-      return;
-    } else if(current_state == SLEEPING && (time_ms() > tasks[current_task].wakeup_time)) { // Check if task is done sleeping
-      tasks[current_task].state = RUNNING;
-      swapcontext(temp, &tasks[current_task].context);
-      return;
-    } else if(current_state == WAITING_ON_TASK && tasks[tasks[current_task].dependant_task].state == EXITED) { // Check if dependant task is complete
-      tasks[current_task].state = RUNNING;
-      swapcontext(temp, &tasks[current_task].context);
-      return;
-    } else if(current_state == WAITING_ON_INPUT && (tasks[current_task].input = getch()) != ERR) { // Check if task waiting on input has input to process
+    if(task_runnable(&tasks[current_task])) {
+      if(trace_enabled) trace_switch(previous_task, current_task);
+      if(current_task != previous_task) switches++;
       tasks[current_task].state = RUNNING;
       swapcontext(temp, &tasks[current_task].context);
       return;
@@ -109,6 +301,39 @@ void schedule() {
   }
 }
 
+/**
+ * Allocate a stack for a new task.
+ */
+void* task_stack_alloc() {
+  void* stack = stack_arena != NULL ? arena_alloc(stack_arena, STACK_SIZE) : malloc(STACK_SIZE);
+  if(stack == NULL) {
+    perror("Failed to allocate a task stack");
+    exit(2);
+  }
+  return stack;
+}
+
+/**
+ * Find a slot for a new task. The slot of a task that has exited is used
+ * again, unless a task waiting for it hasn't seen it exit yet.
+ *
+ * \returns   The slot's index.
+ */
+int task_slot() {
+  for(int i=1; i<num_tasks; i++) {
+    if(tasks[i].state != EXITED) continue;
+
+    bool awaited = false;
+    for(int j=0; j<num_tasks; j++) {
+      if(tasks[j].state == WAITING_ON_TASK && tasks[j].dependant_task == i) awaited = true;
+    }
+    if(!awaited) return i;
+  }
+
+  assert(num_tasks < MAX_TASKS);
+  return num_tasks++;
+}
+
 /**
  * Create a new task and add it to the scheduler.
  *
@@ -117,19 +342,24 @@ void schedule() {
  */
 void task_create(task_t* handle, task_fn_t fn) {
   // Claim an index for the new task
-  int index = num_tasks;
-  num_tasks++;
+  int index = task_slot();
 
   // Set the task handle to this index, since task_t is just an int
   *handle = index;
 
+  // A task that exited leaves its stacks behind for the next one in its slot
+  void* exit_stack = tasks[index].exit_context.uc_stack.ss_sp;
+  void* stack = tasks[index].context.uc_stack.ss_sp;
+  if(exit_stack == NULL) exit_stack = task_stack_alloc();
+  if(stack == NULL) stack = task_stack_alloc();
+
   // We're going to make two contexts: one to run the task, and one that runs at the end of the task so we can clean up. Start with the second
 
   // First, duplicate the current context as a starting point
   getcontext(&tasks[index].exit_context);
 
   // Set up a stack for the exit context
-  tasks[index].exit_context.uc_stack.ss_sp = malloc(STACK_SIZE);
+  tasks[index].exit_context.uc_stack.ss_sp = exit_stack;
   tasks[index].exit_context.uc_stack.ss_size = STACK_SIZE;
 
   // Set up a context to run when the task function returns. This should call task_exit.
@@ -138,9 +368,11 @@ void task_create(task_t* handle, task_fn_t fn) {
   // Now we start with the task's actual running context
   getcontext(&tasks[index].context);
 
-  // Allocate a stack for the new task and add it to the context
-  tasks[index].context.uc_stack.ss_sp = malloc(STACK_SIZE);
+  // Add the task's own stack to the context. Filling it lets task_stack_used
+  // see how deep the task has gone.
+  tasks[index].context.uc_stack.ss_sp = stack;
   tasks[index].context.uc_stack.ss_size = STACK_SIZE;
+  memset(tasks[index].context.uc_stack.ss_sp, STACK_FILL, STACK_SIZE);
 
   // Now set the uc_link field, which sets things up so our task will go to the exit context when the task function finishes
   tasks[index].context.uc_link = &tasks[index].exit_context;
@@ -172,11 +404,21 @@ void task_wait(task_t handle) {
  * \param ms  The number of milliseconds the task should sleep.
  */
 void task_sleep(size_t ms) {
+  task_sleep_until(time_ns() + (uint64_t)ms * 1000000);
+}
+
+/**
+ * The currently-executing task should sleep until a deadline, running other
+ * tasks in the meantime.
+ *
+ * \param deadline_ns  The time to wake up, from time_ns
+ */
+void task_sleep_until(uint64_t deadline_ns) {
   // TODO: Block this task until the requested time has elapsed.
   // Hint: Record the time the task should wake up instead of the time left for it to sleep. The bookkeeping is easier this way.
   tasks[current_task].state = SLEEPING;
   // Assign time to wake up
-  tasks[current_task].wakeup_time = time_ms() + ms;
+  tasks[current_task].wakeup_ns = deadline_ns;
   schedule();
 }
 
@@ -201,3 +443,170 @@ int task_readchar() {
     return key;
   }
 }
+
+/**
+ * Signal an event, waking any task waiting for it. This is safe to call from
+ * any thread, and wakes the scheduler if it is idle.
+ *
+ * \param event  The event to signal
+ */
+void task_event_signal(task_event_t* event) {
+  atomic_fetch_add(&event->count, 1);
+
+  // A full pipe already holds a wakeup, so a failed write is fine
+  char wake = 0;
+  if(wake_pipe[1] != -1 && write(wake_pipe[1], &wake, 1) == -1) {}
+}
+
+/**
+ * Wait until an event has been signalled, or until a timeout passes. The
+ * scheduler runs other tasks while this task waits.
+ *
+ * \param event    The event to wait for
+ * \param seen     The event's count when the caller last woke. This is updated
+ *                 to the current count.
+ * \param timeout  The most milliseconds to wait
+ *
+ * \returns        true if the event was signalled, or false on a timeout.
+ */
+bool task_event_wait(task_event_t* event, unsigned* seen, size_t timeout) {
+  if(atomic_load(&event->count) == *seen) {
+    tasks[current_task].state = WAITING_ON_EVENT;
+    tasks[current_task].event = event;
+    tasks[current_task].event_seen = *seen;
+    tasks[current_task].wakeup_ns = time_ns() + (uint64_t)timeout * 1000000;
+    schedule();
+  }
+
+  unsigned count = atomic_load(&event->count);
+  bool signalled = count != *seen;
+  *seen = count;
+  return signalled;
+}
+
+/**
+ * Spin instead of sleeping for the last part of every wait for a wakeup.
+ */
+void scheduler_set_spin(uint64_t ns) {
+  spin_ns = ns;
+}
+
+/**
+ * Take the stacks of tasks created from now on out of an arena.
+ */
+void scheduler_set_arena(arena_t* arena) {
+  if(arena == stack_arena) return;
+
+  // Tasks that exited leave stacks from the old arena, or from malloc, which
+  // new tasks mustn't reuse
+  for(int i=1; i<num_tasks; i++) {
+    if(tasks[i].state != EXITED) continue;
+    if(stack_arena == NULL) {
+      free(tasks[i].exit_context.uc_stack.ss_sp);
+      free(tasks[i].context.uc_stack.ss_sp);
+    }
+    tasks[i].exit_context.uc_stack.ss_sp = NULL;
+    tasks[i].context.uc_stack.ss_sp = NULL;
+  }
+  stack_arena = arena;
+}
+
+/**
+ * Set up slots and stacks for tasks ahead of time.
+ */
+void scheduler_reserve(int count) {
+  for(int i=0; i<count; i++) {
+    assert(num_tasks < MAX_TASKS);
+    int index = num_tasks++;
+
+    // The slot looks like one whose task has exited, so the next task
+    // created takes it over. Filling the stack brings its pages in now.
+    tasks[index].state = EXITED;
+    tasks[index].exit_context.uc_stack.ss_sp = task_stack_alloc();
+    tasks[index].context.uc_stack.ss_sp = task_stack_alloc();
+    memset(tasks[index].exit_context.uc_stack.ss_sp, 0, STACK_SIZE);
+    memset(tasks[index].context.uc_stack.ss_sp, STACK_FILL, STACK_SIZE);
+  }
+}
+
+/**
+ * Get a histogram of how late sleeping tasks woke up.
+ */
+stats_hist_t* scheduler_wake_late() {
+  return &wake_late_us;
+}
+
+/**
+ * Give a task a name for monitoring and traces to show.
+ *
+ * \param handle  The task to name
+ * \param name    The name, which must stay valid while the program runs
+ */
+void task_set_name(task_t handle, const char* name) {
+  tasks[handle].name = name;
+  trace_name_track(handle, name);
+}
+
+/**
+ * Get a task's name, or NULL if it has none.
+ */
+const char* task_name(task_t handle) {
+  return tasks[handle].name;
+}
+
+/**
+ * Get the number of tasks created so far, including the main task. Handles
+ * run from 0 up to one less than this.
+ */
+int scheduler_num_tasks() {
+  return num_tasks;
+}
+
+/**
+ * Get the number of times the scheduler has switched from one task to
+ * another.
+ */
+uint64_t scheduler_switches() {
+  return switches;
+}
+
+/**
+ * Get the state a task is in, from 0 up to one less than TASK_STATES.
+ */
+int task_state(task_t handle) {
+  return tasks[handle].state;
+}
+
+/**
+ * Get the name of a task state, such as "SLEEPING".
+ */
+const char* task_state_name(int state) {
+  return state_ids[state];
+}
+
+/**
+ * Get the most stack a task has used so far, in bytes. This looks for the
+ * deepest byte that no longer holds the fill from task_create, so it can
+ * miss a few bytes that happened to be written with the fill value.
+ *
+ * \returns   The bytes used, or 0 for the main task, which runs on the
+ *            program's own stack.
+ */
+size_t task_stack_used(task_t handle) {
+  if(handle == 0) return 0;
+
+  // Stacks grow down, so the untouched part is at the bottom
+  const unsigned char* stack = tasks[handle].context.uc_stack.ss_sp;
+  size_t untouched = 0;
+  while(untouched < STACK_SIZE && stack[untouched] == STACK_FILL) {
+    untouched++;
+  }
+  return STACK_SIZE - untouched;
+}
+
+/**
+ * Get the size of each task's stack, in bytes.
+ */
+size_t task_stack_size() {
+  return STACK_SIZE;
+}
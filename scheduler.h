@@ -1,7 +1,16 @@
 #ifndef SCHEDULER_H
 #define SCHEDULER_H
 
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "stats.h"
+
+/// The number of states a task can be in, as returned by task_state
+#define TASK_STATES 7
 
 /// This is the type of a function run in a scheduler task
 typedef void (*task_fn_t)();
@@ -10,6 +19,14 @@ typedef void (*task_fn_t)();
 /// These will just be an index in our large array of tasks.
 typedef int task_t;
 
+/**
+ * Something tasks can wait for, such as a new board being ready to draw. Any
+ * thread can signal an event, not just scheduler tasks.
+ */
+typedef struct task_event {
+  atomic_uint count;    //< The number of times the event has been signalled
+} task_event_t;
+
 /**
  * Initialize the scheduler. Programs should call this before calling any other
  * functiosn in this file.
@@ -17,7 +34,8 @@ typedef int task_t;
 void scheduler_init();
 
 /**
- * Create a new task and add it to the scheduler.
+ * Create a new task and add it to the scheduler. The task takes over the
+ * slot and stacks of one that has exited, if there is one.
  *
  * \param handle  The handle for this task will be written to this location.
  * \param fn      The new task will run this function.
@@ -41,6 +59,51 @@ void task_wait(task_t handle);
  */
 void task_sleep(size_t ms);
 
+/**
+ * The currently-executing task should sleep until a deadline. The scheduler
+ * runs other tasks until then. Sleeping until a series of deadlines a fixed
+ * interval apart keeps a loop on schedule however long each pass takes,
+ * where sleeping for the interval would fall further behind every pass.
+ *
+ * \param deadline_ns  The time to wake up, from time_ns. A deadline that has
+ *                     passed only lets other tasks run first.
+ */
+void task_sleep_until(uint64_t deadline_ns);
+
+/**
+ * Make sleeping tasks wake up closer to their deadlines. The scheduler sleeps
+ * until this long before the next deadline, then checks the time in a loop
+ * until it arrives, so it keeps the processor busy for that long.
+ *
+ * \param ns  How long before each deadline to start spinning, in
+ *            nanoseconds. Zero, the default, turns spinning off.
+ */
+void scheduler_set_spin(uint64_t ns);
+
+/**
+ * Take the stacks of tasks created from now on out of an arena, so they are
+ * released along with it. Every task with a stack from the arena must have
+ * exited before the arena is released. A new task reuses the stacks of one
+ * that has exited, as long as the arena hasn't changed since.
+ *
+ * \param arena  The arena, or NULL to allocate stacks with malloc
+ */
+void scheduler_set_arena(arena_t* arena);
+
+/**
+ * Set up slots and stacks for tasks ahead of time, so creating that many
+ * tasks later allocates nothing and touches no new memory.
+ *
+ * \param count  The number of tasks to set up for
+ */
+void scheduler_reserve(int count);
+
+/**
+ * Get a histogram of how late sleeping tasks woke up after their deadlines,
+ * in microseconds. Only the scheduler's thread records in it.
+ */
+stats_hist_t* scheduler_wake_late();
+
 /**
  * Read a character from user input. If no input is available, the task should
  * block until input becomes available. The scheduler should run a different
@@ -50,4 +113,75 @@ void task_sleep(size_t ms);
  */
 int task_readchar();
 
+/**
+ * Signal an event, waking any task waiting for it. This is safe to call from
+ * any thread, and wakes the scheduler if it is idle.
+ *
+ * \param event  The event to signal
+ */
+void task_event_signal(task_event_t* event);
+
+/**
+ * Wait until an event has been signalled, or until a timeout passes. The
+ * scheduler runs other tasks while this task waits.
+ *
+ * \param event    The event to wait for
+ * \param seen     The event's count when the caller last woke. The wait returns
+ *                 right away if the event has been signalled since then. This
+ *                 is updated to the current count.
+ * \param timeout  The most milliseconds to wait
+ *
+ * \returns        true if the event was signalled, or false on a timeout.
+ */
+bool task_event_wait(task_event_t* event, unsigned* seen, size_t timeout);
+
+/**
+ * Give a task a name for monitoring and traces to show.
+ *
+ * \param handle  The task to name
+ * \param name    The name, which must stay valid while the program runs
+ */
+void task_set_name(task_t handle, const char* name);
+
+/**
+ * Get a task's name, or NULL if it has none.
+ */
+const char* task_name(task_t handle);
+
+/**
+ * Get the number of tasks created so far, including the main task. Handles
+ * run from 0 up to one less than this.
+ */
+int scheduler_num_tasks();
+
+/**
+ * Get the number of times the scheduler has switched from one task to
+ * another.
+ */
+uint64_t scheduler_switches();
+
+/**
+ * Get the state a task is in, from 0 up to one less than TASK_STATES.
+ */
+int task_state(task_t handle);
+
+/**
+ * Get the name of a task state, such as "SLEEPING".
+ */
+const char* task_state_name(int state);
+
+/**
+ * Get the most stack a task has used so far, in bytes. Tasks that come close
+ * to task_stack_size are about to overflow.
+ *
+ * \returns   The bytes used, or 0 for the main task, which runs on the
+ *            program's own stack.
+ */
+size_t task_stack_used(task_t handle);
+
+/**
+ * Get the size of each task's stack, in bytes.
+ */
+size_t task_stack_size();
+
 #endif
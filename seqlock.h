@@ -0,0 +1,80 @@
+#if !defined(SEQLOCK_H)
+#define SEQLOCK_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * A sequence lock protecting a block of memory that has one writer thread.
+ * The writer never waits. Readers copy the data out and retry if a write
+ * happened while they were copying, so they always end up with a complete
+ * version of the data.
+ */
+typedef struct seqlock {
+  // Odd while a write is in progress, incremented twice per write
+  atomic_uint seq;
+} seqlock_t;
+
+/**
+ * Copy new contents into the protected memory. Only one thread may write.
+ *
+ * \param lock    The lock protecting dest
+ * \param dest    The protected memory
+ * \param src     The new contents
+ * \param bytes   The size of the protected memory
+ */
+static inline void seqlock_write(seqlock_t* lock, void* dest, const void* src, size_t bytes) {
+  unsigned seq = atomic_load_explicit(&lock->seq, memory_order_relaxed);
+
+  // Mark the data as being written before touching it
+  atomic_store_explicit(&lock->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  memcpy(dest, src, bytes);
+
+  // Publish the finished write
+  atomic_store_explicit(&lock->seq, seq + 2, memory_order_release);
+}
+
+/**
+ * Get the sequence number of the most recently completed write without
+ * copying anything. Readers can compare this with the value returned by their
+ * last seqlock_read to skip copying data that has not changed.
+ *
+ * \param lock    The lock to check
+ *
+ * \returns       The current sequence number
+ */
+static inline unsigned seqlock_peek(seqlock_t* lock) {
+  return atomic_load_explicit(&lock->seq, memory_order_acquire) & ~1u;
+}
+
+/**
+ * Copy a consistent version of the protected memory out.
+ *
+ * \param lock    The lock protecting src
+ * \param dest    Where the copy should be written
+ * \param src     The protected memory
+ * \param bytes   The size of the protected memory
+ *
+ * \returns       The sequence number of the version that was copied
+ */
+static inline unsigned seqlock_read(seqlock_t* lock, void* dest, const void* src, size_t bytes) {
+  while(true) {
+    unsigned before = atomic_load_explicit(&lock->seq, memory_order_acquire);
+
+    // A write is in progress, so try again
+    if(before & 1) continue;
+
+    memcpy(dest, src, bytes);
+
+    // Make sure the copy finishes before we check the sequence number again
+    atomic_thread_fence(memory_order_acquire);
+    unsigned after = atomic_load_explicit(&lock->seq, memory_order_relaxed);
+    if(before == after) return before;
+  }
+}
+
+#endif
@@ -1,7 +1,27 @@
 #include <curses.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
+#include "arena.h"
+#include "area.h"
+#include "broadcast.h"
+#include "game.h"
+#include "keyframe.h"
+#include "metrics.h"
+#include "protocol.h"
+#include "render.h"
+#include "replay.h"
+#include "results.h"
+#include "room.h"
 #include "scheduler.h"
+#include "seqlock.h"
 #include "socket.h"
+#include "spsc.h"
+#include "stats.h"
+#include "trace.h"
+#include "udp.h"
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -12,63 +32,368 @@
 #include <unistd.h>
 #include "util.h"
 
-// Defines used to track the snake direction
-#define DIR_NORTH 0
-#define DIR_EAST 1
-#define DIR_SOUTH 2
-#define DIR_WEST 3
-
 // Game parameters
-#define INIT_snake_LENGTH 4
-#define snake_HORIZONTAL_INTERVAL 200
-#define snake_VERTICAL_INTERVAL 300
 #define DRAW_BOARD_INTERVAL 33
-#define APPLE_UPDATE_INTERVAL 120
+#define MAX_FPS 60
+#define REDRAW_INTERVAL 100
 #define READ_INPUT_INTERVAL 150
-#define GENERATE_APPLE_INTERVAL 2000
-#define BOARD_WIDTH 50
-#define BOARD_HEIGHT 25
-
-// Game pair colors
+#define SERVE_CONNECTIONS_INTERVAL 5
+#define HELLO_TIMEOUT 2000
+#define REPLAY_KEYFRAME_INTERVAL 500
+#define REPLAY_JUMP_INTERVAL 10000
+#define RECONNECT_GRACE_PERIOD 10000
+#define RECONNECT_INTERVAL 100
+#define MINIMAP_INTERVAL 25
+#define STATS_INTERVAL 1000
+#define STATS_POLL_INTERVAL 100
+#define METRICS_INTERVAL 20
+#define KEYFRAME_RETRY_INTERVAL 100
+#define LEADERBOARD_SIZE 10
+#define HISTORY_SIZE 20
+
+// The fork benchmark forks the game at every tick that is a multiple of
+// FORK_INTERVAL, takes FORK_COUNT forks each way there, and steps each one
+// FORK_STEPS ticks ahead
+#define FORK_INTERVAL 100
+#define FORK_COUNT 16
+#define FORK_STEPS 10
+
+// Address space reserved for each match's arena. Only the pages the match
+// uses take up memory.
+#define MATCH_ARENA_SIZE (64 << 20)
+
+// A room sets up stacks for this many tasks before its first match, and
+// brings this many bytes of its arena into memory for buffers
+#define ROOM_TASKS 4
+#define ROOM_PREFAULT (4 << 20)
+
+// A server waiting for connections checks on the ones that haven't sent
+// their hello this often
+#define HELLO_POLL_INTERVAL 100
+
+// The results file finished matches are added to, unless SNAKE_RESULTS says
+// otherwise
+#define RESULTS_FILE "snake.results"
+
+// The character snakes are drawn with
 #define SNAKE_CHAR 'O'
-#define SNAKE1_PAIR 1
-#define SNAKE2_PAIR 2
-#define TEXT_PAIR 3
-#define APPLE_PAIR 4
-#define BORDER_PAIR 6
-#define EMPTY_PAIR 7
-
-/**
- * In-memory representation of the game board
- * Zero represents an empty cell
- * Positive numbers represent snake cells (which count up at each time step until they reach snake_length)
- * Negative numbers represent apple cells (which count up at each time step)
- */
-int board[BOARD_HEIGHT][BOARD_WIDTH];
-
-// snake parameters
-int snake1_dir = DIR_NORTH;
-int snake2_dir = DIR_NORTH;
-int snake1_length = INIT_snake_LENGTH;
-int snake2_length = INIT_snake_LENGTH;
-int snake1_row;
-int snake1_col;
-int snake2_row;
-int snake2_col;
+
+// The narrowest view the title fits above along with the scores
+#define TITLE_MIN_WIDTH 44
+
+/**
+ * The match being played. A client only uses the board, which holds what the
+ * server has sent it.
+ */
+game_state_t game;
+
+// Memory the match owns beyond the board and player tables, which are fixed
+// in size: task stacks, messages, and the spectator table. It is all released
+// together when the match ends.
+arena_t match_arena;
+
+// The directions the snakes turn to on the next tick
+game_inputs_t inputs = {
+  .snake1_dir = DIR_NORTH,
+  .snake2_dir = DIR_NORTH
+};
+
+// The part of the board that holds cells. A client only knows the area the
+// server sends it, but everywhere else this is the whole board.
+area_t board_area = {
+  .height = BOARD_HEIGHT,
+  .width = BOARD_WIDTH
+};
+
+// The most recent area of the board received from the server. Only
+// receive_board_thrd writes it, and draw_board copies it into board through
+// board_lock.
+area_view_t received_view;
+seqlock_t board_lock;
+
+// Sequence number of the received area that was last copied into board
+unsigned board_seq = 0;
+
+// A coarse overview of the whole board, which clients of a board bigger than
+// their area are sent. Everywhere else it is worked out from the board.
+minimap_t minimap;
+minimap_t received_minimap;
+seqlock_t minimap_lock;
+unsigned minimap_seq = 0;
+
+/**
+ * The updates sent to the clients that follow one of the snakes.
+ */
+typedef struct board_stream {
+  // What the clients following the snake have been sent. A keyframe of this
+  // brings a new or returning connection up to date.
+  area_stream_t sent;
+} board_stream_t;
+
+// When a client's area covers the whole board, everyone is sent the same
+// updates. Otherwise each snake's player gets an area around their snake,
+// and spectators follow snake 1.
+#define NUM_STREAMS ((AREA_WIDTH == BOARD_WIDTH && AREA_HEIGHT == BOARD_HEIGHT) ? 1 : 2)
+board_stream_t streams[NUM_STREAMS];
+
+// The last minimap sent, and the tick it was checked on
+minimap_t sent_minimap;
+uint32_t minimap_tick = 0;
+
+// The final scores
 int snake1_score = 0;
 int snake2_score = 0;
 
-// Client and server socket file descriptors
-int client_socket_fd;
+// Server and client socket file descriptors. The client's socket is replaced
+// when it reconnects, so it is shared with the network thread.
 int server_socket_fd;
-int socket_fd;
+atomic_int socket_fd;
+
+// The server's UDP socket, on the same port number as server_socket_fd, and
+// a player's UDP socket when SNAKE_TRANSPORT=udp. Either is -1 if unused.
+int udp_socket_fd = -1;
+int udp_fd = -1;
+
+// Held while a player sends a message to the server, and guarding udp_inputs
+pthread_mutex_t server_write_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// The commands a player using UDP has sent that the server hasn't applied
+// yet. Its token is zero until the server has welcomed us, and until then
+// commands go over TCP.
+udp_inputs_t udp_inputs;
+
+// Sequence number of the last datagram the server sent us that was used
+uint32_t udp_seq_received = 0;
+
 int end = 0;
 
-// Apple parameters
-int apple_age = 120;
+/**
+ * The server's connection to a player on another machine.
+ */
+typedef struct player_conn {
+  // The player's socket, or -1 if this player is not remote
+  int fd;
+
+  // The secret the player presents to take their place back after reconnecting
+  _Atomic uint64_t token;
+
+  // Set once token and inputs are ready, which is when the UDP receive thread
+  // may start routing the player's datagrams to them
+  atomic_bool joined;
+
+  // The name the player's results are kept under
+  char name[PLAYER_NAME_MAX];
+
+  // Set while the connection is down, along with the time it went down
+  atomic_bool lost;
+  _Atomic size_t lost_at;
+
+  // The thread reading the player's directions
+  pthread_t receive_thread;
+
+  // Directions read from the player's socket, waiting for update_game
+  spsc_queue_t inputs;
+
+  // The player's clock when it sent its latest ping and turn, and ours when
+  // they arrived. The send time is zero once update_game has answered.
+  _Atomic uint64_t ping_sent_us;
+  _Atomic uint64_t ping_received_us;
+  _Atomic uint64_t turn_sent_us;
+  _Atomic uint64_t turn_received_us;
+
+  // Bytes read from the player's socket, written by the receive thread
+  stats_counter_t bytes_in;
+
+  // Set when the player's board no longer matches ours, until update_game
+  // sends the player a keyframe
+  atomic_bool keyframe_wanted;
+
+  // Held while a receive thread queues a direction, since a player using UDP
+  // sends on both its connection and its datagrams. It is set up once, when
+  // the server starts.
+  pthread_mutex_t inputs_lock;
+
+  // Where the player's datagrams come from, once they have sent one. Only the
+  // UDP receive thread writes it, and others read it through udp_lock.
+  struct sockaddr_in udp_addr;
+  seqlock_t udp_lock;
+
+  // The game task's copy of udp_addr, and the version of it that was copied
+  struct sockaddr_in udp_dest;
+  unsigned udp_dest_seq;
+
+  // Sequence number of the last datagram sent to the player, and of the last
+  // of their commands applied, which every datagram acknowledges
+  uint32_t udp_seq;
+  _Atomic uint32_t commands_applied;
+} player_conn_t;
+
+// Connections to remote players. Player 1 plays on the server unless it is a
+// dedicated server, so usually only player 2 is remote.
+player_conn_t players[2];
+
+// Is this a dedicated server with no display of its own?
+bool headless = false;
+
+// Which of a dedicated server's rooms this process plays matches in, or -1
+// if it plays a single match. The lobby hands a room its connections over
+// room_channel and its players' datagrams over room_datagrams.
+int room_index = -1;
+int room_channel = -1;
+int room_datagrams = -1;
+
+// Does this room answer monitoring scrapes, between matches as well as during
+// them? Its match only counts as active while it is being played.
+bool room_metrics = false;
+bool room_playing = false;
+
+// A dedicated server's lobby plays no matches itself, and passes every
+// connection on to one of these rooms
+bool lobby = false;
+room_pool_t room_pool;
+
+// Where the client connected, so it can reconnect
+char* server_name;
+unsigned short server_port;
+
+// Is this client only watching the match?
+bool spectating = false;
+
+// The secret this client presents to take its place back after reconnecting,
+// and which player it controls
+uint64_t session_token = 0;
+int my_player = 0;
+
+// Set while the client's connection to the server is down, along with the
+// time it went down
+atomic_bool connection_lost = false;
+
+// Signalled whenever something draw_board shows has changed
+task_event_t board_changed;
+
+/**
+ * Statistics kept by the game task on the server. Only that task writes
+ * them, so keeping them costs a few plain stores per tick.
+ */
+typedef struct game_stats {
+  stats_hist_t tick_us;             // Time to run each tick and send its updates
+  stats_counter_t updates;          // Board updates encoded, once per stream
+  stats_counter_t bytes;            // Bytes in those updates
+  stats_counter_t keyframe_bytes;   // Size of the latest keyframe
+  stats_counter_t overruns;         // Ticks that took longer than GAME_TICK_INTERVAL
+  stats_counter_t bytes_out;        // Bytes written to remote players
+  stats_counter_t allocs;           // Allocations made while running ticks, in DEBUG_ALLOC builds
+} game_stats_t;
+
+/**
+ * Statistics kept by the network thread on a client. Only that thread
+ * writes them.
+ */
+typedef struct net_stats {
+  stats_counter_t updates;          // Board updates received
+  stats_counter_t bytes;            // Bytes received
+  stats_counter_t keyframe_bytes;   // Size of the latest keyframe
+  stats_counter_t desyncs;          // Updates that left our board different from the server's
+  stats_hist_t rtt_us;              // Round trip times of pings
+  stats_hist_t turn_us;             // Time from sending a turn to the server applying it
+
+  // The latest figures the server sent
+  stats_counter_t server_tick_p50_us;
+  stats_counter_t server_tick_p99_us;
+  stats_counter_t server_tick_max_us;
+  stats_counter_t server_spectators;
+} net_stats_t;
+
+game_stats_t game_stats;
+net_stats_t net_stats;
+
+// Frames drawn, and the allocations made while drawing all but the first of
+// them in DEBUG_ALLOC builds. Only draw_board writes them.
+stats_counter_t frames_drawn;
+stats_counter_t frame_allocs;
+
+// Bytes of datagrams from players, written by the UDP receive thread
+stats_counter_t udp_bytes_in;
+
+// Is the statistics line shown under the board?
+bool show_stats = false;
+
+// The latest statistics line, and whether it has changed since it was drawn
+char stats_line[256];
+bool stats_line_changed = false;
+
+// How the game is drawn on the terminal
+const renderer_t* renderer = &curses_renderer;
+
+// The part of the board on screen, which follows the snake being watched
+// when the board does not fit on the terminal
+int view_row = 0;
+int view_col = 0;
+int view_height = BOARD_HEIGHT;
+int view_width = BOARD_WIDTH;
+
+// Is the minimap drawn beside the board?
+bool show_minimap = false;
+
+// What each cell on screen, each minimap cell, and the scores looked like
+// when they were last drawn
+int drawn[BOARD_HEIGHT][BOARD_WIDTH];
+int drawn_minimap[MINIMAP_HEIGHT][MINIMAP_WIDTH];
+int drawn_score1;
+int drawn_score2;
+bool drawn_waiting;
+_Atomic size_t connection_lost_at = 0;
+
+// Connections that have been accepted but have not sent their hello yet
+#define MAX_PENDING 64
+int pending_fds[MAX_PENDING];
+size_t pending_since[MAX_PENDING];
+int num_pending = 0;
+
+// New players the lobby is holding on to until a room is free
+int waiting_fds[MAX_PENDING];
+hello_t waiting_hellos[MAX_PENDING];
+int num_waiting = 0;
+
+// Is the game running? This is shared with the network threads.
+atomic_bool running = true;
 
-// Is the game running?
-bool running = true;
+/**
+ * The parts of the game state that a replay keyframe holds, which is
+ * everything game_step depends on. This is the layout of keyframes in replay
+ * files, so it stays the same when game_state_t changes.
+ */
+typedef struct game_keyframe {
+  uint64_t rng_state;
+  int board[BOARD_HEIGHT][BOARD_WIDTH];
+  int snake1_dir;
+  int snake2_dir;
+  int snake1_length;
+  int snake2_length;
+  int snake1_timer;
+  int snake2_timer;
+  int apple_timer;
+  int generate_apple_timer;
+  int apple_age;
+  uint32_t game_tick;
+} game_keyframe_t;
+
+// The server records every match it plays to this replay file
+replay_writer_t recorder;
+
+// Finished matches are added to this results file, if keeping_results is set
+results_t results;
+bool keeping_results = false;
+
+// The recording being played back, and the offset of its next record
+replay_t replay;
+size_t replay_pos;
+
+// Is replay playback fast-forwarding?
+bool replay_fast_forward = false;
+
+// Number of keyframes that did not match the re-simulated game
+size_t replay_mismatches = 0;
 
 
 /*
@@ -84,517 +409,2882 @@ int read_better(int fd, void* buffer, size_t bytes) {
 }
 
 /*
- * Server continuously reads the direction of the snake2
- * which changes with player 2's input.
+ * Helper function for writing to sockets. Keeps writing until every byte has
+ * been sent, since a message that is only partly sent would corrupt the stream.
+ */
+int write_better(int fd, const void* buffer, size_t bytes) {
+  int rc = write(fd, buffer, bytes);
+  if(rc <= 0) return -1;
+  else if(bytes - rc == 0) return 1;
+  else return write_better(fd, buffer+rc, bytes - rc);
+}
+
+/**
+ * Mark a remote player as disconnected. The match pauses until they reconnect
+ * or the grace period runs out. Both the game and the receive thread can
+ * notice a dropped connection, so this is safe to call from either.
+ *
+ * \param player  The player whose connection dropped
+ */
+void drop_player(player_conn_t* player) {
+  if(!player->lost) {
+    player->lost_at = time_ms();
+  }
+  if(!atomic_exchange(&player->lost, true)) {
+    // Wake the receive thread if it is still blocked reading
+    shutdown(player->fd, SHUT_RDWR);
+    task_event_signal(&board_changed);
+  }
+}
+
+/**
+ * Check whether the match is paused waiting for a player to reconnect.
+ */
+bool players_lost() {
+  return players[0].lost || players[1].lost;
+}
+
+/**
+ * Act on a message from a remote player, which arrived over either TCP or
+ * UDP. update_game does what it asks on its next tick.
+ */
+void handle_client_msg(player_conn_t* player, const client_msg_t* msg) {
+  // update_game sends the keyframe on its next tick
+  if(msg->type == CMSG_KEYFRAME) {
+    player->keyframe_wanted = true;
+    return;
+  }
+
+  // update_game answers pings and turns on its next tick
+  if(msg->type == CMSG_PING) {
+    player->ping_received_us = time_us();
+    player->ping_sent_us = msg->time_us;
+    return;
+  }
+
+  // Ignore anything that isn't a direction
+  if(msg->type != CMSG_TURN || msg->dir > DIR_WEST) return;
+
+  player->turn_received_us = time_us();
+  player->turn_sent_us = msg->time_us;
+
+  // update_game drains the queue on every tick, so it can only fill up if
+  // the client floods us. Extra turns are dropped in that case.
+  pthread_mutex_lock(&player->inputs_lock);
+  spsc_push(&player->inputs, msg->dir);
+  pthread_mutex_unlock(&player->inputs_lock);
+}
+
+/*
+ * Server continuously reads the direction of a remote player's snake,
+ * which changes with that player's input, along with their pings.
  */
 void* receive_dir_thrd(void* p) {
+  player_conn_t* player = p;
+  trace_thread(player == &players[0] ? "player 1 receiver" : "player 2 receiver");
+  while(running) {
+    client_msg_t msg;
+    if(read_better(player->fd, &msg, sizeof(msg)) == -1) {
+      // Hold the player's place so they can reconnect
+      drop_player(player);
+      break;
+    }
+    stats_add(&player->bytes_in, sizeof(msg));
+    handle_client_msg(player, &msg);
+  }
+  return NULL;
+}
+
+/*
+ * Server continuously reads the datagrams of players using UDP. Each one
+ * repeats the commands the server hasn't acknowledged, so every command is
+ * applied the first time it arrives and ignored after that. Updates go back
+ * to wherever a player's datagrams come from.
+ */
+void* receive_udp_thrd(void* p) {
+  trace_thread("UDP receiver");
+
+  // A room's thread keeps going from one match to the next
+  while(running || room_index != -1) {
+    udp_input_t packet;
+    struct sockaddr_in addr;
+    ssize_t rc;
+    if(room_index != -1) {
+      // The lobby has the socket, and passes on the datagrams for this room
+      rc = room_receive_datagram(room_datagrams, &packet, sizeof(packet), &addr);
+    } else {
+      socklen_t addr_len = sizeof(addr);
+      rc = recvfrom(udp_socket_fd, &packet, sizeof(packet), 0, (struct sockaddr*)&addr, &addr_len);
+    }
+    if(rc == -1) {
+      if(errno == EINTR) continue;
+      break;
+    }
+    if(!udp_input_valid(&packet, rc)) continue;
+
+    // The token says which player sent it, once that player has joined.
+    // Nothing is taken from a player who is reconnecting, so the match stays
+    // paused.
+    player_conn_t* player = NULL;
+    for(int i=0; i<2; i++) {
+      if(atomic_load_explicit(&players[i].joined, memory_order_acquire) &&
+         players[i].token == packet.token) {
+        player = &players[i];
+      }
+    }
+    if(player == NULL || player->lost) continue;
+    stats_add(&udp_bytes_in, rc);
+
+    if(memcmp(&addr, &player->udp_addr, sizeof(addr)) != 0) {
+      seqlock_write(&player->udp_lock, &player->udp_addr, &addr, sizeof(addr));
+    }
+
+    for(uint32_t i=0; i<packet.count; i++) {
+      uint32_t seq = packet.first_seq + i;
+      if(seq <= player->commands_applied) continue;
+      handle_client_msg(player, &packet.commands[i]);
+      player->commands_applied = seq;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Try to get back into the match after the connection to the server drops.
+ * Players present their session token so the server gives them their snake
+ * back, and spectators simply join again. Either way the server starts the
+ * new connection off with a keyframe.
+ *
+ * \returns   false if the server could not be reached within the grace period.
+ */
+bool reconnect() {
+  // Players can't take their place back without a token
+  if(!spectating && session_token == 0) return false;
+
+  if(!connection_lost) {
+    connection_lost_at = time_ms();
+    connection_lost = true;
+    task_event_signal(&board_changed);
+  }
+
+  while(running && time_ms() - connection_lost_at < RECONNECT_GRACE_PERIOD) {
+    int fd = socket_connect(server_name, server_port);
+    if(fd != -1) {
+      hello_t hello = {
+        .magic = PROTOCOL_MAGIC,
+        .role = spectating ? ROLE_SPECTATOR : ROLE_RESUME,
+        .token = session_token
+      };
+      if(write_better(fd, &hello, sizeof(hello)) == 1) {
+        int old_fd = atomic_exchange(&socket_fd, fd);
+        close(old_fd);
+        return true;
+      }
+      close(fd);
+    }
+    sleep_ms(RECONNECT_INTERVAL);
+  }
+  return false;
+}
+
+/**
+ * Send a message to the server. The game tasks and the network thread both
+ * send messages, so this keeps them from interleaving.
+ *
+ * \returns   false if the write failed, in which case the network thread is
+ *            already reconnecting.
+ */
+bool send_to_server(const client_msg_t* msg) {
+  pthread_mutex_lock(&server_write_lock);
+  bool sent = true;
+  if(udp_inputs.packet.token != 0) {
+    // The command is repeated until the server acknowledges it, so a lost
+    // packet only matters if the next few are lost as well
+    udp_inputs_add(&udp_inputs, msg);
+    udp_inputs_send(&udp_inputs, udp_fd);
+  } else {
+    sent = write_better(socket_fd, msg, sizeof(client_msg_t)) != -1;
+  }
+  pthread_mutex_unlock(&server_write_lock);
+  return sent;
+}
+
+/**
+ * Resend the commands the server hasn't acknowledged, once they have waited
+ * UDP_RESEND_INTERVAL. Until the server has sent us a datagram, an empty
+ * packet is sent instead, so the server learns where to send them.
+ */
+void resend_inputs() {
+  pthread_mutex_lock(&server_write_lock);
+  if(udp_inputs.packet.token != 0 &&
+     (udp_inputs.packet.count > 0 || udp_seq_received == 0) &&
+     time_us() - udp_inputs.sent_us >= UDP_RESEND_INTERVAL * 1000) {
+    udp_inputs_send(&udp_inputs, udp_fd);
+  }
+  pthread_mutex_unlock(&server_write_lock);
+}
+
+/**
+ * Wait for a message from the server, which arrives over TCP, or as a
+ * datagram when this player uses UDP. Datagrams older than one already used
+ * are thrown away: their updates are out of date, and if that leaves our
+ * board wrong, its hash shows it.
+ *
+ * \param header   The message's header is written here
+ * \param payload  Space for AREA_PAYLOAD_MAX bytes. The payload is written
+ *                 here, or this is pointed at a datagram holding it.
+ *
+ * \returns        1 if a message arrived, 0 if there is nothing yet, or -1 if
+ *                 the connection dropped.
+ */
+int receive_from_server(msg_header_t* header, uint8_t** payload) {
+  static uint8_t datagram[UDP_DATAGRAM_MAX];
+
+  if(udp_fd != -1) {
+    struct pollfd fds[2] = {
+      { .fd = socket_fd, .events = POLLIN },
+      { .fd = udp_fd, .events = POLLIN }
+    };
+    int rc = poll(fds, 2, UDP_RESEND_INTERVAL);
+    resend_inputs();
+    if(rc == -1) return errno == EINTR ? 0 : -1;
+
+    if(fds[1].revents & POLLIN) {
+      ssize_t length = recv(udp_fd, datagram, sizeof(datagram), MSG_DONTWAIT);
+      udp_header_t* udp = (udp_header_t*)datagram;
+      msg_header_t* message = (msg_header_t*)(datagram + sizeof(udp_header_t));
+      if(length < (ssize_t)(sizeof(udp_header_t) + sizeof(msg_header_t)) ||
+         length != sizeof(udp_header_t) + sizeof(msg_header_t) + message->length) {
+        return 0;
+      }
+
+      pthread_mutex_lock(&server_write_lock);
+      udp_inputs_ack(&udp_inputs, udp->ack);
+      pthread_mutex_unlock(&server_write_lock);
+
+      if(udp->seq <= udp_seq_received) return 0;
+      udp_seq_received = udp->seq;
+
+      *header = *message;
+      *payload = (uint8_t*)(message + 1);
+      return 1;
+    }
+
+    if(fds[0].revents == 0) return 0;
+  }
+
+  if(read_better(socket_fd, header, sizeof(msg_header_t)) <= 0 ||
+     header->length > AREA_PAYLOAD_MAX ||
+     (header->length > 0 && read_better(socket_fd, *payload, header->length) <= 0)) {
+    return -1;
+  }
+  return 1;
+}
+
+/*
+ * Thread to continuously read the board from the server. Full boards replace
+ * the cells of our area and deltas are applied to them. If the connection
+ * drops, the thread tries to reconnect. Once the game is over or the server
+ * can't be reached, we set running = false and ungetch to end other tasks.
+ */
+void* receive_board_thrd(void* p) {
+  // Build each board in a private buffer so a partial update is never visible
+  static int incoming[BOARD_HEIGHT][BOARD_WIDTH];
+  static area_t incoming_area;
+  static area_view_t view;
+
+  // A delta is only sent when it is smaller than a full area
+  static uint8_t buffer[AREA_PAYLOAD_MAX];
+
+  // When a keyframe was last asked for, or zero if one isn't on its way. A
+  // request or keyframe sent over UDP may be lost, so it is asked for again
+  // if it doesn't turn up.
+  uint64_t keyframe_requested_us = 0;
+
+  trace_thread("board receiver");
+
   while(running) {
-    if(read_better(client_socket_fd, &snake2_dir, sizeof(int)) == -1) {
-      perror("Failed to read snake2_dir\n");
+    msg_header_t header;
+    uint8_t* payload = buffer;
+    int rc = receive_from_server(&header, &payload);
+    if(rc == 0) continue;
+    if(rc == -1) {
+      if(!reconnect()) {
+        running = false;
+        ungetch(0);
+      }
+      continue;
+    }
+
+    // A complete message arrived, so the connection is healthy again
+    if(atomic_exchange(&connection_lost, false)) {
+      task_event_signal(&board_changed);
+    }
+    stats_add(&net_stats.bytes, sizeof(header) + header.length);
+
+    if(header.type == MSG_WELCOME && header.length == sizeof(welcome_t)) {
+      session_token = ((welcome_t*)payload)->token;
+      my_player = ((welcome_t*)payload)->player;
+
+      // Commands go out as datagrams from now on
+      if(udp_fd != -1) {
+        pthread_mutex_lock(&server_write_lock);
+        udp_inputs_init(&udp_inputs, session_token);
+        pthread_mutex_unlock(&server_write_lock);
+        resend_inputs();
+      }
+
+    } else if((header.type == MSG_BOARD || header.type == MSG_DELTA) &&
+              area_apply(incoming, &incoming_area, header.type, payload, header.length)) {
+      // Ask for a keyframe if our board no longer matches the server's.
+      // Spectators can't ask, but catch up whenever they fall behind.
+      if(header.type == MSG_BOARD) {
+        keyframe_requested_us = 0;
+      }
+      if(!area_in_sync(&incoming_area, payload)) {
+        stats_add(&net_stats.desyncs, 1);
+        bool retry = udp_fd != -1 && time_us() - keyframe_requested_us >= KEYFRAME_RETRY_INTERVAL * 1000;
+        if(!spectating && (keyframe_requested_us == 0 || retry)) {
+          client_msg_t request = {
+            .type = CMSG_KEYFRAME,
+            .time_us = time_us()
+          };
+          keyframe_requested_us = send_to_server(&request) ? request.time_us : 0;
+        }
+      }
+
+      // Only the area is handed over, so large boards cost no more to draw
+      uint64_t apply_start = trace_now();
+      area_view_copy(&view, incoming, &incoming_area);
+      seqlock_write(&board_lock, &received_view, &view, sizeof(view));
+      task_event_signal(&board_changed);
+      trace_span("apply update", apply_start, "bytes", header.length);
+
+      stats_add(&net_stats.updates, 1);
+      if(header.type == MSG_BOARD) {
+        stats_set(&net_stats.keyframe_bytes, sizeof(header) + header.length);
+      }
+
+    } else if(header.type == MSG_MINIMAP && header.length == sizeof(minimap_t)) {
+      seqlock_write(&minimap_lock, &received_minimap, payload, sizeof(minimap_t));
+      task_event_signal(&board_changed);
+
+    } else if(header.type == MSG_PONG && header.length == sizeof(pong_t)) {
+      // The time the server held a ping until its next tick is not part of
+      // the round trip, but a turn's wait for the tick is part of its delay
+      pong_t* pong = (pong_t*)payload;
+      uint64_t elapsed = time_us() - pong->time_us;
+      if(pong->type == CMSG_PING) {
+        stats_record(&net_stats.rtt_us, elapsed > pong->held_us ? elapsed - pong->held_us : 0);
+      } else {
+        stats_record(&net_stats.turn_us, elapsed);
+      }
+
+    } else if(header.type == MSG_STATS && header.length == sizeof(server_stats_t)) {
+      server_stats_t* server = (server_stats_t*)payload;
+      stats_set(&net_stats.server_tick_p50_us, server->tick_p50_us);
+      stats_set(&net_stats.server_tick_p99_us, server->tick_p99_us);
+      stats_set(&net_stats.server_tick_max_us, server->tick_max_us);
+      stats_set(&net_stats.server_spectators, server->spectators);
+
+    } else if(header.type == MSG_GAME_OVER) {
+      running = false;
+      ungetch(0);
+      task_event_signal(&board_changed);
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Copy the latest area of the board and minimap from the network thread, if
+ * new ones have arrived since the last call. Cells that left the area are
+ * cleared. Nothing is ever published on the server, so this does nothing
+ * there.
+ */
+void board_snapshot() {
+  static area_view_t view;
+
+  if(seqlock_peek(&board_lock) != board_seq) {
+    board_seq = seqlock_read(&board_lock, &view, &received_view, sizeof(view));
+    area_view_apply(game.board, &board_area, &view);
+  }
+
+  if(seqlock_peek(&minimap_lock) != minimap_seq) {
+    minimap_seq = seqlock_read(&minimap_lock, &minimap, &received_minimap, sizeof(minimap));
+  }
+}
+
+/**
+ * Encode a message into a tick buffer with a single reference.
+ */
+tick_buf_t* encode_message(uint32_t type, bool keyframe, const void* payload, size_t length) {
+  msg_header_t header = {
+    .type = type,
+    .flags = keyframe ? MSG_FLAG_KEYFRAME : 0,
+    .tick = game.game_tick,
+    .length = length,
+    .time_us = time_us()
+  };
+
+  tick_buf_t* buf = tick_buf_create(sizeof(header) + length, keyframe);
+  if(buf == NULL) {
+    perror("Failed to allocate message");
+    exit(2);
+  }
+  memcpy(buf->data, &header, sizeof(header));
+  if(length > 0) {
+    memcpy(buf->data + sizeof(header), payload, length);
+  }
+  return buf;
+}
+
+/**
+ * Get the stream of updates a player is sent.
+ *
+ * \param index   0 for player 1 or 1 for player 2
+ */
+board_stream_t* player_stream(int index) {
+  return &streams[NUM_STREAMS == 1 ? 0 : index];
+}
+
+/**
+ * Send a message to a remote player over their connection, if they are
+ * connected, even when they use UDP. Messages that must not be lost are
+ * sent this way.
+ */
+void send_to_player_reliably(int index, tick_buf_t* buf) {
+  if(players[index].fd == -1 || players[index].lost) return;
+
+  if(write_better(players[index].fd, buf->data, buf->length) == -1) {
+    drop_player(&players[index]);
+  } else {
+    stats_add(&game_stats.bytes_out, buf->length);
+  }
+}
+
+/**
+ * Send a message to a remote player, if they are connected. Players who use
+ * UDP get it as a datagram, which is dropped rather than waited for if the
+ * socket is full, so a lost or late update never holds up the ones after it.
+ */
+void send_to_player(int index, tick_buf_t* buf) {
+  player_conn_t* player = &players[index];
+  if(player->fd == -1 || player->lost) return;
+
+  // Pick up the address the player's latest datagrams came from
+  if(seqlock_peek(&player->udp_lock) != player->udp_dest_seq) {
+    player->udp_dest_seq = seqlock_read(&player->udp_lock, &player->udp_dest, &player->udp_addr,
+                                        sizeof(player->udp_dest));
+  }
+  if(player->udp_dest.sin_family == 0) {
+    send_to_player_reliably(index, buf);
+    return;
+  }
+
+  udp_header_t header = {
+    .seq = ++player->udp_seq,
+    .ack = player->commands_applied
+  };
+  struct iovec parts[] = {
+    { .iov_base = &header, .iov_len = sizeof(header) },
+    { .iov_base = buf->data, .iov_len = buf->length }
+  };
+  struct msghdr datagram = {
+    .msg_name = &player->udp_dest,
+    .msg_namelen = sizeof(player->udp_dest),
+    .msg_iov = parts,
+    .msg_iovlen = 2
+  };
+  if(sendmsg(udp_socket_fd, &datagram, MSG_DONTWAIT) != -1) {
+    stats_add(&game_stats.bytes_out, sizeof(header) + buf->length);
+  }
+}
+
+/**
+ * Send a message to every connected remote player.
+ */
+void send_to_players(tick_buf_t* buf) {
+  for(int i=0; i<2; i++) {
+    send_to_player(i, buf);
+  }
+}
+
+/**
+ * Encode a keyframe of what the clients following a stream already know. This
+ * brings a connection that is new, returning, or has gone wrong up to date.
+ *
+ * \param stream  The stream
+ *
+ * \returns       A message to release once it is sent, or NULL if the stream
+ *                hasn't sent anything yet, so there is nothing to catch up on.
+ */
+tick_buf_t* stream_keyframe(board_stream_t* stream) {
+  static uint8_t payload[AREA_PAYLOAD_MAX];
+  if(stream->sent.area.height == 0) return NULL;
+
+  size_t length = area_encode_known(&stream->sent, payload);
+  return encode_message(MSG_BOARD, true, payload, length);
+}
+
+/**
+ * Encode the changes to the area around a snake once and send that same
+ * message to everyone following the snake. Updates are deltas holding just
+ * the cells that changed since the last update, or the whole area when that
+ * is smaller, as it always is for the first. Each one carries the hash of
+ * the board its clients should end up with, and clients that find theirs
+ * doesn't match ask for a keyframe, so there is no need to send keyframes
+ * every so often.
+ *
+ * \param index   0 for the stream following snake 1, or 1 for snake 2
+ */
+void broadcast_stream(int index) {
+  static uint8_t delta[AREA_PAYLOAD_MAX];
+  static uint8_t whole[AREA_PAYLOAD_MAX];
+  board_stream_t* stream = &streams[index];
+  uint64_t encode_start = trace_now();
+
+  area_t area = (index == 0) ? area_around(game.snake1_row, game.snake1_col) : area_around(game.snake2_row, game.snake2_col);
+  area.snake1_length = game.snake1_length;
+  area.snake2_length = game.snake2_length;
+
+  size_t length = 0;
+  bool keyframe = stream->sent.area.height == 0;
+  if(keyframe) {
+    length = area_encode_keyframe(&stream->sent, game.board, area, whole);
+  } else {
+    length = area_encode_delta(&stream->sent, game.board, area, delta);
+
+    // Nothing to send
+    if(length == 0) {
+      trace_span("encode", encode_start, "bytes", 0);
+      return;
+    }
+
+    // Every segment of a snake changes when it moves, so the whole area is
+    // often smaller than the changes. The delta has brought the stream up to
+    // date, so the area is encoded from what its clients will know.
+    size_t whole_length = area_encode_known(&stream->sent, whole);
+    if(whole_length < length) {
+      length = whole_length;
+      keyframe = true;
+    }
+  }
+
+  tick_buf_t* buf = keyframe ? encode_message(MSG_BOARD, true, whole, length)
+                             : encode_message(MSG_DELTA, false, delta, length);
+
+  stats_add(&game_stats.updates, 1);
+  stats_add(&game_stats.bytes, buf->length);
+  if(keyframe) {
+    stats_set(&game_stats.keyframe_bytes, buf->length);
+  }
+  trace_span("encode", encode_start, "bytes", buf->length);
+
+  uint64_t send_start = trace_now();
+  for(int i=0; i<2; i++) {
+    if(player_stream(i) == stream) send_to_player(i, buf);
+  }
+  if(index == 0) spectator_publish(buf);
+  trace_span("send", send_start, "bytes", buf->length);
+  tick_buf_release(buf);
+}
+
+/**
+ * Send a keyframe to each remote player whose board has gone wrong, and to
+ * spectators that fell too far behind and skipped updates. Everyone else
+ * keeps getting deltas.
+ */
+void broadcast_keyframes() {
+  for(int index=0; index<NUM_STREAMS; index++) {
+    board_stream_t* stream = &streams[index];
+
+    bool wanted = index == 0 && spectators_lagging();
+    for(int i=0; i<2; i++) {
+      if(player_stream(i) == stream && players[i].keyframe_wanted) wanted = true;
+    }
+
+    tick_buf_t* buf;
+    if(!wanted || (buf = stream_keyframe(stream)) == NULL) continue;
+
+    for(int i=0; i<2; i++) {
+      if(player_stream(i) == stream && atomic_exchange(&players[i].keyframe_wanted, false)) {
+        send_to_player(i, buf);
+      }
+    }
+    if(index == 0) spectator_publish_keyframe(buf);
+
+    stats_set(&game_stats.keyframe_bytes, buf->length);
+    tick_buf_release(buf);
+  }
+}
+
+/**
+ * Send everyone a new minimap if the board has changed enough to alter it.
+ * This is only needed when the board is bigger than what clients are sent.
+ */
+void broadcast_minimap() {
+  if(NUM_STREAMS == 1 || game.game_tick - minimap_tick < MINIMAP_INTERVAL) return;
+  minimap_tick = game.game_tick;
+
+  static minimap_t next;
+  minimap_build(&next, game.board);
+  if(memcmp(&next, &sent_minimap, sizeof(next)) == 0) return;
+  memcpy(&sent_minimap, &next, sizeof(next));
+
+  tick_buf_t* buf = encode_message(MSG_MINIMAP, false, &next, sizeof(next));
+  send_to_players(buf);
+  spectator_publish(buf);
+  tick_buf_release(buf);
+}
+
+/**
+ * Send the changes to the board to the remote players and every spectator.
+ */
+void broadcast_board() {
+  for(int i=0; i<NUM_STREAMS; i++) {
+    broadcast_stream(i);
+  }
+  broadcast_minimap();
+}
+
+/**
+ * Tell the remote players and every spectator that the match is over.
+ */
+void broadcast_game_over() {
+  tick_buf_t* buf = encode_message(MSG_GAME_OVER, true, NULL, 0);
+  for(int i=0; i<2; i++) {
+    send_to_player_reliably(i, buf);
+  }
+  spectator_publish(buf);
+  tick_buf_release(buf);
+}
+
+/**
+ * Answer a remote player's latest ping and turn, if they haven't been
+ * answered yet. The player works out the round trip time from the answer.
+ *
+ * \param index   0 for player 1 or 1 for player 2
+ */
+void answer_player(int index) {
+  player_conn_t* player = &players[index];
+  uint32_t types[] = {CMSG_PING, CMSG_TURN};
+  _Atomic uint64_t* sent[] = {&player->ping_sent_us, &player->turn_sent_us};
+  _Atomic uint64_t* received[] = {&player->ping_received_us, &player->turn_received_us};
+
+  for(int i=0; i<2; i++) {
+    uint64_t sent_us = atomic_exchange(sent[i], 0);
+    if(sent_us == 0) continue;
+
+    pong_t pong = {
+      .type = types[i],
+      .time_us = sent_us,
+      .held_us = time_us() - *received[i]
+    };
+    tick_buf_t* buf = encode_message(MSG_PONG, false, &pong, sizeof(pong));
+    send_to_player(index, buf);
+    tick_buf_release(buf);
+  }
+}
+
+/**
+ * Start a thread reading a remote player's directions from its socket.
+ */
+void start_receiving_dirs(player_conn_t* player) {
+  pthread_create(&player->receive_thread, NULL, receive_dir_thrd, player);
+}
+
+/**
+ * Take on a newly connected remote player. They are sent the token they need
+ * to reconnect if their connection drops, and their directions start being
+ * read.
+ *
+ * \param index   0 for player 1 or 1 for player 2
+ * \param fd      The player's socket
+ * \param name    The name the player sent in their hello
+ *
+ * \returns       false if the player could not be welcomed.
+ */
+bool join_player(int index, int fd, const char* name) {
+  player_conn_t* player = &players[index];
+  player->fd = fd;
+  if(name[0] == '\0') name = "anonymous";
+  strncpy(player->name, name, PLAYER_NAME_MAX);
+  player->lost = false;
+
+  // A room's tokens say which room gave them out, so the lobby can send the
+  // player back to it. Token 0 is never given out, since it means no player.
+  do {
+    player->token = random_token();
+    if(room_index != -1) player->token = room_token(player->token, room_index);
+  } while(player->token == 0);
+
+  // A datagram matched to the room's last player may still be queueing
+  pthread_mutex_lock(&player->inputs_lock);
+  spsc_init(&player->inputs);
+  pthread_mutex_unlock(&player->inputs_lock);
+
+  // The UDP receive thread only looks at the player from here on, and sees
+  // the token and inputs above when it does
+  atomic_store_explicit(&player->joined, true, memory_order_release);
+
+  welcome_t welcome = {
+    .token = player->token,
+    .player = index + 1
+  };
+  tick_buf_t* buf = encode_message(MSG_WELCOME, false, &welcome, sizeof(welcome));
+  bool sent = write_better(fd, buf->data, buf->length) == 1;
+  tick_buf_release(buf);
+  if(!sent) return false;
+
+  start_receiving_dirs(player);
+  return true;
+}
+
+/**
+ * Give a remote player's place in the match back to a reconnecting client,
+ * then catch it up with a keyframe.
+ *
+ * \param fd      The new connection
+ * \param token   The session token the connection presented
+ *
+ * \returns       false if the connection can't take a player's place.
+ */
+bool resume_player(int fd, uint64_t token) {
+  player_conn_t* player = NULL;
+  for(int i=0; i<2; i++) {
+    if(players[i].fd != -1 && players[i].lost && players[i].token == token) {
+      player = &players[i];
+    }
+  }
+  if(player == NULL) return false;
+
+  // The keyframe goes out with a blocking write, like every other message to
+  // a player
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+  tick_buf_t* buf = stream_keyframe(player_stream(player - players));
+  if(buf != NULL) {
+    bool sent = write_better(fd, buf->data, buf->length) != -1;
+    tick_buf_release(buf);
+    if(!sent) return false;
+  }
+
+  // The old receive thread exits once its socket has been shut down
+  pthread_join(player->receive_thread, NULL);
+  close(player->fd);
+  player->fd = fd;
+
+  player->lost = false;
+  task_event_signal(&board_changed);
+  start_receiving_dirs(player);
+  return true;
+}
+
+/**
+ * Start streaming the match to a new spectator, beginning with a keyframe of
+ * the board so far.
+ */
+void add_spectator(int fd) {
+  tick_buf_t* buf = stream_keyframe(&streams[0]);
+  spectator_add(fd, &buf, buf != NULL ? 1 : 0);
+  if(buf != NULL) tick_buf_release(buf);
+}
+
+/**
+ * Check whether a connection has sent a complete hello yet, without blocking.
+ *
+ * \param fd      The connection to check
+ * \param hello   The hello is written here once it has arrived
+ *
+ * \returns       1 if the hello was read, 0 if it has not arrived yet, or -1 if
+ *                the connection failed or sent something else.
+ */
+int try_read_hello(int fd, hello_t* hello) {
+  int rc = recv(fd, hello, sizeof(hello_t), MSG_PEEK | MSG_DONTWAIT);
+  if(rc == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+  if(rc <= 0) return -1;
+  if((size_t)rc < sizeof(hello_t)) return 0;
+
+  // Now that the whole hello is available, take it off the socket
+  if(read_better(fd, hello, sizeof(hello_t)) == -1) return -1;
+  return hello->magic == PROTOCOL_MAGIC ? 1 : -1;
+}
+
+/**
+ * Accept everything waiting on the non-blocking server socket, to wait for
+ * its hello.
+ */
+void accept_pending() {
+  while(num_pending < MAX_PENDING) {
+    int fd = accept(server_socket_fd, NULL, NULL);
+    if(fd == -1) break;
+    pending_fds[num_pending] = fd;
+    pending_since[num_pending] = time_ms();
+    num_pending++;
+  }
+}
+
+/**
+ * Check the pending connections for their hellos, and take the first one
+ * that has sent it. Connections that sent something else, or have taken too
+ * long, are closed.
+ *
+ * \param hello  The hello is written here
+ *
+ * \returns      The connection, or -1 if none has sent its hello yet.
+ */
+int pending_hello(hello_t* hello) {
+  int i = 0;
+  while(i < num_pending) {
+    int fd = pending_fds[i];
+    int rc = try_read_hello(fd, hello);
+    if(rc == 0 && time_ms() - pending_since[i] < HELLO_TIMEOUT) {
+      i++;
+      continue;
+    }
+
+    // Move the last pending connection into this slot
+    num_pending--;
+    pending_fds[i] = pending_fds[num_pending];
+    pending_since[i] = pending_since[num_pending];
+
+    if(rc == 1) return fd;
+    close(fd);
+  }
+  return -1;
+}
+
+/**
+ * Pass a connection that has sent its hello on to the room it belongs in.
+ * Players go to the room that is taking players, and so do spectators,
+ * unless no room is, in which case they watch the match that started last.
+ * Reconnecting players go back to the room their token came from. When
+ * every room is playing, new players wait for one to be free.
+ */
+void send_to_room(int fd, const hello_t* hello) {
+  int index = -1;
+  if(hello->role == ROLE_PLAYER) {
+    index = room_pool_filling(&room_pool);
+    if(index == -1 && num_waiting < MAX_PENDING) {
+      waiting_fds[num_waiting] = fd;
+      waiting_hellos[num_waiting] = *hello;
+      num_waiting++;
+      return;
+    }
+  } else if(hello->role == ROLE_SPECTATOR) {
+    index = room_pool.filling != -1 ? room_pool.filling : room_pool.latest;
+    if(index == -1) index = room_pool_filling(&room_pool);
+  } else if(hello->role == ROLE_RESUME && token_room(hello->token) < room_pool.count) {
+    index = token_room(hello->token);
+  }
+
+  // The room has its own copy of the connection once it is sent
+  if(index != -1) room_send(room_pool.rooms[index].channel, ROOM_CONNECTION, fd, hello);
+  close(fd);
+}
+
+/**
+ * Send the players waiting for a room to one that has become free, in the
+ * order they arrived. Any that still don't fit keep waiting.
+ */
+void seat_waiting_players() {
+  int count = num_waiting;
+  num_waiting = 0;
+  for(int i=0; i<count; i++) {
+    send_to_room(waiting_fds[i], &waiting_hellos[i]);
+  }
+}
+
+/**
+ * Deal with a connection that has sent its hello. Spectators are caught up
+ * and start receiving updates, and remote players can take their place back
+ * after a dropped connection. New players can't join a match that has
+ * started, so they are turned away, or sent back to the lobby to find
+ * another room. The lobby passes every connection on to a room.
+ *
+ * \param fd     The connection
+ * \param hello  The hello it sent
+ */
+void admit_connection(int fd, const hello_t* hello) {
+  if(lobby) {
+    send_to_room(fd, hello);
+  } else if(hello->role == ROLE_SPECTATOR) {
+    add_spectator(fd);
+  } else if(hello->role == ROLE_RESUME && resume_player(fd, hello->token)) {
+    // The player is back in the match
+  } else if(hello->role == ROLE_PLAYER && room_index != -1) {
+    room_send(room_channel, ROOM_CONNECTION, fd, hello);
+    close(fd);
+  } else {
+    close(fd);
+  }
+}
+
+/**
+ * Accept any waiting connections and admit the ones that have sent their
+ * hello. A room doesn't accept connections itself, but is handed them by
+ * the lobby once their hello has arrived.
+ */
+void accept_connections() {
+  if(room_index != -1) {
+    room_msg_t msg;
+    int fd;
+    int rc;
+    while((rc = room_receive(room_channel, &msg, &fd, false)) == 1) {
+      if(fd != -1) admit_connection(fd, &msg.hello);
+    }
+
+    // The lobby has shut down, and the rest of the server with it
+    if(rc == -1) running = false;
+    return;
+  }
+
+  accept_pending();
+  hello_t hello;
+  int fd;
+  while((fd = pending_hello(&hello)) != -1) {
+    admit_connection(fd, &hello);
+  }
+}
+
+/**
+ * Run in a thread to admit new connections and stream queued updates to
+ * spectators.
+ */
+void serve_connections() {
+  while(running) {
+    accept_connections();
+
+    uint64_t flush_start = trace_now();
+    spectator_flush();
+    trace_span("send to spectators", flush_start, NULL, 0);
+
+    task_sleep(SERVE_CONNECTIONS_INTERVAL);
+  }
+}
+
+/**
+ * Format a percentile of a window of microsecond times in milliseconds, or as
+ * a dash if nothing was recorded.
+ */
+void format_ms(char* text, size_t size, const stats_window_t* window, double percent) {
+  if(window->total == 0) {
+    snprintf(text, size, "-");
+  } else {
+    snprintf(text, size, "%.1f ms", stats_percentile(window, percent) / 1000.0);
+  }
+}
+
+/**
+ * Run in a thread to gather statistics every STATS_INTERVAL. The server sends
+ * its recent tick times to every client, and players ping the server. When
+ * SNAKE_STATS is set the latest figures are shown under the board, or printed
+ * to stderr on a dedicated server. When SNAKE_STATS_LOG names a file they are
+ * appended to it as well.
+ */
+void report_stats() {
+  static stats_window_t previous[4];
+  static stats_window_t window[4];
+  char line[sizeof(stats_line)];
+
+  const char* log_name = getenv("SNAKE_STATS_LOG");
+  FILE* log = NULL;
+  if(log_name != NULL && log_name[0] != '\0') {
+    log = fopen(log_name, "a");
+    if(log == NULL) perror("Failed to open statistics log");
+  }
+
+  bool client = server_name != NULL;
+  uint64_t start = time_us();
+  uint64_t last_time = start;
+  uint64_t last_updates = 0;
+  uint64_t last_bytes = 0;
+
+  while(running) {
+    // Sleep in short steps so the match doesn't wait on us when it ends
+    for(size_t slept=0; running && slept < STATS_INTERVAL; slept += STATS_POLL_INTERVAL) {
+      task_sleep(STATS_POLL_INTERVAL);
+    }
+    if(!running) break;
+
+    uint64_t now = time_us();
+    double seconds = (now - last_time) / 1000000.0;
+    last_time = now;
+
+    if(client) {
+      // Players ping the server to find the round trip time. If this fails
+      // the receive thread is already reconnecting.
+      if(!spectating) {
+        client_msg_t ping = {
+          .type = CMSG_PING,
+          .time_us = time_us()
+        };
+        send_to_server(&ping);
+      }
+
+      uint64_t updates = stats_get(&net_stats.updates);
+      uint64_t bytes = stats_get(&net_stats.bytes);
+      stats_window(&net_stats.rtt_us, &previous[0], &window[0]);
+      stats_window(&net_stats.turn_us, &previous[1], &window[1]);
+
+      char rtt[16];
+      char turn[16];
+      format_ms(rtt, sizeof(rtt), &window[0], 50);
+      format_ms(turn, sizeof(turn), &window[1], 50);
+      snprintf(line, sizeof(line),
+               "RTT %s  Turn %s  Server tick p50 %u us p99 %u us  %.0f updates/s  %.1f KB/s  Keyframe %u B  %u desyncs",
+               rtt, turn,
+               (unsigned)stats_get(&net_stats.server_tick_p50_us),
+               (unsigned)stats_get(&net_stats.server_tick_p99_us),
+               (updates - last_updates) / seconds, (bytes - last_bytes) / seconds / 1024,
+               (unsigned)stats_get(&net_stats.keyframe_bytes),
+               (unsigned)stats_get(&net_stats.desyncs));
+      last_updates = updates;
+      last_bytes = bytes;
+
+    } else {
+      // Every client following a snake gets the same updates, so one
+      // stream's share of the bytes is what each client receives
+      uint64_t updates = stats_get(&game_stats.updates);
+      uint64_t bytes = stats_get(&game_stats.bytes);
+      stats_window(&game_stats.tick_us, &previous[2], &window[2]);
+      stats_window(scheduler_wake_late(), &previous[3], &window[3]);
+
+      server_stats_t summary = {
+        .tick_p50_us = stats_percentile(&window[2], 50),
+        .tick_p99_us = stats_percentile(&window[2], 99),
+        .tick_max_us = stats_percentile(&window[2], 100),
+        .spectators = spectator_count()
+      };
+      tick_buf_t* buf = encode_message(MSG_STATS, false, &summary, sizeof(summary));
+      send_to_players(buf);
+      spectator_publish(buf);
+      tick_buf_release(buf);
+
+      snprintf(line, sizeof(line),
+               "Tick p50 %u us p99 %u us max %u us  Wake late p99 %u us  %.0f updates/s  %.1f KB/s per client  Keyframe %u B  %u spectators",
+               summary.tick_p50_us, summary.tick_p99_us, summary.tick_max_us,
+               (unsigned)stats_percentile(&window[3], 99),
+               (updates - last_updates) / seconds / NUM_STREAMS,
+               (bytes - last_bytes) / seconds / 1024 / NUM_STREAMS,
+               (unsigned)stats_get(&game_stats.keyframe_bytes), summary.spectators);
+      last_updates = updates;
+      last_bytes = bytes;
+    }
+
+    if(log != NULL) {
+      fprintf(log, "[%8.1f s] %s\n", (now - start) / 1000000.0, line);
+      fflush(log);
+    }
+
+    if(show_stats && headless) {
+      fprintf(stderr, "%s\n", line);
+    } else if(show_stats) {
+      // Pad the line out to the edge of the screen so it covers the last one
+      int width = COLS - 3;
+      if(width < 0) width = 0;
+      if(width > (int)sizeof(stats_line) - 1) width = sizeof(stats_line) - 1;
+      snprintf(stats_line, sizeof(stats_line), "%-*.*s", width, width, line);
+      stats_line_changed = true;
+      task_event_signal(&board_changed);
+    }
+  }
+
+  if(log != NULL) fclose(log);
+}
+
+/**
+ * Convert a row number within the view to a screen position
+ * \param   row   The view row number to convert
+ * \return        A corresponding row number for the ncurses screen
+ */
+int screen_row(int row) {
+  return 2 + row;
+}
+
+/**
+ * Convert a column number within the view to a screen position
+ * \param   col   The view column number to convert
+ * \return        A corresponding column number for the ncurses screen
+ */
+int screen_col(int col) {
+  return 2 + col;
+}
+
+/**
+ * Print the rules of the game
+ */
+void print_rules() {
+  fprintf(stdout, "\nMultiplayer Snake Rules!\n\n");
+  fprintf(stdout, "Usage for Player 1: ./snake\n");
+  fprintf(stdout, "Usage for Player 2: ./snake <Player 1's Machine Name> <port number>\n");
+  fprintf(stdout, "Usage for Spectators: ./snake <Player 1's Machine Name> <port number> watch\n\n");
+  fprintf(stdout, "The player with the longest snake wins!\n\n");
+  fprintf(stdout, "Don't forget that:\n");
+  fprintf(stdout, "Eat the apples to become longer (before your opponent does!)\n");
+  fprintf(stdout, "If you collide with the board edges, the game is over.\n");
+  fprintf(stdout, "If you collide with your opponent or viceversa, the game is over.\n");
+  fprintf(stdout, "Your oponent might want to make you collide if you have a shorter snake.\n");
+  fprintf(stdout, "When the game is over, the player with the longest snake wins!\n");
+}
+
+/**
+ * Work out how much of the board fits on the terminal. A board that doesn't
+ * fit is shown through a view that follows the snake being watched, with a
+ * minimap of the whole board beside it if there is room.
+ */
+void init_view() {
+  // Leave room for the title line, the edges, and the statistics line
+  view_height = BOARD_HEIGHT;
+  view_width = BOARD_WIDTH;
+  int reserved_lines = show_stats ? 4 : 3;
+  if(view_height > LINES - reserved_lines) view_height = LINES - reserved_lines;
+  if(view_width > COLS - 4) view_width = COLS - 4;
+
+  // The minimap goes to the right of the board, with a column between them
+  show_minimap = (view_height < BOARD_HEIGHT || view_width < BOARD_WIDTH) &&
+                 LINES >= MINIMAP_HEIGHT + 4 && COLS - 4 - (MINIMAP_WIDTH + 3) >= 1;
+  if(show_minimap && view_width > COLS - 4 - (MINIMAP_WIDTH + 3)) {
+    view_width = COLS - 4 - (MINIMAP_WIDTH + 3);
+  }
+
+  // Clients are never sent more of the board than their area
+  if(view_height > AREA_HEIGHT) view_height = AREA_HEIGHT;
+  if(view_width > AREA_WIDTH) view_width = AREA_WIDTH;
+  if(view_height < 1) view_height = 1;
+  if(view_width < 1) view_width = 1;
+}
+
+/**
+ * Draw a box around a part of the screen.
+ * \param   row     The screen row of the first row inside the box
+ * \param   col     The screen column of the first column inside the box
+ * \param   height  The number of rows inside the box
+ * \param   width   The number of columns inside the box
+ */
+void draw_box(int row, int col, int height, int width) {
+  // Print corners
+  renderer->put(row - 1, col - 1, BORDER_PAIR, CHAR_ULCORNER);
+  renderer->put(row - 1, col + width, BORDER_PAIR, CHAR_URCORNER);
+  renderer->put(row + height, col - 1, BORDER_PAIR, CHAR_LLCORNER);
+  renderer->put(row + height, col + width, BORDER_PAIR, CHAR_LRCORNER);
+
+  // Print top and bottom edges
+  for(int c=0; c<width; c++) {
+    renderer->put(row - 1, col + c, BORDER_PAIR, CHAR_HLINE);
+    renderer->put(row + height, col + c, BORDER_PAIR, CHAR_HLINE);
+  }
+
+  // Print left and right edges
+  for(int r=0; r<height; r++) {
+    renderer->put(row + r, col - 1, BORDER_PAIR, CHAR_VLINE);
+    renderer->put(row + r, col + width, BORDER_PAIR, CHAR_VLINE);
+  }
+}
+
+/**
+ * Get the screen column of the minimap's first column.
+ */
+int minimap_col() {
+  return screen_col(view_width) + 3;
+}
+
+/**
+ * Initialize the board display by printing the title and edges
+ */
+void init_display() {
+  init_view();
+
+  // Print Title Line, unless the view is too narrow to fit it between the scores
+  if(view_width >= TITLE_MIN_WIDTH) {
+    int title_col = screen_col(view_width/2 - 5);
+    renderer->put(screen_row(-2), title_col, TEXT_PAIR, CHAR_DIAMOND);
+    renderer->put(screen_row(-2), title_col+1, TEXT_PAIR, CHAR_DIAMOND);
+    renderer->text(screen_row(-2), title_col+2, TEXT_PAIR, " Snake! ");
+    renderer->put(screen_row(-2), title_col+10, TEXT_PAIR, CHAR_DIAMOND);
+    renderer->put(screen_row(-2), title_col+11, TEXT_PAIR, CHAR_DIAMOND);
+  }
+
+  // Print the edges of the board and the minimap
+  draw_box(screen_row(0), screen_col(0), view_height, view_width);
+  if(show_minimap) {
+    draw_box(screen_row(0), minimap_col(), MINIMAP_HEIGHT, MINIMAP_WIDTH);
+  }
+
+  // Refresh the display
+  renderer->present();
+}
+
+/*
+ * Determine the scores and winner by comparing the lengths of the snakes and updates end and score variables accordingly.
+ */
+void score_counter() {
+  if(board_area.height < BOARD_HEIGHT || board_area.width < BOARD_WIDTH) {
+    // The tails may be outside the area we know about, so use the lengths the
+    // server sent along with it
+    snake1_score = board_area.snake1_length;
+    snake2_score = (SNAKE2_BASE - 1) + board_area.snake2_length;
+  }
+   for(int r = board_area.row; r < board_area.row + board_area.height; r++) {
+    for(int c = board_area.col; c < board_area.col + board_area.width; c++) {
+      int cur = game.board[r][c];
+      // Found snake1, find tail (largest number less than SNAKE2_BASE).
+      if(cur > snake1_score && cur < SNAKE2_BASE) {
+        snake1_score = cur;
+      }
+      // Found snake2, find tail (largest number from SNAKE2_BASE up).
+      if(cur > snake2_score && cur >= SNAKE2_BASE) {
+        snake2_score = cur;
+      }
+    }
+  }
+  // Remove initial length to determine score.
+  snake2_score = snake2_score - (SNAKE2_BASE - 1) - INIT_snake_LENGTH;
+  snake1_score = snake1_score - INIT_snake_LENGTH;
+
+
+    if(end == 1) {
+    snake2_score++;
+    } else if(end == 2) {
+    snake1_score++;
+    }
+
+  // Compare scores and determine winner.
+  if(snake1_score > snake2_score) {
+    end = 1 ;
+  } else if (snake2_score > snake1_score) {
+    end = 2;
+  }
+}
+
+/**
+ * Show a game over message, winner message, and wait for a key press.
+ */
+void end_game() {
+  renderer->text(screen_row(view_height/2)-1, screen_col(view_width/2)-6, TEXT_PAIR, "            ");
+  renderer->text(screen_row(view_height/2),   screen_col(view_width/2)-6, TEXT_PAIR, " Game Over! ");
+  renderer->text(screen_row(view_height/2)+1, screen_col(view_width/2)-6, TEXT_PAIR, "            ");
+  score_counter();
+  if(end == 1) {
+    renderer->text(screen_row(view_height/2)+1, screen_col(view_width/2)-6, SNAKE1_PAIR, "Player 1 Wins");
+  } else if(end == 2) {
+    renderer->text(screen_row(view_height/2)+1, screen_col(view_width/2)-6, SNAKE2_PAIR, "Player 2 Wins");
+  } else {
+    renderer->text(screen_row(view_height/2)+1, screen_col(view_width/2)-2, TEXT_PAIR, "Tie");
+  }
+  renderer->text(screen_row(view_height/2)+3, screen_col(view_width/2)-11, TEXT_PAIR, "Press any key to exit.");
+  renderer->present();
+  timeout(-1);
+  task_readchar();
+}
+
+/**
+ * Get what a board cell looks like on screen. Snake segments of any age look
+ * the same, and apples cycle through four spinner characters.
+ *
+ * \param   cur   The value of the board cell
+ * \return        0 for an empty cell, 1 or 2 for a snake, or 3 plus the
+ *                spinner position for an apple
+ */
+int cell_glyph(int cur) {
+  if(cur == 0) {
+    return 0;
+  } else if(cur > 0 && cur < SNAKE2_BASE) {
+    return 1;
+  } else if(cur >= SNAKE2_BASE) {
+    return 2;
+  } else {
+    return 3 + abs(cur % 4);
+  }
+}
+
+/**
+ * Draw a single board cell.
+ * \param   r       The cell's row within the view
+ * \param   c       The cell's column within the view
+ * \param   glyph   What the cell looks like, as returned by cell_glyph
+ */
+void draw_cell(int r, int c, int glyph) {
+  if(glyph == 0) {  // Draw blank spaces
+    renderer->put(screen_row(r), screen_col(c), EMPTY_PAIR, ' ');
+  } else if(glyph == 1) {  // Draw snake
+    renderer->put(screen_row(r), screen_col(c), SNAKE1_PAIR, SNAKE_CHAR);
+  } else if(glyph == 2) {
+    renderer->put(screen_row(r), screen_col(c), SNAKE2_PAIR, SNAKE_CHAR);
+  } else {  // Draw apple spinner character
+    char spinner_chars[] = {'|', '/', '-', '\\'};
+    renderer->put(screen_row(r), screen_col(c), APPLE_PAIR, spinner_chars[glyph - 3]);
+  }
+}
+
+/**
+ * Move a view along one axis as little as needed to keep a position away from
+ * its edges, without going past the edges of what is known.
+ *
+ * \param   start   The view's first row or column
+ * \param   size    The view's height or width
+ * \param   pos     The position to keep in view
+ * \param   first   The first row or column that is known
+ * \param   count   The number of rows or columns that are known
+ * \return          The view's new first row or column
+ */
+int follow(int start, int size, int pos, int first, int count) {
+  int margin = size / 4;
+  if(pos < start + margin) start = pos - margin;
+  if(pos >= start + size - margin) start = pos - size + margin + 1;
+  if(start > first + count - size) start = first + count - size;
+  if(start < first) start = first;
+  return start;
+}
+
+/**
+ * Move the view to follow the snake being watched. Players watch their own
+ * snake, and everyone else watches snake 1.
+ */
+void follow_snake() {
+  if(view_height == BOARD_HEIGHT && view_width == BOARD_WIDTH) return;
+
+  // Look for the snake's head in the part of the board we know about
+  int head = (my_player == 2) ? SNAKE2_BASE : 1;
+  for(int r=board_area.row; r<board_area.row + board_area.height; r++) {
+    for(int c=board_area.col; c<board_area.col + board_area.width; c++) {
+      if(game.board[r][c] == head) {
+        view_row = follow(view_row, view_height, r, board_area.row, board_area.height);
+        view_col = follow(view_col, view_width, c, board_area.col, board_area.width);
+        return;
+      }
+    }
+  }
+}
+
+/**
+ * Draw the minimap cells that look different from the last frame. The part
+ * of the board in view is shaded.
+ *
+ * \returns   true if anything was drawn.
+ */
+bool draw_minimap() {
+  // Work out the minimap ourselves when we know the whole board
+  if(board_area.height == BOARD_HEIGHT && board_area.width == BOARD_WIDTH) {
+    minimap_build(&minimap, game.board);
+  }
+
+  bool changed = false;
+  for(int r=0; r<MINIMAP_HEIGHT; r++) {
+    // The board rows this minimap row covers, up to but not including the last
+    int first_row = r * BOARD_HEIGHT / MINIMAP_HEIGHT;
+    int last_row = (r + 1) * BOARD_HEIGHT / MINIMAP_HEIGHT;
+    bool row_in_view = last_row > view_row && first_row < view_row + view_height;
+    for(int c=0; c<MINIMAP_WIDTH; c++) {
+      int first_col = c * BOARD_WIDTH / MINIMAP_WIDTH;
+      int last_col = (c + 1) * BOARD_WIDTH / MINIMAP_WIDTH;
+      bool in_view = row_in_view && last_col > view_col && first_col < view_col + view_width;
+
+      int glyph = minimap.cells[r][c] | (in_view ? 8 : 0);
+      if(glyph == drawn_minimap[r][c]) continue;
+
+      int row = screen_row(r);
+      int col = minimap_col() + c;
+      if(minimap.cells[r][c] & MINIMAP_SNAKE1) {
+        renderer->put(row, col, SNAKE1_PAIR, SNAKE_CHAR);
+      } else if(minimap.cells[r][c] & MINIMAP_SNAKE2) {
+        renderer->put(row, col, SNAKE2_PAIR, SNAKE_CHAR);
+      } else if(minimap.cells[r][c] & MINIMAP_APPLE) {
+        renderer->put(row, col, APPLE_PAIR, '*');
+      } else {
+        renderer->put(row, col, in_view ? BORDER_PAIR : EMPTY_PAIR, in_view ? '.' : ' ');
+      }
+      drawn_minimap[r][c] = glyph;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+/**
+ * Forget what is on screen, so the next frame draws everything.
+ */
+void reset_frame() {
+  memset(drawn, -1, sizeof(drawn));
+  memset(drawn_minimap, -1, sizeof(drawn_minimap));
+  drawn_score1 = -1;
+  drawn_score2 = -1;
+  drawn_waiting = false;
+  stats_line_changed = true;
+}
+
+/**
+ * Draw the cells and scores that look different from the last frame, and
+ * show them on the terminal.
+ *
+ * \returns   true if anything was drawn.
+ */
+bool draw_frame() {
+  // The reconnect message covers part of a row, so that row is drawn again
+  // once the message goes away
+  bool waiting = connection_lost || players_lost();
+  if(drawn_waiting && !waiting) {
+    memset(drawn[view_height/2], -1, sizeof(drawn[0]));
+  }
+
+  // Keep the snake being watched in view. Cells that look the same in the
+  // view's new position are left alone.
+  follow_snake();
+
+  // Draw the cells of the game board that look different
+  bool changed = false;
+  for(int r=0; r<view_height; r++) {
+    for(int c=0; c<view_width; c++) {
+      int glyph = cell_glyph(game.board[view_row + r][view_col + c]);
+      if(glyph != drawn[r][c]) {
+        draw_cell(r, c, glyph);
+        drawn[r][c] = glyph;
+        changed = true;
+      }
+    }
+  }
+
+  // Draw the scores for player 1 and player 2 (score color corresponding to snake color)
+  score_counter();
+  if(snake1_score != drawn_score1 || snake2_score != drawn_score2) {
+    char score[16];
+    renderer->text(screen_row(-2), screen_col(-1), TEXT_PAIR, " P1 Score:");
+    renderer->text(screen_row(-2), screen_col(view_width-18), TEXT_PAIR, "     P2 Score:");
+    snprintf(score, sizeof(score), " %03d       ", snake1_score);
+    renderer->text(screen_row(-2), screen_col(9), SNAKE1_PAIR, score);
+    snprintf(score, sizeof(score), " %03d ", snake2_score);
+    renderer->text(screen_row(-2), screen_col(view_width-4), SNAKE2_PAIR, score);
+    drawn_score1 = snake1_score;
+    drawn_score2 = snake2_score;
+    changed = true;
+  }
+
+  // Let the players know why the game has stopped. Cells under the message
+  // may have been drawn over it, so it is drawn on every frame it is up.
+  if(waiting) {
+    renderer->text(screen_row(view_height/2), screen_col(view_width/2)-12, TEXT_PAIR, " Waiting to reconnect... ");
+    changed = true;
+  }
+  drawn_waiting = waiting;
+
+  if(show_minimap && draw_minimap()) {
+    changed = true;
+  }
+
+  // Show the latest statistics below the board
+  if(show_stats && stats_line_changed) {
+    renderer->text(screen_row(view_height) + 1, screen_col(-1), TEXT_PAIR, stats_line);
+    stats_line_changed = false;
+    changed = true;
+  }
+
+  // Refresh the display if anything was drawn
+  if(changed) {
+    renderer->present();
+  }
+  return changed;
+}
+
+/**
+ * Run in a thread to draw the current state of the game board. The last frame
+ * drawn is kept, so only the cells and scores that changed since then are
+ * drawn again. A frame is drawn when board_changed is signalled, but no more
+ * than the frame rate cap allows. The cap is MAX_FPS unless the SNAKE_MAX_FPS
+ * environment variable sets another.
+ */
+void draw_board() {
+  const char* max_fps = getenv("SNAKE_MAX_FPS");
+  uint64_t frame_interval_ns = 1000000000 / ((max_fps != NULL && atoi(max_fps) > 0) ? atoi(max_fps) : MAX_FPS);
+  unsigned seen = 0;
+
+  // Nothing is on screen yet, so every cell is drawn the first time
+  reset_frame();
+
+  while(running) {
+    // Frames are paced from when each one starts, so the time spent drawing
+    // doesn't slow the frame rate
+    uint64_t frame_start = time_ns();
+
+    // Pick up a complete board from the network thread, if there is one
+    board_snapshot();
+
+    uint64_t render_start = trace_now();
+    uint64_t allocs = alloc_count();
+    bool drawn = draw_frame();
+    if(drawn) {
+      // ncurses sets up its buffers while drawing the first frame, so only
+      // the frames after it are counted
+      if(stats_get(&frames_drawn) > 0) stats_add(&frame_allocs, alloc_count() - allocs);
+      stats_add(&frames_drawn, 1);
+    }
+    trace_span("render", render_start, "drawn", drawn);
+
+    // Wait for something to change, checking again every so often in case
+    // anything changed without a signal. Then hold off until the next frame
+    // is allowed, so bursts of changes are drawn together.
+    task_event_wait(&board_changed, &seen, REDRAW_INTERVAL);
+    uint64_t next_frame = frame_start + frame_interval_ns;
+    if(time_ns() < next_frame) {
+      task_sleep_until(next_frame);
+    }
+  }
+}
+
+/**
+ * Run in a thread to process player 1 input.
+ */
+void read_input1() {
+  while(running) {
+    // Read a character, potentially blocking this thread until a key is pressed
+    int key = task_readchar();
+
+    // Make sure the input was read correctly
+    if(key == ERR) {
+      running = false;
+      fprintf(stderr, "ERROR READING INPUT\n");
+    }
+
+    // Handle the key press
+    if(key == KEY_UP && inputs.snake1_dir != DIR_SOUTH) {
+      inputs.snake1_dir = DIR_NORTH;
+    } else if(key == KEY_RIGHT && inputs.snake1_dir != DIR_WEST) {
+      inputs.snake1_dir = DIR_EAST;
+    } else if(key == KEY_DOWN && inputs.snake1_dir != DIR_NORTH) {
+      inputs.snake1_dir = DIR_SOUTH;
+    } else if(key == KEY_LEFT && inputs.snake1_dir != DIR_EAST) {
+      inputs.snake1_dir = DIR_WEST;
+    } else if(key == 'q') {
+      running = false;
+    }
+
+  }
+}
+
+/**
+ * Run in a thread to process the input of a player on another machine. Player
+ * 2 always plays remotely, and so does player 1 on a dedicated server.
+ */
+void read_remote_input() {
+  // The server tells us which snake is ours when we join
+  int* dir = &inputs.snake2_dir;
+  while(running) {
+    // Read a character, potentially blocking this thread until a key is pressed
+    int key = task_readchar();
+
+    // Make sure the input was read correctly
+    if(key == ERR) {
+      running = false;
+      fprintf(stderr, "ERROR READING INPUT\n");
+    }
+
+    if(my_player == 1) {
+      dir = &inputs.snake1_dir;
+    }
+
+    // Handle the key press
+    if(key == KEY_UP && *dir != DIR_SOUTH) {
+      *dir = DIR_NORTH;
+    } else if(key == KEY_RIGHT && *dir != DIR_WEST) {
+      *dir = DIR_EAST;
+    } else if(key == KEY_DOWN && *dir != DIR_NORTH) {
+      *dir = DIR_SOUTH;
+    } else if(key == KEY_LEFT && *dir != DIR_EAST) {
+      *dir = DIR_WEST;
+    } else if(key == 'q') {
+      running = false;
+    }
+
+    // Write our snake's direction to the server. If this fails the receive
+    // thread is already reconnecting, and the turn is lost.
+    client_msg_t turn = {
+      .type = CMSG_TURN,
+      .dir = *dir,
+      .time_us = time_us()
+    };
+    send_to_server(&turn);
+
+  }
+}
+
+/**
+ * Run in a thread to let a spectator quit.
+ */
+void watch_input() {
+  while(running) {
+    // Read a character, potentially blocking this thread until a key is pressed
+    int key = task_readchar();
+
+    if(key == ERR || key == 'q') {
+      running = false;
+    }
+  }
+}
+
+/**
+ * Copy every part of the game state that game_step depends on into a keyframe.
+ */
+void save_keyframe(game_keyframe_t* keyframe) {
+  memcpy(keyframe->board, game.board, sizeof(game.board));
+  keyframe->snake1_dir = game.snake1_dir;
+  keyframe->snake2_dir = game.snake2_dir;
+  keyframe->snake1_length = game.snake1_length;
+  keyframe->snake2_length = game.snake2_length;
+  keyframe->snake1_timer = game.snake1_timer;
+  keyframe->snake2_timer = game.snake2_timer;
+  keyframe->apple_timer = game.apple_timer;
+  keyframe->generate_apple_timer = game.generate_apple_timer;
+  keyframe->apple_age = game.apple_age;
+  keyframe->game_tick = game.game_tick;
+  keyframe->rng_state = game.rng_state;
+}
+
+/**
+ * Restore the game state from a keyframe.
+ */
+void load_keyframe(const game_keyframe_t* keyframe) {
+  memcpy(game.board, keyframe->board, sizeof(game.board));
+  game.snake1_dir = keyframe->snake1_dir;
+  game.snake2_dir = keyframe->snake2_dir;
+  game.snake1_length = keyframe->snake1_length;
+  game.snake2_length = keyframe->snake2_length;
+  game.snake1_timer = keyframe->snake1_timer;
+  game.snake2_timer = keyframe->snake2_timer;
+  game.apple_timer = keyframe->apple_timer;
+  game.generate_apple_timer = keyframe->generate_apple_timer;
+  game.apple_age = keyframe->apple_age;
+  game.game_tick = keyframe->game_tick;
+  game.rng_state = keyframe->rng_state;
+  game.over = false;
+
+  // Keep heading the way the keyframe was until an input says otherwise
+  inputs.snake1_dir = game.snake1_dir;
+  inputs.snake2_dir = game.snake2_dir;
+}
+
+/**
+ * Start recording the match. The file name comes from the SNAKE_REPLAY
+ * environment variable if it is set, and recording is turned off if it is set
+ * to an empty string.
+ *
+ * \param seed  The seed the match's random number generator started from
+ */
+void start_recording(uint64_t seed) {
+  char path[1024];
+  const char* name = getenv("SNAKE_REPLAY");
+  if(name == NULL) {
+    time_t now = time(NULL);
+    strftime(path, sizeof(path), "snake-%Y%m%d-%H%M%S.replay", localtime(&now));
+
+    // Rooms play at the same time, so each puts its number in the name
+    if(room_index != -1) {
+      strftime(path, sizeof(path), "snake-%Y%m%d-%H%M%S", localtime(&now));
+      snprintf(path + strlen(path), sizeof(path) - strlen(path), "-%d.replay", room_index);
+    }
+    name = path;
+  } else if(name[0] == '\0') {
+    return;
+  } else if(room_index != -1) {
+    snprintf(path, sizeof(path), "%s.%d", name, room_index);
+    name = path;
+  }
+
+  replay_header_t header = {
+    .board_width = BOARD_WIDTH,
+    .board_height = BOARD_HEIGHT,
+    .tick_interval = GAME_TICK_INTERVAL,
+    .horizontal_interval = snake_HORIZONTAL_INTERVAL,
+    .vertical_interval = snake_VERTICAL_INTERVAL,
+    .apple_interval = APPLE_UPDATE_INTERVAL,
+    .generate_apple_interval = GENERATE_APPLE_INTERVAL,
+    .init_length = INIT_snake_LENGTH,
+    .keyframe_interval = REPLAY_KEYFRAME_INTERVAL,
+    .state_size = sizeof(game_keyframe_t),
+    .seed = seed
+  };
+
+  // A match that can't be recorded can still be played
+  if(replay_writer_open(&recorder, name, &header) == -1) {
+    perror("Failed to create replay file");
+  }
+}
+
+/**
+ * Get the name this machine's player goes by, from the SNAKE_NAME environment
+ * variable or else the user's login name.
+ *
+ * \param name  The name is written here, cut short if it is too long
+ */
+void local_player_name(char name[PLAYER_NAME_MAX]) {
+  const char* env = getenv("SNAKE_NAME");
+  if(env == NULL || env[0] == '\0') env = getenv("USER");
+  if(env == NULL || env[0] == '\0') env = "anonymous";
+  strncpy(name, env, PLAYER_NAME_MAX);
+}
+
+/**
+ * Open the file that finished matches are added to. The file name comes from
+ * the SNAKE_RESULTS environment variable if it is set, and results are not
+ * kept if it is set to an empty string.
+ */
+void open_results() {
+  const char* path = getenv("SNAKE_RESULTS");
+  if(path == NULL) {
+    path = RESULTS_FILE;
+  } else if(path[0] == '\0') {
+    return;
+  }
+
+  // A match whose result can't be kept can still be played
+  if(results_open(&results, path, true) == -1) {
+    perror("Failed to open results file");
+    return;
+  }
+  keeping_results = true;
+}
+
+/**
+ * Add the match that just ended to the results file. Each player scores a
+ * point for every apple their snake ate. This runs after the last tick, so it
+ * never holds up the game.
+ */
+void record_result() {
+  if(!keeping_results) return;
+
+  match_result_t result = {
+    .finished = wall_time_ms(),
+    .ticks = game.game_tick,
+    .score1 = game.snake1_length - INIT_snake_LENGTH,
+    .score2 = game.snake2_length - INIT_snake_LENGTH
+  };
+  if(result.score1 != result.score2) {
+    result.winner = result.score1 > result.score2 ? 1 : 2;
+  }
+  memcpy(result.name1, players[0].name, PLAYER_NAME_MAX);
+  memcpy(result.name2, players[1].name, PLAYER_NAME_MAX);
+
+  if(results_append(&results, &result) == -1) {
+    perror("Failed to record the result");
+  }
+}
+
+/**
+ * Stop keeping results. A room keeps its results file open from one match
+ * to the next, so this is only called once a process has played its last
+ * match.
+ */
+void close_results() {
+  if(!keeping_results) return;
+  results_close(&results);
+  keeping_results = false;
+}
+
+/**
+ * Print the leaderboard from the results file, or one player's recent
+ * matches if a name is given.
+ *
+ * \param name  The player to show, or NULL for the leaderboard
+ */
+void print_results(const char* name) {
+  const char* path = getenv("SNAKE_RESULTS");
+  if(path == NULL || path[0] == '\0') path = RESULTS_FILE;
+
+  results_t store;
+  if(results_open(&store, path, false) == -1) {
+    if(errno == ENOENT) {
+      printf("No matches have been recorded in %s yet.\n", path);
+      return;
+    }
+    perror("Failed to open results file");
+    exit(2);
+  }
+
+  if(name == NULL) {
+    player_record_t top[LEADERBOARD_SIZE];
+    size_t count = results_leaderboard(&store, top, LEADERBOARD_SIZE);
+    printf("%u matches played\n", results_count(&store));
+    for(size_t i=0; i<count; i++) {
+      printf("%3zu. %-*.*s %4u wins %4u losses %4u ties   best %d\n", i + 1,
+             PLAYER_NAME_MAX, PLAYER_NAME_MAX, top[i].name,
+             top[i].wins, top[i].losses, top[i].ties, top[i].best_score);
+    }
+  } else {
+    player_record_t player;
+    if(!results_player(&store, name, &player)) {
+      printf("%s has not played any matches.\n", name);
+      results_close(&store);
+      return;
+    }
+    printf("%.*s: %u matches, %u wins, %u losses, %u ties, best score %d\n",
+           PLAYER_NAME_MAX, player.name, player.matches, player.wins, player.losses, player.ties,
+           player.best_score);
+
+    match_result_t history[HISTORY_SIZE];
+    size_t count = results_history(&store, name, history, HISTORY_SIZE);
+    for(size_t i=0; i<count; i++) {
+      match_result_t* match = &history[i];
+      char when[32];
+      time_t finished = match->finished / 1000;
+      strftime(when, sizeof(when), "%Y-%m-%d %H:%M", localtime(&finished));
+
+      // Show each match from the named player's side
+      bool first = strncmp(match->name1, name, PLAYER_NAME_MAX) == 0;
+      int mine = first ? match->score1 : match->score2;
+      int theirs = first ? match->score2 : match->score1;
+      const char* outcome = match->winner == 0 ? "tied" :
+                            (match->winner == 1) == first ? "beat" : "lost to";
+      printf("%s  %-7s %-*.*s %3d - %-3d  %u ticks\n", when, outcome,
+             PLAYER_NAME_MAX, PLAYER_NAME_MAX, first ? match->name2 : match->name1,
+             mine, theirs, match->ticks);
+    }
+  }
+  results_close(&store);
+}
+
+/**
+ * Work out when the tick after one that was due at a given time is due. A
+ * tick that ran late is caught up with by running the next one sooner, but
+ * after falling more than a whole tick behind, the game carries on from now
+ * instead of rushing through the ticks it missed.
+ *
+ * \param due   When the last tick was due, from time_ns
+ *
+ * \returns     When the next tick is due
+ */
+uint64_t next_tick_due(uint64_t due) {
+  uint64_t next = due + GAME_TICK_INTERVAL * 1000000ull;
+  uint64_t now = time_ns();
+  return now > next + GAME_TICK_INTERVAL * 1000000ull ? now : next;
+}
+
+/**
+ * Run in a thread to move the snakes and apples. The game advances one tick at
+ * a time, and every change is sent to the remote players and any spectators.
+ */
+void update_game() {
+  static game_keyframe_t keyframe;
+
+  // When the next tick is due. Ticks are due a fixed interval apart, so time
+  // spent running them doesn't add up over a match.
+  uint64_t next_tick = time_ns();
+
+  while(running) {
+    // Pause the match while a player reconnects, and end it if they take too long
+    if(players_lost()) {
+      size_t now = time_ms();
+      for(int i=0; i<2; i++) {
+        if(players[i].lost && now - players[i].lost_at > RECONNECT_GRACE_PERIOD) {
+          running = false;
+        }
+      }
+      if(running) {
+        task_sleep(GAME_TICK_INTERVAL);
+        next_tick = time_ns();
+        continue;
+      }
+    }
+
+    uint64_t tick_start = time_us();
+    uint64_t trace_start = trace_now();
+    uint64_t allocs = alloc_count();
+
+    // Apply the most recent directions the remote players sent
+    int dir;
+    while(spsc_pop(&players[0].inputs, &dir)) {
+      inputs.snake1_dir = dir;
+    }
+    while(spsc_pop(&players[1].inputs, &dir)) {
+      inputs.snake2_dir = dir;
+    }
+
+    // Record the whole state every so often, plus the inputs for this tick.
+    // The keyframe goes first, so a replay that seeks to it still reads a
+    // turn made on this tick.
+    if(game.game_tick % REPLAY_KEYFRAME_INTERVAL == 0) {
+      save_keyframe(&keyframe);
+      replay_write_keyframe(&recorder, game.game_tick, &keyframe);
+    }
+    replay_write_input(&recorder, game.game_tick, inputs.snake1_dir, inputs.snake2_dir);
+
+    bool changed = game_step(&game, &inputs);
+    if(game.over) running = false;
+
+    // Once the server board has been updated, send the changes to the client
+    // and any spectators.
+    if(changed) {
+      broadcast_board();
+      task_event_signal(&board_changed);
+    }
+    broadcast_keyframes();
+
+    // Let the players know their pings and turns have been seen to
+    answer_player(0);
+    answer_player(1);
+    uint64_t tick_us = time_us() - tick_start;
+    stats_record(&game_stats.tick_us, tick_us);
+    if(tick_us > GAME_TICK_INTERVAL * 1000) {
+      stats_add(&game_stats.overruns, 1);
+    }
+    stats_add(&game_stats.allocs, alloc_count() - allocs);
+    trace_span("tick", trace_start, "tick", game.game_tick);
+
+    if(!running) {
+      // Add a key to the input buffer so the read_input thread can exit
+      if(!headless) ungetch(0);
+      break;
+    }
+
+    next_tick = next_tick_due(next_tick);
+    task_sleep_until(next_tick);
+  }
+
+  replay_writer_close(&recorder, game.game_tick);
+}
+
+/**
+ * Re-simulate one tick of a recorded match, applying whatever was recorded for
+ * that tick first. Keyframes along the way are compared with the simulated
+ * state to catch anything that did not replay exactly.
+ *
+ * \returns   false once the recording has no more ticks to play.
+ */
+bool replay_step() {
+  static game_keyframe_t keyframe;
+
+  const replay_record_t* record;
+  while((record = replay_record(&replay, replay_pos)) != NULL && record->tick <= game.game_tick) {
+    if(record->type == REPLAY_INPUT) {
+      inputs.snake1_dir = record->dir1;
+      inputs.snake2_dir = record->dir2;
+    } else if(record->type == REPLAY_KEYFRAME) {
+      save_keyframe(&keyframe);
+      if(memcmp(&keyframe, replay_keyframe_state(record), sizeof(keyframe)) != 0) {
+        replay_mismatches++;
+      }
+    } else if(record->type == REPLAY_END) {
+      return false;
+    }
+    replay_pos = replay_next(&replay, replay_pos);
+  }
+
+  // A recording that was cut off has no inputs past its last record
+  if(record == NULL) return false;
+
+  game_step(&game, &inputs);
+  if(game.over) running = false;
+  return running;
+}
+
+/**
+ * Jump to a tick in the recorded match by restoring the nearest keyframe at or
+ * before it and re-simulating the ticks in between.
+ *
+ * \param tick  The tick to jump to
+ */
+void replay_goto(uint32_t tick) {
+  replay_pos = replay_seek(&replay, tick);
+  const replay_record_t* record = replay_record(&replay, replay_pos);
+  load_keyframe(replay_keyframe_state(record));
+  replay_pos = replay_next(&replay, replay_pos);
+  running = true;
+
+  while(game.game_tick < tick && replay_step()) {}
+}
+
+/**
+ * Run in a thread to play back a recorded match at its original speed, or as
+ * fast as possible while fast-forwarding.
+ */
+void play_replay() {
+  uint64_t next_tick = time_ns();
+  while(running) {
+    if(replay_fast_forward) {
+      // Simulate for most of a frame, then let the board be drawn
+      size_t start = time_ms();
+      while(running && time_ms() - start < DRAW_BOARD_INTERVAL) {
+        if(!replay_step()) running = false;
+      }
+    } else if(!replay_step()) {
+      running = false;
+    }
+
+    task_event_signal(&board_changed);
+
+    if(!running) {
+      // Add a key to the input buffer so the replay_input thread can exit
+      ungetch(0);
+      break;
+    }
+
+    if(replay_fast_forward) {
+      task_sleep(1);
+      next_tick = time_ns();
+    } else {
+      next_tick = next_tick_due(next_tick);
+      task_sleep_until(next_tick);
+    }
+  }
+}
+
+/**
+ * Run in a thread to control replay playback. The left and right arrows jump
+ * back and forward, f toggles fast-forward, and q quits.
+ */
+void replay_input() {
+  while(running) {
+    int key = task_readchar();
+
+    if(key == ERR || key == 'q') {
+      running = false;
+    } else if(key == 'f') {
+      replay_fast_forward = !replay_fast_forward;
+    } else if(key == KEY_LEFT) {
+      uint32_t jump = REPLAY_JUMP_INTERVAL / GAME_TICK_INTERVAL;
+      replay_goto(game.game_tick > jump ? game.game_tick - jump : 0);
+    } else if(key == KEY_RIGHT) {
+      replay_goto(game.game_tick + REPLAY_JUMP_INTERVAL / GAME_TICK_INTERVAL);
+    }
+    task_event_signal(&board_changed);
+  }
+}
+
+/**
+ * Re-simulate a recorded match as fast as possible without displaying it, then
+ * print how long it took. This is for reproducing problems offline. Seeking
+ * is checked too, by seeking to each keyframe and re-simulating up to the
+ * next one, which has to match it.
+ *
+ * \param start_tick  The tick to start from
+ */
+void replay_benchmark(uint32_t start_tick) {
+  size_t seek_start = time_ms();
+  replay_goto(start_tick);
+  size_t sim_start = time_ms();
+
+  uint32_t first_tick = game.game_tick;
+  while(replay_step()) {}
+  size_t finish = time_ms();
+
+  uint32_t ticks = game.game_tick - first_tick;
+  size_t elapsed = finish - sim_start;
+  printf("Seeked to tick %u in %zu ms\n", first_tick, sim_start - seek_start);
+  printf("Simulated %u ticks in %zu ms", ticks, elapsed);
+  if(elapsed > 0) {
+    printf(" (%.0f ticks/sec, %.0fx real time)", ticks * 1000.0 / elapsed,
+           (double)ticks * GAME_TICK_INTERVAL / elapsed);
+  }
+  printf("\nStopped at tick %u of %u\n", game.game_tick, replay.last_tick);
+  printf("Keyframe mismatches: %zu\n", replay_mismatches);
+
+  score_counter();
+  printf("Player 1 score: %d, Player 2 score: %d\n", snake1_score, snake2_score);
+
+  size_t straight_mismatches = replay_mismatches;
+  for(size_t i=0; i + 1 < replay.num_keyframes; i++) {
+    uint32_t next = replay_record(&replay, replay.keyframes[i + 1])->tick;
+    replay_goto(replay_record(&replay, replay.keyframes[i])->tick);
+    while(game.game_tick <= next && replay_step()) {}
+  }
+  printf("Keyframe mismatches after seeking: %zu\n", replay_mismatches - straight_mismatches);
+}
+
+/**
+ * Encode the area around snake 1 as a keyframe at every tick of a recorded
+ * match, decode it again, and print how big the keyframes were and how fast
+ * the codec ran. Every decoded keyframe is checked against the board.
+ *
+ * \param start_tick  The tick to start from
+ */
+void replay_codec_benchmark(uint32_t start_tick) {
+  static uint8_t encoded[KEYFRAME_MAX_SIZE(AREA_HEIGHT * AREA_WIDTH)];
+  static int decoded[AREA_HEIGHT][AREA_WIDTH];
+  replay_goto(start_tick);
+
+  size_t keyframes = 0;
+  size_t bytes = 0;
+  size_t max_bytes = 0;
+  size_t errors = 0;
+  uint64_t encode_ns = 0;
+  uint64_t decode_ns = 0;
+  area_t area;
+  do {
+    area = area_around(game.snake1_row, game.snake1_col);
+    int* cells = &game.board[area.row][area.col];
+
+    uint64_t start = time_ns();
+    size_t length = keyframe_encode(cells, area.height, area.width, BOARD_WIDTH, encoded);
+    uint64_t encoded_at = time_ns();
+    bool ok = keyframe_decode(encoded, length, &decoded[0][0], area.height, area.width, AREA_WIDTH);
+    uint64_t decoded_at = time_ns();
+
+    for(int r=0; r<area.height && ok; r++) {
+      ok = memcmp(decoded[r], &cells[r * BOARD_WIDTH], area.width * sizeof(int)) == 0;
+    }
+    if(!ok) errors++;
+
+    keyframes++;
+    bytes += length;
+    if(length > max_bytes) max_bytes = length;
+    encode_ns += encoded_at - start;
+    decode_ns += decoded_at - encoded_at;
+  } while(replay_step());
+
+  // Throughput is in terms of the cells as they are held in memory
+  double raw = (double)area.height * area.width * sizeof(int);
+  printf("Encoded %zu keyframes of %dx%d cells (%.0f bytes raw)\n", keyframes, area.width, area.height, raw);
+  printf("Average size: %.1f bytes, largest: %zu bytes\n", (double)bytes / keyframes, max_bytes);
+  printf("Encode: %.2f us/keyframe (%.0f MB/s)\n", encode_ns / 1000.0 / keyframes,
+         raw * keyframes * 1000.0 / (encode_ns ? encode_ns : 1));
+  printf("Decode: %.2f us/keyframe (%.0f MB/s)\n", decode_ns / 1000.0 / keyframes,
+         raw * keyframes * 1000.0 / (decode_ns ? decode_ns : 1));
+  printf("Keyframes that decoded wrong: %zu\n", errors);
+}
+
+/**
+ * Fork the game now and then over a recorded match, both copy-on-write and
+ * with a plain copy, step each fork a few ticks ahead with the recorded
+ * directions, and print what each way cost. Every copy-on-write fork is
+ * checked against a copy stepped the same way, and the match against how it
+ * was before it was forked.
+ *
+ * \param start_tick  The tick to start from
+ */
+void replay_fork_benchmark(uint32_t start_tick) {
+  static game_state_t copy;
+  static game_state_t before;
+  replay_goto(start_tick);
+
+  size_t forks = 0;
+  size_t errors = 0;
+  bool mapped = false;
+  uint64_t copy_ns = 0;
+  uint64_t copy_step_ns = 0;
+  uint64_t cow_ns = 0;
+  uint64_t cow_step_ns = 0;
+  do {
+    if(game.game_tick % FORK_INTERVAL != 0) continue;
+
+    game_snapshot(&game, &before);
+    game_cow_t cow;
+    game_cow_open(&cow, &game);
+    mapped = cow.mapped;
+
+    for(int i=0; i<FORK_COUNT; i++) {
+      uint64_t start = time_ns();
+      game_snapshot(&game, &copy);
+      uint64_t copied = time_ns();
+      for(int n=0; n<FORK_STEPS; n++) {
+        game_step(&copy, &inputs);
+      }
+      uint64_t copy_stepped = time_ns();
+
+      game_state_t* fork = game_cow_fork(&cow);
+      if(fork == NULL) {
+        perror("Failed to fork the game");
+        exit(2);
+      }
+      uint64_t forked = time_ns();
+      for(int n=0; n<FORK_STEPS; n++) {
+        game_step(fork, &inputs);
+      }
+      uint64_t fork_stepped = time_ns();
+
+      if(memcmp(fork, &copy, sizeof(game_state_t)) != 0) errors++;
+      game_cow_release(&cow, fork);
+
+      forks++;
+      copy_ns += copied - start;
+      copy_step_ns += copy_stepped - copied;
+      cow_ns += forked - copy_stepped;
+      cow_step_ns += fork_stepped - forked;
+    }
+
+    game_cow_close(&cow);
+    if(memcmp(&game, &before, sizeof(game_state_t)) != 0) errors++;
+  } while(replay_step());
+
+  if(forks == 0) forks = 1;
+  printf("Forked a %dx%d game %zu times, stepping each fork %d ticks\n",
+         BOARD_WIDTH, BOARD_HEIGHT, forks, FORK_STEPS);
+  printf("Copy:          %.2f us/fork, then %.2f us of steps\n",
+         copy_ns / 1000.0 / forks, copy_step_ns / 1000.0 / forks);
+  printf("Copy-on-write: %.2f us/fork, then %.2f us of steps%s\n",
+         cow_ns / 1000.0 / forks, cow_step_ns / 1000.0 / forks,
+         mapped ? "" : " (not available, so these were copies too)");
+  printf("Forks that went wrong: %zu\n", errors);
+}
+
+/**
+ * Write what a dedicated server is doing to a page of metrics for monitoring
+ * to scrape.
+ */
+void write_metrics(metrics_page_t* page) {
+  char labels[128];
+
+  metrics_family(page, "snake_matches_active", "gauge", "Matches being played");
+  bool active = running && (room_index == -1 || room_playing);
+  metrics_sample(page, "snake_matches_active", NULL, active ? 1 : 0);
+
+  int connected = 0;
+  for(int i=0; i<2; i++) {
+    if(players[i].fd != -1 && !players[i].lost) connected++;
+  }
+  metrics_family(page, "snake_connections", "gauge", "Connected players and spectators");
+  metrics_sample(page, "snake_connections", "kind=\"player\"", connected);
+  metrics_sample(page, "snake_connections", "kind=\"spectator\"", spectator_count());
+
+  metrics_family(page, "snake_ticks_total", "counter", "Game ticks run");
+  metrics_sample(page, "snake_ticks_total", NULL, game.game_tick);
+
+  metrics_family(page, "snake_tick_overruns_total", "counter",
+                 "Ticks that took longer than the tick interval");
+  metrics_sample(page, "snake_tick_overruns_total", NULL, stats_get(&game_stats.overruns));
+
+  metrics_histogram_us(page, "snake_tick_duration_seconds",
+                       "Time to run each tick and send its updates", &game_stats.tick_us);
+  metrics_histogram_us(page, "snake_wake_lateness_seconds",
+                       "How late scheduler tasks woke up after sleeping", scheduler_wake_late());
+
+  metrics_family(page, "snake_received_bytes_total", "counter", "Bytes received from players");
+  metrics_sample(page, "snake_received_bytes_total", NULL,
+                 stats_get(&players[0].bytes_in) + stats_get(&players[1].bytes_in) +
+                 stats_get(&udp_bytes_in));
+
+  metrics_family(page, "snake_sent_bytes_total", "counter", "Bytes sent to players and spectators");
+  metrics_sample(page, "snake_sent_bytes_total", "to=\"player\"", stats_get(&game_stats.bytes_out));
+  metrics_sample(page, "snake_sent_bytes_total", "to=\"spectator\"", spectator_bytes_sent());
+
+  metrics_family(page, "snake_scheduler_switches_total", "counter", "Switches from one task to another");
+  metrics_sample(page, "snake_scheduler_switches_total", NULL, scheduler_switches());
+
+  // Count every state, so states with no tasks show up as zero
+  size_t states[TASK_STATES] = {0};
+  int num_tasks = scheduler_num_tasks();
+  for(task_t task=0; task<num_tasks; task++) {
+    states[task_state(task)]++;
+  }
+  metrics_family(page, "snake_scheduler_tasks", "gauge", "Scheduler tasks in each state");
+  for(int state=0; state<TASK_STATES; state++) {
+    snprintf(labels, sizeof(labels), "state=\"%s\"", task_state_name(state));
+    metrics_sample(page, "snake_scheduler_tasks", labels, states[state]);
+  }
+
+  // The main task runs on the program's stack, so it has no stack of its own
+  metrics_family(page, "snake_task_stack_used_bytes", "gauge", "Most stack each task has used");
+  for(task_t task=1; task<num_tasks; task++) {
+    snprintf(labels, sizeof(labels), "task=\"%s\"", task_name(task) != NULL ? task_name(task) : "unnamed");
+    metrics_sample(page, "snake_task_stack_used_bytes", labels, task_stack_used(task));
+  }
+  metrics_family(page, "snake_task_stack_size_bytes", "gauge", "Size of each task's stack");
+  metrics_sample(page, "snake_task_stack_size_bytes", NULL, task_stack_size());
+}
+
+/**
+ * Wait for the next connection and its hello, before the match starts.
+ * Hellos are read without blocking, so a connection that never sends one
+ * doesn't hold up the others. A room waits for the lobby to hand it a
+ * connection instead, answering scrapes while it does, and exits if the
+ * lobby has shut down.
+ *
+ * \param hello   The hello is written here
+ *
+ * \returns       The connection, or -1 if the lobby sent none with its
+ *                message.
+ */
+int next_connection(hello_t* hello) {
+  if(room_index != -1) {
+    room_msg_t msg;
+    int fd;
+    int rc;
+    while((rc = room_receive(room_channel, &msg, &fd, !room_metrics)) == 0) {
+      struct pollfd channel = { .fd = room_channel, .events = POLLIN };
+      poll(&channel, 1, METRICS_INTERVAL);
+      metrics_serve(write_metrics);
+    }
+    if(rc == -1) exit(0);
+    *hello = msg.hello;
+    return fd;
+  }
+
+  struct pollfd fds[1 + MAX_PENDING];
+  while(true) {
+    accept_pending();
+    int fd = pending_hello(hello);
+    if(fd != -1) return fd;
+
+    // Wait for a connection or a hello, checking for ones that took too long
+    int n = 0;
+    fds[n++] = (struct pollfd){ .fd = server_socket_fd, .events = POLLIN };
+    for(int i=0; i<num_pending; i++) {
+      fds[n++] = (struct pollfd){ .fd = pending_fds[i], .events = POLLIN };
+    }
+    if(poll(fds, n, HELLO_POLL_INTERVAL) == -1 && errno != EINTR) {
+      perror("poll");
+      exit(2);
+    }
+  }
+}
+
+/**
+ * Accept connections until the match has both its players. Spectators who
+ * arrive early are kept and start receiving boards with the first move.
+ *
+ * \param first   The first player slot to fill: 0 on a dedicated server, or 1
+ *                when player 1 plays on this machine
+ */
+void wait_for_players(int first) {
+  int next = first;
+  while(next < 2) {
+    hello_t hello;
+    int fd = next_connection(&hello);
+    if(fd == -1) {
+      continue;
+    } else if(hello.role == ROLE_PLAYER) {
+      // Give the player the token they need to reconnect if their connection
+      // drops, and start reading their directions
+      if(join_player(next, fd, hello.name)) {
+        next++;
+      } else {
+        close(fd);
+      }
+    } else if(hello.role == ROLE_SPECTATOR) {
+      add_spectator(fd);
+    } else {
+      close(fd);
+    }
+  }
+}
+
+/**
+ * Put the board in its starting position.
+ */
+void reset_board() {
+  game_reset(&game, game.rng_state);
+  inputs.snake1_dir = game.snake1_dir;
+  inputs.snake2_dir = game.snake2_dir;
+}
+
+/**
+ * Seed the random number generator with the time in milliseconds, and record
+ * the seed so the match can be replayed.
+ */
+void start_match() {
+  uint64_t seed = wall_time_ms();
+  game.rng_state = seed;
+  start_recording(seed);
+
+  // Everything the match allocates from here on comes out of its arena. A
+  // room has had its arena open since before its first match.
+  if(match_arena.base == NULL) {
+    if(arena_open(&match_arena, MATCH_ARENA_SIZE) == -1) {
+      perror("Failed to reserve memory for the match");
       exit(2);
     }
+    scheduler_set_arena(&match_arena);
+    broadcast_set_arena(&match_arena);
   }
-  return NULL;
 }
 
-/*
- * Thread to continuously read the board from the server. If the thread fails to
- * read, then we know the game has ended so we set running = false and ungetch
- * to end other tasks.
+/**
+ * The match is over, so let everyone know and close their connections.
  */
-void* receive_board_thrd(void* p) {
-  while(running) {
-    if(read_better(socket_fd, &board, sizeof(int) * BOARD_HEIGHT * BOARD_WIDTH) <= 0) {
-      running = false;
-      ungetch(0);
-    }
+void end_match() {
+  broadcast_game_over();
+  spectator_close_all();
+  record_result();
+
+  // Every task has exited and every message has been sent, so the match's
+  // memory can go all at once. A room keeps it for its next match.
+  if(room_index == -1) {
+    broadcast_set_arena(NULL);
+    scheduler_set_arena(NULL);
+    arena_close(&match_arena);
   }
-  return NULL;
 }
 
 /**
- * Convert a board row number to a screen position
- * \param   row   The board row number to convert
- * \return        A corresponding row number for the ncurses screen
+ * In builds that count allocations, print how many the game made while
+ * running ticks and drawing frames. Once a match is under way there should be
+ * none.
  */
-int screen_row(int row) {
-  return 2 + row;
+void report_allocs() {
+  if(!alloc_counting()) return;
+  uint64_t frames = stats_get(&frames_drawn);
+  fprintf(stderr, "Allocations: %llu in %u ticks, %llu in %llu frames after the first\n",
+          (unsigned long long)stats_get(&game_stats.allocs), game.game_tick,
+          (unsigned long long)stats_get(&frame_allocs), (unsigned long long)(frames > 0 ? frames - 1 : 0));
 }
 
 /**
- * Convert a board column number to a screen position
- * \param   col   The board column number to convert
- * \return        A corresponding column number for the ncurses screen
+ * Run in a thread to answer monitoring scrapes on a dedicated server. Scrapes
+ * are read and answered a piece at a time without blocking, so a slow scraper
+ * never holds up a tick.
  */
-int screen_col(int col) {
-  return 2 + col;
+void serve_metrics() {
+  while(running) {
+    metrics_serve(write_metrics);
+    task_sleep(METRICS_INTERVAL);
+  }
+
+  // A room keeps its socket for the next match
+  if(room_index == -1) metrics_close();
 }
 
 /**
- * Print the rules of the game
+ * Handle a signal by ending the match, so the program exits the usual way.
  */
-void print_rules() {
-  fprintf(stdout, "\nMultiplayer Snake Rules!\n\n");
-  fprintf(stdout, "Usage for Player 1: ./snake\n");
-  fprintf(stdout, "Usage for Player 2: ./snake <Player 1's Machine Name> <port number>\n\n");
-  fprintf(stdout, "The player with the longest snake wins!\n\n");
-  fprintf(stdout, "Don't forget that:\n");
-  fprintf(stdout, "Eat the apples to become longer (before your opponent does!)\n");
-  fprintf(stdout, "If you collide with the board edges, the game is over.\n");
-  fprintf(stdout, "If you collide with your opponent or viceversa, the game is over.\n");
-  fprintf(stdout, "Your oponent might want to make you collide if you have a shorter snake.\n");
-  fprintf(stdout, "When the game is over, the player with the longest snake wins!\n");
+void stop_running(int signal) {
+  running = false;
 }
 
 /**
- * Initialize the board display by printing the title and edges
+ * Create a scheduler task and give it a name for monitoring and traces.
+ *
+ * \param handle  The handle for this task will be written to this location.
+ * \param fn      The new task will run this function.
+ * \param name    The name traces show for the task
  */
-void init_display() {
-  // Print Title Line
-  move(screen_row(-2), screen_col(BOARD_WIDTH/2 - 5));
-  attron(COLOR_PAIR(TEXT_PAIR));
-  addch(ACS_DIAMOND);
-  addch(ACS_DIAMOND);
-  printw(" Snake! ");
-  addch(ACS_DIAMOND);
-  addch(ACS_DIAMOND);
-  attroff(COLOR_PAIR(TEXT_PAIR));
-
-  // Print corners
-  attron(COLOR_PAIR(BORDER_PAIR));
-  mvaddch(screen_row(-1), screen_col(-1), ACS_ULCORNER);
-  mvaddch(screen_row(-1), screen_col(BOARD_WIDTH), ACS_URCORNER);
-  mvaddch(screen_row(BOARD_HEIGHT), screen_col(-1), ACS_LLCORNER);
-  mvaddch(screen_row(BOARD_HEIGHT), screen_col(BOARD_WIDTH), ACS_LRCORNER);
+void start_task(task_t* handle, task_fn_t fn, const char* name) {
+  task_create(handle, fn);
+  task_set_name(*handle, name);
+}
 
-  // Print top and bottom edges
-  for(int col=0; col<BOARD_WIDTH; col++) {
-    mvaddch(screen_row(-1), screen_col(col), ACS_HLINE);
-    mvaddch(screen_row(BOARD_HEIGHT), screen_col(col), ACS_HLINE);
+/**
+ * Batch the writes to spectators through io_uring if SNAKE_IO asks for it.
+ */
+void choose_spectator_io() {
+  const char* io = getenv("SNAKE_IO");
+  if(io != NULL && strcmp(io, "uring") == 0 && !spectator_use_uring()) {
+    perror("io_uring is not available, so spectators are sent to one at a time");
   }
+}
 
-  // Print left and right edges
-  for(int row=0; row<BOARD_HEIGHT; row++) {
-    mvaddch(screen_row(row), screen_col(-1), ACS_VLINE);
-    mvaddch(screen_row(row), screen_col(BOARD_WIDTH), ACS_VLINE);
-  }
+/**
+ * Play a match on a dedicated server once its players have joined. Only the
+ * game and the network tasks run, and the result is printed when the match
+ * ends.
+ *
+ * \param metrics  Should monitoring scrapes be answered during the match?
+ */
+void play_headless_match(bool metrics) {
+  task_t update_game_thread;
+  task_t serve_connections_thread;
+  task_t report_stats_thread;
+  task_t serve_metrics_thread;
+
+  reset_board();
+  start_match();
+
+  start_task(&update_game_thread, update_game, "update game");
+  start_task(&serve_connections_thread, serve_connections, "serve connections");
+  start_task(&report_stats_thread, report_stats, "report stats");
+  if(metrics) start_task(&serve_metrics_thread, serve_metrics, "serve metrics");
+  task_wait(update_game_thread);
+  task_wait(serve_connections_thread);
+  task_wait(report_stats_thread);
+  if(metrics) task_wait(serve_metrics_thread);
+
+  end_match();
 
-  attroff(COLOR_PAIR(BORDER_PAIR));
-  // Refresh the display
-  refresh();
+  score_counter();
+  if(room_index != -1) printf("Room %d: ", room_index);
+  printf("Game over after %u ticks. Player 1 score: %d, Player 2 score: %d\n",
+         game.game_tick, snake1_score, snake2_score);
+  fflush(stdout);
+  report_allocs();
 }
 
-/*
- * Determine the scores and winner by comparing the lengths of the snakes and updates end and score variables accordingly.
+/**
+ * Run a single match on a dedicated server.
  */
-void score_counter() {
-   for(int r = 0; r < BOARD_HEIGHT; r++) {
-    for(int c = 0; c < BOARD_WIDTH; c++) {
-      int cur = board[r][c];
-      // Found snake1, find tail (largest number less than 625).
-      if(cur > snake1_score && cur < 625) {
-        snake1_score = cur;
-      }
-      // Found snake2, find tail (largest number greater than 624).
-      if(cur > snake2_score && cur > 624) {
-        snake2_score = cur;
-      }
-    }
+void run_headless() {
+  // Serve metrics for monitoring if SNAKE_METRICS says where
+  const char* metrics_address = getenv("SNAKE_METRICS");
+  bool metrics = metrics_address != NULL && metrics_address[0] != '\0';
+  if(metrics && !metrics_open(metrics_address)) {
+    perror("Failed to open metrics socket");
+    metrics = false;
   }
-  // Remove initial length to determine score.
-  snake2_score = snake2_score - 624 - INIT_snake_LENGTH;
-  snake1_score = snake1_score - INIT_snake_LENGTH;
 
+  scheduler_init();
+  play_headless_match(metrics);
+  close_results();
+}
 
-    if(end == 1) {
-    snake2_score++;
-    } else if(end == 2) {
-    snake1_score++;
+/**
+ * Set a room up for its next match. The players' connections are closed,
+ * and everything the last match changed is put back the way it started,
+ * but the memory it used is kept.
+ */
+void recycle_room() {
+  struct sockaddr_in no_addr = {0};
+  for(int i=0; i<2; i++) {
+    player_conn_t* player = &players[i];
+
+    // The UDP receive thread leaves the player alone before its token goes
+    atomic_store_explicit(&player->joined, false, memory_order_release);
+    if(player->fd != -1) {
+      // The receive thread may still be blocked reading
+      shutdown(player->fd, SHUT_RDWR);
+      pthread_join(player->receive_thread, NULL);
+      close(player->fd);
+      player->fd = -1;
     }
-
-  // Compare scores and determine winner.
-  if(snake1_score > snake2_score) {
-    end = 1 ;
-  } else if (snake2_score > snake1_score) {
-    end = 2;
+    player->token = 0;
+    player->lost = false;
+    player->keyframe_wanted = false;
+    player->ping_sent_us = 0;
+    player->turn_sent_us = 0;
+    player->udp_seq = 0;
+    player->commands_applied = 0;
+    seqlock_write(&player->udp_lock, &player->udp_addr, &no_addr, sizeof(no_addr));
   }
+
+  memset(streams, 0, sizeof(streams));
+  memset(&sent_minimap, 0, sizeof(sent_minimap));
+  minimap_tick = 0;
+  stats_set(&game_stats.allocs, 0);
+  running = true;
 }
 
 /**
- * Show a game over message, winner message, and wait for a key press.
+ * Work out where a room serves its metrics. A Unix socket's path gets the
+ * room's number added after a '.', like its trace, and a port gets the
+ * room's number added to it, so room 0 uses the port SNAKE_METRICS names.
+ *
+ * \param buf      The address is written here
+ * \param size     The size of buf
+ * \param address  SNAKE_METRICS
+ * \param index    The room's number
  */
-void end_game() {
-  attron(COLOR_PAIR(TEXT_PAIR));
-  mvprintw(screen_row(BOARD_HEIGHT/2)-1, screen_col(BOARD_WIDTH/2)-6, "            ");
-  mvprintw(screen_row(BOARD_HEIGHT/2),   screen_col(BOARD_WIDTH/2)-6, " Game Over! ");
-  mvprintw(screen_row(BOARD_HEIGHT/2)+1, screen_col(BOARD_WIDTH/2)-6, "            ");
-  attroff(COLOR_PAIR(TEXT_PAIR));
-  score_counter();
-  if(end == 1) {
-    attron(COLOR_PAIR(SNAKE1_PAIR));
-    mvprintw(screen_row(BOARD_HEIGHT/2)+1, screen_col(BOARD_WIDTH/2)-6, "Player 1 Wins");
-    attroff(COLOR_PAIR(SNAKE1_PAIR));
-  } else if(end == 2) {
-    attron(COLOR_PAIR(SNAKE2_PAIR));
-    mvprintw(screen_row(BOARD_HEIGHT/2)+1, screen_col(BOARD_WIDTH/2)-6, "Player 2 Wins");
-    attroff(COLOR_PAIR(SNAKE2_PAIR));
-  } else {
-    attron(COLOR_PAIR(TEXT_PAIR));
-    mvprintw(screen_row(BOARD_HEIGHT/2)+1, screen_col(BOARD_WIDTH/2)-2, "Tie");
-    attroff(COLOR_PAIR(TEXT_PAIR));
-  }
-  attron(COLOR_PAIR(TEXT_PAIR));
-  mvprintw(screen_row(BOARD_HEIGHT/2)+3, screen_col(BOARD_WIDTH/2)-11, "Press any key to exit.");
-  attroff(COLOR_PAIR(TEXT_PAIR));
-  refresh();
-  timeout(-1);
-  task_readchar();
+void room_metrics_address(char* buf, size_t size, const char* address, int index) {
+  if(strchr(address, '/') != NULL) {
+    snprintf(buf, size, "%s.%d", address, index);
+    return;
+  }
+  const char* colon = strrchr(address, ':');
+  const char* port = colon != NULL ? colon + 1 : address;
+  snprintf(buf, size, "%.*s%d", (int)(port - address), address, atoi(port) + index);
 }
 
 /**
- * Run in a thread to draw the current state of the game board.
+ * Run in each of a dedicated server's rooms, in a process of its own. Before
+ * any players arrive, the room sets up the stacks of the tasks a match runs,
+ * the board, and the memory messages are encoded into. It then plays a match
+ * whenever the lobby hands it two players, and sets itself up again after
+ * each one instead of starting over.
  */
-void draw_board() {
-  while(running) {
-    // Loop over cells of the game board
-    int cur;
-    for(int r=0; r<BOARD_HEIGHT; r++) {
-      for(int c=0; c<BOARD_WIDTH; c++) {
-        cur = board[r][c];
-        if(cur == 0) {  // Draw blank spaces
-          attron(COLOR_PAIR(EMPTY_PAIR));
-          mvaddch(screen_row(r), screen_col(c), ' ');
-          attron(COLOR_PAIR(EMPTY_PAIR));
-        } else if(cur > 0 && cur < 625) {  // Draw snake
-          attron(COLOR_PAIR(SNAKE1_PAIR));
-          mvaddch(screen_row(r), screen_col(c), SNAKE_CHAR);
-          attroff(COLOR_PAIR(SNAKE1_PAIR));
-        } else if(cur >= 625) {
-          attron(COLOR_PAIR(SNAKE2_PAIR));
-          mvaddch(screen_row(r), screen_col(c), SNAKE_CHAR);
-          attroff(COLOR_PAIR(SNAKE2_PAIR));
-        } else {  // Draw apple spinner character
-          char spinner_chars[] = {'|', '/', '-', '\\'};
-          attron(COLOR_PAIR(APPLE_PAIR));
-          mvaddch(screen_row(r), screen_col(c), spinner_chars[abs(cur % 4)]);
-          attroff(COLOR_PAIR(APPLE_PAIR));
-        }
-      }
-    }
+void run_room(int index, int channel, int datagrams) {
+  room_index = index;
+  room_channel = channel;
+  room_datagrams = datagrams;
+  lobby = false;
+
+  // Each room writes its own trace
+  const char* trace_path = getenv("SNAKE_TRACE");
+  if(trace_enabled && trace_path != NULL) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s.%d", trace_path, index);
+    trace_set_path(path);
+  }
+
+  // Each room serves its own metrics too
+  const char* metrics_address = getenv("SNAKE_METRICS");
+  if(metrics_address != NULL && metrics_address[0] != '\0') {
+    char address[1024];
+    room_metrics_address(address, sizeof(address), metrics_address, index);
+    room_metrics = metrics_open(address);
+    if(!room_metrics) perror("Failed to open a room's metrics socket");
+  }
 
-    // Draw the scores for player 1 and player 2 (score color corresponding to snake color)
-    score_counter();
-    attron(COLOR_PAIR(TEXT_PAIR));
-    mvprintw(screen_row(-2), screen_col(-1), " P1 Score:\r");
-    mvprintw(screen_row(-2), screen_col(BOARD_WIDTH-18), "     P2 Score:\r");
-    attroff(COLOR_PAIR(TEXT_PAIR));
-    attron(COLOR_PAIR(SNAKE1_PAIR));
-    mvprintw(screen_row(-2), screen_col(9), " %03d       \r", snake1_score);
-    attroff(COLOR_PAIR(SNAKE1_PAIR));
-    attron(COLOR_PAIR(SNAKE2_PAIR));
-    mvprintw(screen_row(-2), screen_col(BOARD_WIDTH-4), " %03d \r", snake2_score);
-    attron(COLOR_PAIR(SNAKE2_PAIR));
+  // Only the lobby accepts connections, including any it was still holding
+  // when this room was restarted
+  close(server_socket_fd);
+  for(int i=0; i<num_pending; i++) {
+    close(pending_fds[i]);
+  }
+  for(int i=0; i<num_waiting; i++) {
+    close(waiting_fds[i]);
+  }
+  num_pending = 0;
+  num_waiting = 0;
 
-    // Refresh the display
-    refresh();
+  scheduler_init();
+  if(arena_open(&match_arena, MATCH_ARENA_SIZE) == -1) {
+    perror("Failed to reserve memory for a room");
+    exit(2);
+  }
+  scheduler_set_arena(&match_arena);
+  broadcast_set_arena(&match_arena);
+  scheduler_reserve(ROOM_TASKS);
+  arena_prefault(&match_arena, ROOM_PREFAULT);
+  recycle_room();
+  reset_board();
+
+  // Each room has its own io_uring, and its own hold on the results file, so
+  // rooms take turns adding to it
+  choose_spectator_io();
+  open_results();
+
+  if(udp_socket_fd != -1) {
+    pthread_t udp_receive;
+    pthread_create(&udp_receive, NULL, receive_udp_thrd, NULL);
+  }
 
-    // Sleep for a while before drawing the board again
-    task_sleep(DRAW_BOARD_INTERVAL);
+  while(true) {
+    wait_for_players(0);
+    room_send(room_channel, ROOM_STARTED, -1, NULL);
+    room_playing = true;
+    play_headless_match(room_metrics);
+    room_playing = false;
+    recycle_room();
+    room_send(room_channel, ROOM_READY, -1, NULL);
   }
 }
 
 /**
- * Run in a thread to process player 1 input.
+ * Pass each waiting datagram on to the room whose player sent it.
  */
-void read_input1() {
-  while(running) {
-    // Read a character, potentially blocking this thread until a key is pressed
-    int key = task_readchar();
-
-    // Make sure the input was read correctly
-    if(key == ERR) {
-      running = false;
-      fprintf(stderr, "ERROR READING INPUT\n");
-    }
-
-    // Handle the key press
-    if(key == KEY_UP && snake1_dir != DIR_SOUTH) {
-      snake1_dir = DIR_NORTH;
-    } else if(key == KEY_RIGHT && snake1_dir != DIR_WEST) {
-      snake1_dir = DIR_EAST;
-    } else if(key == KEY_DOWN && snake1_dir != DIR_NORTH) {
-      snake1_dir = DIR_SOUTH;
-    } else if(key == KEY_LEFT && snake1_dir != DIR_EAST) {
-      snake1_dir = DIR_WEST;
-    } else if(key == 'q') {
-      running = false;
+void forward_datagrams() {
+  udp_input_t packet;
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  ssize_t rc;
+  while((rc = recvfrom(udp_socket_fd, &packet, sizeof(packet), MSG_DONTWAIT,
+                       (struct sockaddr*)&addr, &addr_len)) != -1) {
+    if(udp_input_valid(&packet, rc) && token_room(packet.token) < room_pool.count) {
+      room_send_datagram(room_pool.rooms[token_room(packet.token)].datagrams, &addr, &packet, rc);
     }
-
+    addr_len = sizeof(addr);
   }
 }
 
 /**
- * Run in a thread to process player 2 input.
+ * Act on what a room has told the lobby: that its match has started or is
+ * over, or that it couldn't seat a player, who is sent to another room.
  */
-void read_input2() {
-  while(running) {
-    // Read a character, potentially blocking this thread until a key is pressed
-    int key = task_readchar();
-
-    // Make sure the input was read correctly
-    if(key == ERR) {
-      running = false;
-      fprintf(stderr, "ERROR READING INPUT\n");
-    }
-
-    // Handle the key press
-    if(key == KEY_UP && snake2_dir != DIR_SOUTH) {
-      snake2_dir = DIR_NORTH;
-    } else if(key == KEY_RIGHT && snake2_dir != DIR_WEST) {
-      snake2_dir = DIR_EAST;
-    } else if(key == KEY_DOWN && snake2_dir != DIR_NORTH) {
-      snake2_dir = DIR_SOUTH;
-    } else if(key == KEY_LEFT && snake2_dir != DIR_EAST) {
-      snake2_dir = DIR_WEST;
-    } else if(key == 'q') {
-      running = false;
+void hear_from_room(int index) {
+  room_msg_t msg;
+  int fd;
+  int rc;
+  while((rc = room_receive(room_pool.rooms[index].channel, &msg, &fd, false)) == 1) {
+    if(msg.type == ROOM_STARTED) {
+      room_pool_started(&room_pool, index);
+    } else if(msg.type == ROOM_READY) {
+      room_pool_ready(&room_pool, index);
+      seat_waiting_players();
+    } else if(msg.type == ROOM_CONNECTION && fd != -1) {
+      send_to_room(fd, &msg.hello);
     }
+  }
 
-    // Write the direction of snake2 to the server.
-    if(write(socket_fd, &snake2_dir, sizeof(int)) <= 0) {
-      perror("Failed to write snake2_dir\n");
+  // The room's process has exited, so another takes its place
+  if(rc == -1) {
+    fprintf(stderr, "Room %d exited, so it is being restarted\n", index);
+    if(room_pool_restart(&room_pool, index) == -1) {
+      perror("Failed to restart room");
       exit(2);
     }
-
   }
 }
 
 /**
- * Run in a thread to move player 1's snake around on the board
+ * Run a dedicated server's lobby, which keeps a pool of rooms ready and plays
+ * no matches itself. It accepts every connection, waits for its hello, and
+ * passes it on to the room it belongs in, along with the datagrams of that
+ * room's players. This runs until the server is stopped.
+ *
+ * \param count  The number of rooms
  */
-void update_snake1() {
-  while(running) {
-    // "Age" each existing segment of the snake
-    for(int r=0; r<BOARD_HEIGHT; r++) {
-      for(int c=0; c<BOARD_WIDTH; c++) {
-        if(board[r][c] == 1) {  // Found the head of the snake. Save position
-          snake1_row = r;
-          snake1_col = c;
-        }
-
-        // Add 1 to the age of the snake segment
-        if(board[r][c] > 0 && board[r][c] < 625) {
-          board[r][c]++;
-
-          // Remove the snake segment if it is too old
-          if(board[r][c] > snake1_length) {
-            board[r][c] = 0;
-          }
-        }
-      }
-    }
-
-    // Move the snake into a new space
-    if(snake1_dir == DIR_NORTH) {
-      snake1_row--;
-    } else if(snake1_dir == DIR_SOUTH) {
-      snake1_row++;
-    } else if(snake1_dir == DIR_EAST) {
-      snake1_col++;
-    } else if(snake1_dir == DIR_WEST) {
-      snake1_col--;
-    }
-
-
-    // Check for edge collisions
-    if(snake1_row < 0 || snake1_row >= BOARD_HEIGHT || snake1_col < 0 || snake1_col >= BOARD_WIDTH) {
-      running = false;
-      // Add a key to the input buffer so the read_input thread can exit
-      ungetch(0);
-      return;
-    }
+void run_lobby(int count) {
+  lobby = true;
+  if(room_pool_open(&room_pool, count, run_room) == -1) {
+    perror("Failed to start rooms");
+    exit(2);
+  }
 
-    // Check for snake collisions
-    if(board[snake1_row][snake1_col] > 0) {
-      running = false;
-      // Add a key to the input buffer so the read_input thread can exit
-      ungetch(0);
-      return;
+  struct pollfd fds[2 + MAX_ROOMS + MAX_PENDING];
+  while(running) {
+    // Wait for connections, hellos, datagrams, and news from the rooms
+    int n = 0;
+    fds[n++] = (struct pollfd){ .fd = server_socket_fd, .events = POLLIN };
+    fds[n++] = (struct pollfd){ .fd = udp_socket_fd, .events = POLLIN };
+    for(int i=0; i<room_pool.count; i++) {
+      fds[n++] = (struct pollfd){ .fd = room_pool.rooms[i].channel, .events = POLLIN };
     }
-
-    // Check for apple collisions
-    if(board[snake1_row][snake1_col] < 0) {
-      // snake gets longer
-      snake1_length++;
+    for(int i=0; i<num_pending; i++) {
+      fds[n++] = (struct pollfd){ .fd = pending_fds[i], .events = POLLIN };
     }
-
-    // Add the snake's new position
-    board[snake1_row][snake1_col] = 1;
-
-    // Once the server board has been updated, write the board to the client.
-    if(write(client_socket_fd, &board, sizeof(int) * BOARD_HEIGHT * BOARD_WIDTH) <= 0) {
-      running = false;
-      ungetch(0);
+    if(poll(fds, n, HELLO_POLL_INTERVAL) == -1 && errno != EINTR) {
+      perror("poll");
+      exit(2);
     }
 
-    // Update the snake movement speed to deal with rectangular cursors
-    if(snake1_dir == DIR_NORTH || snake1_dir == DIR_SOUTH) {
-      task_sleep(snake_VERTICAL_INTERVAL);
-    } else {
-      task_sleep(snake_HORIZONTAL_INTERVAL);
+    accept_connections();
+    if(fds[1].revents != 0) forward_datagrams();
+    for(int i=0; i<room_pool.count; i++) {
+      if(fds[2 + i].revents != 0) hear_from_room(i);
     }
   }
 }
 
 /**
- * Run in a thread to move player 1's snake around on the board
+ * Draw every tick of a recorded match as fast as possible, then print what
+ * that cost: the bytes and write calls sent to the terminal per frame, and
+ * the time per frame. Set SNAKE_RENDERER to measure the other renderer.
+ * Write counts come from /proc, so they are only available on Linux.
  */
-void update_snake2() {
-  while(running) {
-    // "Age" each existing segment of the snake
-    for(int r=0; r<BOARD_HEIGHT; r++) {
-      for(int c=0; c<BOARD_WIDTH; c++) {
-        if(board[r][c] == 625) {  // Found the head of the snake. Save position
-          snake2_row = r;
-          snake2_col = c;
-        }
+void replay_render_benchmark() {
+  size_t start_writes;
+  size_t start_bytes;
+  bool counted = write_counts(&start_writes, &start_bytes);
+  uint64_t start = time_us();
+
+  reset_frame();
+  size_t frames = 0;
+  uint32_t first_tick = game.game_tick;
+  do {
+    if(draw_frame()) frames++;
+  } while(replay_step());
+
+  uint64_t elapsed = time_us() - start;
+  size_t end_writes;
+  size_t end_bytes;
+  counted = counted && write_counts(&end_writes, &end_bytes);
+
+  renderer->end();
+  endwin();
+
+  if(frames == 0) frames = 1;
+  fprintf(stderr, "Renderer: %s\n", renderer->name);
+  fprintf(stderr, "Drew %zu frames over %u ticks in %.1f ms (%.1f us/frame)\n",
+          frames, game.game_tick - first_tick, elapsed / 1000.0, (double)elapsed / frames);
+  if(counted) {
+    fprintf(stderr, "Bytes per frame: %.1f\n", (double)(end_bytes - start_bytes) / frames);
+    fprintf(stderr, "Write calls per frame: %.2f\n", (double)(end_writes - start_writes) / frames);
+  } else {
+    fprintf(stderr, "Write counts are not available on this system\n");
+  }
+}
 
-        // Add 1 to the age of the snake segment
-        if(board[r][c] > 624) {
-          board[r][c]++;
+// Entry point: Sets up the main server, waits for client to connect, creates jobs, then runs the scheduler
+int main(int argc, char** argv) {
 
-          // Remove the snake segment if it is too old
-          if((board[r][c] - 624) > snake2_length) {
-            board[r][c] = 0;
-          }
-        }
-      }
-    }
+  // Is this process playing back a recorded match?
+  bool replaying = argc >= 3 && argc <= 5 && strcmp(argv[1], "replay") == 0;
 
-    // Move the snake into a new space
-    if(snake2_dir == DIR_NORTH) {
-      snake2_row--;
-    } else if(snake2_dir == DIR_SOUTH) {
-      snake2_row++;
-    } else if(snake2_dir == DIR_EAST) {
-      snake2_col++;
-    } else if(snake2_dir == DIR_WEST) {
-      snake2_col--;
-    }
+  // Is this replay only being drawn to measure the renderer?
+  bool render_benchmark = false;
 
-    // Check for edge collisions
-    if(snake2_row < 0 || snake2_row >= BOARD_HEIGHT || snake2_col < 0 || snake2_col >= BOARD_WIDTH) {
-      running = false;
-      // Add a key to the input buffer so the read_input thread can exit
-      ungetch(0);
-      return;
-    }
+  // Is this client only watching the match?
+  spectating = !replaying && argc == 4 && strcmp(argv[3], "watch") == 0;
 
-    // Check for snake collisions
-    if(board[snake2_row][snake2_col] > 0) {
-      running = false;
-      // Add a key to the input buffer so the read_input thread can exit
-      ungetch(0);
-      return;
-    }
+  // Is this a dedicated server, where both players connect over the network?
+  headless = (argc == 2 || argc == 3) && strcmp(argv[1], "serve") == 0;
 
-    // Check for apple collisions
-    if(board[snake2_row][snake2_col] < 0) {
-      // snake gets longer
-      snake2_length++;
-    }
+  // Is this a look at the results of earlier matches?
+  bool showing_results = (argc == 2 || argc == 3) && strcmp(argv[1], "results") == 0;
 
-    // Add the snake's new position
-    board[snake2_row][snake2_col] = 625;
+  // Is this client joining the match as a player?
+  bool joining = !replaying && !headless && !showing_results && argc == 3;
 
-    // Once the server board has been updated, write the board to the client.
-    if(write(client_socket_fd, &board, sizeof(int) * BOARD_HEIGHT * BOARD_WIDTH) <= 0) {
-      running = false;
-      ungetch(0);
-    }
+  // Should statistics be shown, or logged? Servers always gather them, since
+  // their clients show the server's tick times.
+  const char* stats = getenv("SNAKE_STATS");
+  const char* stats_log = getenv("SNAKE_STATS_LOG");
+  show_stats = !replaying && stats != NULL && stats[0] != '\0' && strcmp(stats, "0") != 0;
+  bool gather_stats = show_stats || (stats_log != NULL && stats_log[0] != '\0');
 
-    // Update the snake movement speed to deal with rectangular cursors
-    if(snake2_dir == DIR_NORTH || snake2_dir == DIR_SOUTH) {
-      task_sleep(snake_VERTICAL_INTERVAL);
-    } else {
-      task_sleep(snake_HORIZONTAL_INTERVAL);
-    }
-  }
-}
+  // Record what the scheduler and the game do to a trace file, if asked to
+  const char* trace_path = getenv("SNAKE_TRACE");
+  if(trace_path != NULL && trace_path[0] != '\0') {
+    trace_open(trace_path);
 
-/**
- * Run in a thread to update all the apples on the board.
- */
-void update_apples() {
-  while(running) {
-    // "Age" each apple
-    for(int r=0; r<BOARD_HEIGHT; r++) {
-      for(int c=0; c<BOARD_WIDTH; c++) {
-        if(board[r][c] < 0) {  // Add one to each apple cell
-          board[r][c]++;
-        }
-      }
-    }
-    task_sleep(APPLE_UPDATE_INTERVAL);
+    // The trace is written at exit, so end the match cleanly when stopped
+    signal(SIGINT, stop_running);
+    signal(SIGTERM, stop_running);
   }
-}
 
-/**
- * Run in a thread to generate apples on the board.
- */
-void generate_apple() {
-  while(running) {
-    bool inserted = false;
-    // Repeatedly try to insert an apple at a random empty cell
-    while(!inserted) {
-      int r = rand() % BOARD_HEIGHT;
-      int c = rand() % BOARD_WIDTH;
-
-      // If the cell is empty, add an apple
-      if(board[r][c] == 0) {
-        // Pick a random age between apple_age/2 and apple_age*1.5
-        // Negative numbers represent apples, so negate the whole value
-        board[r][c] = -((rand() % apple_age) + apple_age / 2);
-        inserted = true;
-      }
-    }
-    task_sleep(GENERATE_APPLE_INTERVAL);
+  // Spin for the end of each sleep instead of leaving it all to the kernel,
+  // which wakes tasks more punctually at the cost of some CPU
+  const char* spin_us = getenv("SNAKE_SPIN_US");
+  if(spin_us != NULL && atoi(spin_us) > 0) {
+    scheduler_set_spin(atoi(spin_us) * 1000ull);
   }
-}
 
-// Entry point: Sets up the main server, waits for client to connect, creates jobs, then runs the scheduler
-int main(int argc, char** argv) {
+  // Results are printed without starting a game
+  if(showing_results) {
+    print_results(argc == 3 ? argv[2] : NULL);
+    exit(0);
+  }
 
   // Set up server
-  if(argc == 1) {
+  if(argc == 1 || headless) {
 
-    // Starting the game case
+    // Starting the game case. A dedicated server can be given a port.
     unsigned short port = 0;
+    if(headless && argc == 3) {
+      port = atoi(argv[2]);
+    }
     server_socket_fd = server_socket_open(&port);
     if(server_socket_fd == -1) {
       perror("Server socket was not opened");
       exit(2);
     }
 
-    // Start listening for connections, with a maximum of one queued connection
-    if(listen(server_socket_fd, 1)) {
+    // Players can ask to send and receive over UDP on the same port number.
+    // Without it, everyone uses TCP.
+    udp_socket_fd = udp_socket_open(port);
+    if(udp_socket_fd == -1) {
+      perror("UDP socket was not opened");
+    }
+
+    // Start listening for connections. Spectators can connect at any time, so
+    // allow plenty of them to queue up.
+    if(listen(server_socket_fd, SOMAXCONN)) {
       perror("listen failed");
       exit(2);
     }
 
-    // Print server's port number
+    // Make room for lots of spectators, and don't let one that disconnects
+    // mid-write kill the server
+    raise_fd_limit();
+    signal(SIGPIPE, SIG_IGN);
+
+    // Print server's port number. Whatever started a dedicated server may be
+    // waiting to read it from a pipe.
     printf("Server listening on port %u\n", port);
+    fflush(stdout);
 
-    // Accept client's connection
-    client_socket_fd = server_socket_accept(server_socket_fd);
-    if(client_socket_fd == -1) {
-      perror("accept failed");
-      exit(2);
+    // Connections are accepted without blocking, and wait for their hello
+    // alongside the rest, so one that sends nothing can't hold up the server
+    fcntl(server_socket_fd, F_SETFL, fcntl(server_socket_fd, F_GETFL) | O_NONBLOCK);
+
+    // Player 1 plays on this machine unless this is a dedicated server
+    for(int i=0; i<2; i++) {
+      players[i].fd = -1;
+      pthread_mutex_init(&players[i].inputs_lock, NULL);
+    }
+
+    // A dedicated server can keep rooms ready, and play matches in them
+    // until it is stopped
+    const char* rooms = getenv("SNAKE_ROOMS");
+    if(headless && rooms != NULL && atoi(rooms) > 0) {
+      run_lobby(atoi(rooms) < MAX_ROOMS ? atoi(rooms) : MAX_ROOMS);
+      return 0;
     }
 
-    // Create thread to continuously read the keys of the the client
-    pthread_t server_receive_dir;
-    pthread_create(&server_receive_dir, NULL, receive_dir_thrd, NULL);
+    choose_spectator_io();
+    if(!headless) local_player_name(players[0].name);
+
+    // Keep the results of the match, unless SNAKE_RESULTS turns that off
+    open_results();
+    wait_for_players(headless ? 0 : 1);
+
+    // Start reading datagrams once every player has a token to send
+    if(udp_socket_fd != -1) {
+      pthread_t udp_receive;
+      pthread_create(&udp_receive, NULL, receive_udp_thrd, NULL);
+    }
   }
 
   // Player wants to read the rules
@@ -603,20 +3293,90 @@ int main(int argc, char** argv) {
     exit(1);
   }
 
-  // Player 2 connecting to the game case
-  else if(argc == 3) {
+  // Playing back a recorded match
+  else if(replaying) {
+    if(replay_open(&replay, argv[2]) == -1) {
+      perror("Failed to open replay");
+      exit(2);
+    }
+
+    // The recorded state has to fit this build of the game
+    if(replay.header->board_width != BOARD_WIDTH || replay.header->board_height != BOARD_HEIGHT ||
+       replay.header->tick_interval != GAME_TICK_INTERVAL ||
+       replay.header->state_size != sizeof(game_keyframe_t)) {
+      fprintf(stderr, "This replay was recorded with a different game configuration.\n");
+      exit(2);
+    }
+
+    // Fast replays are simulated without being displayed
+    bool fast = strcmp(argv[argc-1], "fast") == 0;
+    bool codec = strcmp(argv[argc-1], "codec") == 0;
+    bool fork_benchmark = strcmp(argv[argc-1], "fork") == 0;
+    render_benchmark = strcmp(argv[argc-1], "render") == 0;
+    uint32_t start_tick = 0;
+    if(argc == 5 || (argc == 4 && !fast && !codec && !fork_benchmark && !render_benchmark)) {
+      start_tick = atoi(argv[3]);
+    }
+
+    if(fast) {
+      replay_benchmark(start_tick);
+      replay_close(&replay);
+      exit(0);
+    }
+
+    // Measure the keyframe codec on every board of the match
+    if(codec) {
+      replay_codec_benchmark(start_tick);
+      replay_close(&replay);
+      exit(0);
+    }
+
+    // Measure forking the game for a look ahead, both ways
+    if(fork_benchmark) {
+      replay_fork_benchmark(start_tick);
+      replay_close(&replay);
+      exit(0);
+    }
+
+    replay_goto(start_tick);
+  }
+
+  // A remote player or a spectator connecting to the game case
+  else if(joining || spectating) {
 
     // Read command line arguments
-    char* server_name = argv[1];
-    unsigned short port = atoi(argv[2]);
+    server_name = argv[1];
+    server_port = atoi(argv[2]);
+
+    // A write to a dropped connection should fail, not kill the client
+    signal(SIGPIPE, SIG_IGN);
 
     // Connect to the server
-    socket_fd = socket_connect(server_name, port);
+    socket_fd = socket_connect(server_name, server_port);
     if(socket_fd == -1) {
       perror("Failed to connect");
       exit(2);
     }
 
+    // Tell the server whether we are playing or watching
+    hello_t hello = {
+      .magic = PROTOCOL_MAGIC,
+      .role = spectating ? ROLE_SPECTATOR : ROLE_PLAYER
+    };
+    local_player_name(hello.name);
+    if(write_better(socket_fd, &hello, sizeof(hello)) == -1) {
+      perror("Failed to send hello");
+      exit(2);
+    }
+
+    // Players can send their input and receive updates over UDP instead,
+    // which the connection is still kept open alongside
+    const char* transport = getenv("SNAKE_TRANSPORT");
+    if(!spectating && transport != NULL && strcmp(transport, "udp") == 0) {
+      udp_fd = udp_socket_connect(server_name, server_port);
+      if(udp_fd == -1) perror("Failed to open UDP socket");
+    }
+
     // Create thread to continuously read the board of the the server
     pthread_t client_receive;
     pthread_create(&client_receive, NULL, receive_board_thrd, NULL);
@@ -625,96 +3385,133 @@ int main(int argc, char** argv) {
   } else {
     fprintf(stderr, "Usage for Player 1: %s\n", argv[0]);
     fprintf(stderr, "Usage for Player 2: %s <Player 1's Machine Name> <port number>]\n", argv[0]);
+    fprintf(stderr, "Usage for Dedicated Servers: %s serve [port number]\n", argv[0]);
+    fprintf(stderr, "Usage for Spectators: %s <Player 1's Machine Name> <port number> watch\n", argv[0]);
+    fprintf(stderr, "Usage for Replays: %s replay <replay file> [start tick] [fast|render|codec|fork]\n", argv[0]);
+    fprintf(stderr, "Usage for Results: %s results [player name]\n", argv[0]);
     fprintf(stderr, "Usage for Rules: %s rules\n", argv[0]);
     exit(1);
   }
 
-  // Initialize the ncurses window
+  // A dedicated server has no display, so it only runs the game and network
+  if(headless) {
+    run_headless();
+    exit(0);
+  }
+
+  // Pick the renderer named by SNAKE_RENDERER, if there is one
+  const char* renderer_name = getenv("SNAKE_RENDERER");
+  if(renderer_name != NULL && strcmp(renderer_name, ansi_renderer.name) == 0) {
+    renderer = &ansi_renderer;
+  }
+
+  // Initialize the ncurses window. Curses reads the keyboard whichever
+  // renderer draws the game.
   WINDOW* mainwin = initscr();
   if(mainwin == NULL) {
     fprintf(stderr, "Error initializing ncurses.\n");
     exit(2);
   }
-  // Check if machine supports ncurses colors
-  if (has_colors() == FALSE) {
-    endwin();
-    fprintf(stderr, "Your terminal does not support color.\n");
-    exit(2);
-  }
-
-  // Initialize game pair colors
-  start_color();
-  init_pair(SNAKE1_PAIR, COLOR_BLUE, COLOR_YELLOW);
-  init_pair(SNAKE2_PAIR, COLOR_MAGENTA, COLOR_YELLOW);
-  init_pair(TEXT_PAIR, COLOR_BLACK, COLOR_YELLOW);
-  init_pair(APPLE_PAIR, COLOR_RED, COLOR_YELLOW);
-  init_pair(BORDER_PAIR, COLOR_CYAN, COLOR_YELLOW);
-  init_pair(EMPTY_PAIR, COLOR_YELLOW, COLOR_YELLOW);
-
-  // Seed random number generator with the time in milliseconds
-  srand(time_ms());
 
   noecho();               // Don't print keys when pressed
   keypad(mainwin, true);  // Support arrow keys
   nodelay(mainwin, true); // Non-blocking keyboard access
 
+  // Get the terminal ready to draw on
+  if(!renderer->init()) {
+    endwin();
+    fprintf(stderr, "Your terminal does not support color.\n");
+    exit(2);
+  }
+
   // Initialize the game display
   init_display();
 
-  // Zero out the board contents
-  memset(board, 0, BOARD_WIDTH*BOARD_HEIGHT*sizeof(int));
+  // Draw the whole replay as fast as possible to see what the renderer costs
+  if(render_benchmark) {
+    replay_render_benchmark();
+    exit(0);
+  }
 
-  // Put the snakes at the middle of the board
-  board[BOARD_HEIGHT/2][(BOARD_WIDTH/2) - 2] = 1; // head of snake1 is 1
-  board[BOARD_HEIGHT/2][(BOARD_WIDTH/2) + 2] = 625; // head of snake2 is 625 (half the area of board)
+  // A replay starts from the keyframe it loaded instead of a new board
+  if(!replaying) {
+    reset_board();
+  }
 
   // Thread handles for each of the game threads
-  task_t update_snake1_thread = 0;
-  task_t update_snake2_thread = 0;
+  task_t update_game_thread = 0;
   task_t draw_board_thread;
   task_t read_input1_thread = 0;
-  task_t read_input2_thread = 0;
-  task_t update_apples_thread = 0;
-  task_t generate_apple_thread;
+  task_t read_remote_input_thread = 0;
+  task_t serve_connections_thread;
+  task_t watch_input_thread;
+  task_t play_replay_thread;
+  task_t replay_input_thread;
+  task_t report_stats_thread;
 
   // Initialize the scheduler library
   scheduler_init();
 
-  if(argc == 3) {
+  if(joining) {
     // Create threads for each task in the game
-    task_create(&draw_board_thread, draw_board);
-    task_create(&read_input2_thread, read_input2);
+    start_task(&draw_board_thread, draw_board, "draw board");
+    start_task(&read_remote_input_thread, read_remote_input, "read remote input");
+    if(gather_stats) start_task(&report_stats_thread, report_stats, "report stats");
 
     // Wait for these threads to exit
     task_wait(draw_board_thread);
-    task_wait(read_input2_thread);
+    task_wait(read_remote_input_thread);
+    if(gather_stats) task_wait(report_stats_thread);
+  } else if(spectating) {
+    // Spectators only draw the board and wait for the quit key
+    start_task(&draw_board_thread, draw_board, "draw board");
+    start_task(&watch_input_thread, watch_input, "watch input");
+    if(gather_stats) start_task(&report_stats_thread, report_stats, "report stats");
+
+    task_wait(draw_board_thread);
+    task_wait(watch_input_thread);
+    if(gather_stats) task_wait(report_stats_thread);
+  } else if(replaying) {
+    // Replays re-simulate the game instead of reading input from players
+    start_task(&play_replay_thread, play_replay, "play replay");
+    start_task(&draw_board_thread, draw_board, "draw board");
+    start_task(&replay_input_thread, replay_input, "replay input");
+
+    task_wait(play_replay_thread);
+    task_wait(draw_board_thread);
+    task_wait(replay_input_thread);
   } else {
+    start_match();
+
     // Create threads for each task in the game
-    task_create(&update_snake1_thread, update_snake1);
-    task_create(&update_snake2_thread, update_snake2);
-    task_create(&draw_board_thread, draw_board);
-    task_create(&read_input1_thread, read_input1);
-    task_create(&update_apples_thread, update_apples);
-    task_create(&generate_apple_thread, generate_apple);
+    start_task(&update_game_thread, update_game, "update game");
+    start_task(&draw_board_thread, draw_board, "draw board");
+    start_task(&read_input1_thread, read_input1, "read input");
+    start_task(&serve_connections_thread, serve_connections, "serve connections");
+    start_task(&report_stats_thread, report_stats, "report stats");
 
     // Wait for these threads to exit
-    task_wait(update_snake1_thread);
-    task_wait(update_snake2_thread);
+    task_wait(update_game_thread);
     task_wait(draw_board_thread);
     task_wait(read_input1_thread);
-    task_wait(update_apples_thread);
+    task_wait(serve_connections_thread);
+    task_wait(report_stats_thread);
+
+    end_match();
+    close_results();
   }
 
-  // Don't wait for the generate_apple task because it sleeps for 2 seconds,
-  // which creates a noticeable delay when exiting.
-  //task_wait(generate_apple_thread);
+  // Make sure the final board from the server is the one we score
+  board_snapshot();
 
   // Display the end of game message and wait for user input
   end_game();
 
   // Clean up window
+  renderer->end();
   delwin(mainwin);
   endwin();
 
+  report_allocs();
   return 0;
 }
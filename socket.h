@@ -19,7 +19,7 @@
  * \returns   A file descriptor for the connected socket, or -1 if there is an
  *            error. The errno value will be set by the failed POSIX call.
  */
-static int socket_connect(char* server_name, unsigned short port) {
+static inline int socket_connect(char* server_name, unsigned short port) {
   // Look up the server by name
   struct hostent* server = gethostbyname(server_name);
   if(server == NULL) {
@@ -52,6 +52,45 @@ static int socket_connect(char* server_name, unsigned short port) {
   return fd;
 }
 
+/**
+ * Create a UDP socket connected to a server, so datagrams can be sent to it
+ * with write and only datagrams from it are received.
+ *
+ * \param server_name   A null-terminated string that specifies either the IP
+ *                      address or host name of the server.
+ * \param port          The server's port number.
+ *
+ * \returns   A file descriptor for the connected socket, or -1 if there is an
+ *            error. The errno value will be set by the failed POSIX call.
+ */
+static inline int udp_socket_connect(char* server_name, unsigned short port) {
+  struct hostent* server = gethostbyname(server_name);
+  if(server == NULL) {
+    // Set errno, since gethostbyname does not
+    errno = EHOSTDOWN;
+    return -1;
+  }
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if(fd == -1) {
+    return -1;
+  }
+
+  struct sockaddr_in addr = {
+    .sin_family = AF_INET,
+    .sin_port = htons(port)
+  };
+  memcpy(&addr.sin_addr.s_addr, server->h_addr, server->h_length);
+
+  // Connecting a UDP socket sends nothing. It only picks the address.
+  if(connect(fd, (struct sockaddr*)&addr, sizeof(struct sockaddr_in))) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
 /**
  * Open a server socket that will accept TCP connections from any other machine.
  * 
@@ -65,7 +104,7 @@ static int socket_connect(char* server_name, unsigned short port) {
  *                In case of failure, this function returns -1. The value of
  *                errno will be set by the POSIX socket function that failed.
  */
-static int server_socket_open(unsigned short* port) {
+static inline int server_socket_open(unsigned short* port) {
   // Create a server socket. Return if there is an error.
   int fd = socket(AF_INET, SOCK_STREAM, 0);
   if(fd == -1) {
@@ -100,6 +139,34 @@ static int server_socket_open(unsigned short* port) {
   return fd;
 }
 
+/**
+ * Open a UDP socket that will receive datagrams from any other machine.
+ *
+ * \param port    The port to bind to. A server uses the same port number for
+ *                UDP as it does for TCP.
+ *
+ * \returns       A file descriptor for the bound socket, or -1 with errno set
+ *                by the POSIX socket function that failed.
+ */
+static inline int udp_socket_open(unsigned short port) {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if(fd == -1) {
+    return -1;
+  }
+
+  struct sockaddr_in addr = {
+    .sin_family = AF_INET,
+    .sin_addr.s_addr = INADDR_ANY,
+    .sin_port = htons(port)
+  };
+  if(bind(fd, (struct sockaddr*)&addr, sizeof(struct sockaddr_in))) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
 /**
  * Accept an incoming connection on a server socket.
  *
@@ -108,7 +175,7 @@ static int server_socket_open(unsigned short* port) {
  * \returns   The file descriptor for the newly-connected client socket. In case
  *            of failure, returns -1 with errno set by the failed accept call.
  */
-static int server_socket_accept(int server_socket_fd) {
+static inline int server_socket_accept(int server_socket_fd) {
   // Create a struct to record the connected client's address
   struct sockaddr_in client_addr;
   socklen_t client_addr_len = sizeof(struct sockaddr_in);
@@ -0,0 +1,82 @@
+#if !defined(SPSC_H)
+#define SPSC_H
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Number of slots in each queue. This must be a power of two.
+#define SPSC_CAPACITY 64
+
+// Size used to keep the producer and consumer indices on separate cache lines
+#define SPSC_CACHE_LINE 64
+
+/**
+ * A lock-free ring buffer with exactly one producer thread and one consumer
+ * thread. The producer only writes tail and the consumer only writes head, so
+ * neither side ever waits on the other.
+ */
+typedef struct spsc_queue {
+  // Index of the next slot the consumer will read
+  alignas(SPSC_CACHE_LINE) atomic_size_t head;
+
+  // Index of the next slot the producer will write
+  alignas(SPSC_CACHE_LINE) atomic_size_t tail;
+
+  // Storage for queued values
+  alignas(SPSC_CACHE_LINE) int items[SPSC_CAPACITY];
+} spsc_queue_t;
+
+/**
+ * Reset a queue to empty. Only call this before either side starts using it.
+ *
+ * \param q   The queue to initialize
+ */
+static inline void spsc_init(spsc_queue_t* q) {
+  atomic_init(&q->head, 0);
+  atomic_init(&q->tail, 0);
+}
+
+/**
+ * Add a value to the queue. Must only be called from the producer thread.
+ *
+ * \param q       The queue to add to
+ * \param value   The value to add
+ *
+ * \returns       true if the value was queued, or false if the queue was full.
+ */
+static inline bool spsc_push(spsc_queue_t* q, int value) {
+  size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+  if(tail - head == SPSC_CAPACITY) return false;
+
+  q->items[tail & (SPSC_CAPACITY - 1)] = value;
+
+  // Publish the slot only after its contents have been written
+  atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+  return true;
+}
+
+/**
+ * Remove the oldest value from the queue. Must only be called from the
+ * consumer thread.
+ *
+ * \param q       The queue to read from
+ * \param value   The removed value will be written to this location.
+ *
+ * \returns       true if a value was removed, or false if the queue was empty.
+ */
+static inline bool spsc_pop(spsc_queue_t* q, int* value) {
+  size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+  if(head == tail) return false;
+
+  *value = q->items[head & (SPSC_CAPACITY - 1)];
+
+  // Hand the slot back to the producer only after we have copied it out
+  atomic_store_explicit(&q->head, head + 1, memory_order_release);
+  return true;
+}
+
+#endif
@@ -0,0 +1,54 @@
+#include "stats.h"
+
+/**
+ * Get the smallest value that falls in a histogram bucket.
+ */
+static uint64_t stats_bucket_start(unsigned bucket) {
+  if(bucket < STATS_SUB_BUCKETS) return bucket;
+  unsigned shift = bucket / STATS_SUB_BUCKETS - 1;
+  return (uint64_t)(STATS_SUB_BUCKETS + bucket % STATS_SUB_BUCKETS) << shift;
+}
+
+/**
+ * Get the values recorded in a histogram since the last call.
+ */
+void stats_window(stats_hist_t* hist, stats_window_t* previous, stats_window_t* window) {
+  window->total = 0;
+  previous->total = 0;
+  for(unsigned i=0; i<STATS_BUCKETS; i++) {
+    uint64_t count = stats_get(&hist->counts[i]);
+    window->counts[i] = count - previous->counts[i];
+    window->total += window->counts[i];
+    previous->counts[i] = count;
+    previous->total += count;
+  }
+}
+
+/**
+ * Count the values ever recorded in a histogram that are less than a limit.
+ */
+uint64_t stats_count_below(stats_hist_t* hist, uint64_t limit) {
+  uint64_t count = 0;
+  for(unsigned i=0; i<STATS_BUCKETS && stats_bucket_start(i) < limit; i++) {
+    count += stats_get(&hist->counts[i]);
+  }
+  return count;
+}
+
+/**
+ * Estimate a percentile of the values in a window.
+ */
+uint64_t stats_percentile(const stats_window_t* window, double percent) {
+  if(window->total == 0) return 0;
+
+  // The rank of the value we want, counting from one
+  uint64_t rank = (uint64_t)(window->total * percent / 100.0);
+  if(rank < 1) rank = 1;
+
+  uint64_t seen = 0;
+  for(unsigned i=0; i<STATS_BUCKETS; i++) {
+    seen += window->counts[i];
+    if(seen >= rank) return stats_bucket_start(i);
+  }
+  return stats_bucket_start(STATS_BUCKETS - 1);
+}
@@ -0,0 +1,114 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Number of histogram buckets. Values up to 2^34 fit, which is hours in
+// microseconds.
+#define STATS_BUCKETS 256
+
+// Each power of two is split into this many buckets, so a percentile is off
+// by at most an eighth
+#define STATS_SUB_BUCKETS 8
+
+/**
+ * A running total that only one thread adds to. Any thread may read it.
+ * Since there is a single writer, adding needs no locked instruction.
+ */
+typedef _Atomic uint64_t stats_counter_t;
+
+/**
+ * A histogram that only one thread records values in.
+ */
+typedef struct stats_hist {
+  stats_counter_t counts[STATS_BUCKETS];
+  stats_counter_t sum;    //< The total of every value recorded
+} stats_hist_t;
+
+/**
+ * The values recorded in a histogram over some interval, taken by the
+ * thread that reports them.
+ */
+typedef struct stats_window {
+  uint64_t counts[STATS_BUCKETS];
+  uint64_t total;
+} stats_window_t;
+
+/**
+ * Add to a counter. Must only be called from the counter's writer thread.
+ */
+static inline void stats_add(stats_counter_t* counter, uint64_t amount) {
+  uint64_t value = atomic_load_explicit(counter, memory_order_relaxed);
+  atomic_store_explicit(counter, value + amount, memory_order_relaxed);
+}
+
+/**
+ * Set a counter that holds the latest value of something rather than a
+ * running total.
+ */
+static inline void stats_set(stats_counter_t* counter, uint64_t value) {
+  atomic_store_explicit(counter, value, memory_order_relaxed);
+}
+
+/**
+ * Read a counter from any thread.
+ */
+static inline uint64_t stats_get(stats_counter_t* counter) {
+  return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+/**
+ * Get the histogram bucket a value falls in. Small values get a bucket each,
+ * and larger ones share a bucket with values within an eighth of them.
+ */
+static inline unsigned stats_bucket(uint64_t value) {
+  if(value < STATS_SUB_BUCKETS) return value;
+  unsigned shift = 63 - __builtin_clzll(value) - 3;
+  unsigned bucket = STATS_SUB_BUCKETS * (shift + 1) + ((value >> shift) & (STATS_SUB_BUCKETS - 1));
+  return bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS - 1;
+}
+
+/**
+ * Record a value in a histogram. Must only be called from the histogram's
+ * writer thread.
+ */
+static inline void stats_record(stats_hist_t* hist, uint64_t value) {
+  stats_add(&hist->counts[stats_bucket(value)], 1);
+  stats_add(&hist->sum, value);
+}
+
+/**
+ * Get the values recorded in a histogram since the last call.
+ *
+ * \param hist      The histogram to read
+ * \param previous  The counts as of the last call, which are updated. Start
+ *                  this out zeroed.
+ * \param window    The values recorded in between are written here
+ */
+void stats_window(stats_hist_t* hist, stats_window_t* previous, stats_window_t* window);
+
+/**
+ * Count the values ever recorded in a histogram that are less than a limit.
+ * The count is exact when the limit is a power of two, since those always
+ * start a bucket.
+ *
+ * \param hist    The histogram to read
+ * \param limit   The limit
+ *
+ * \returns       The number of values in buckets that start below the limit
+ */
+uint64_t stats_count_below(stats_hist_t* hist, uint64_t limit);
+
+/**
+ * Estimate a percentile of the values in a window.
+ *
+ * \param window    The values
+ * \param percent   The percentile, from 0 to 100
+ *
+ * \returns         The low end of the bucket the percentile falls in, or 0 if
+ *                  the window is empty.
+ */
+uint64_t stats_percentile(const stats_window_t* window, double percent);
+
+#endif
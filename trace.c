@@ -0,0 +1,195 @@
+#include "trace.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * One recorded event.
+ */
+typedef struct trace_event {
+  uint64_t start;         //< Start time in nanoseconds
+  uint64_t duration;      //< Duration in nanoseconds
+  const char* name;       //< What happened
+  const char* arg_name;   //< The name of the value shown with it, or NULL
+  int64_t arg;            //< The value
+  int32_t track;          //< The track it is shown on
+} trace_event_t;
+
+/**
+ * The events one thread has recorded. Only that thread writes them.
+ */
+typedef struct trace_ring {
+  // Number of events ever recorded. Events are written before this counts
+  // them, so the writer at exit sees complete events.
+  atomic_size_t count;
+  trace_event_t* events;
+} trace_ring_t;
+
+bool trace_enabled = false;
+
+// Where the trace is written at exit, and the time events count from
+static char* trace_path;
+static uint64_t trace_start;
+
+// Every thread's ring, and the number claimed so far
+static trace_ring_t rings[TRACE_MAX_THREADS];
+static atomic_int num_rings = 0;
+
+// The names shown for tracks
+static const char* track_names[TRACE_MAX_TRACKS];
+
+// The calling thread's ring, and the track its events go on
+static _Thread_local trace_ring_t* thread_ring = NULL;
+static _Thread_local int thread_track = 0;
+
+/**
+ * Get a monotonic time in nanoseconds.
+ */
+static uint64_t monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Turn tracing on.
+ */
+void trace_open(const char* path) {
+  trace_path = strdup(path);
+  trace_start = monotonic_ns();
+  trace_enabled = trace_path != NULL;
+  if(trace_enabled) {
+    atexit(trace_write);
+  }
+}
+
+/**
+ * Write the trace to another file at exit.
+ */
+void trace_set_path(const char* path) {
+  if(!trace_enabled) return;
+  char* copy = strdup(path);
+  if(copy == NULL) return;
+  free(trace_path);
+  trace_path = copy;
+}
+
+/**
+ * Give the calling thread its own ring of events.
+ */
+void trace_thread(const char* name) {
+  if(!trace_enabled || thread_ring != NULL) return;
+
+  int index = atomic_fetch_add(&num_rings, 1);
+  if(index >= TRACE_MAX_THREADS) return;
+
+  trace_ring_t* ring = &rings[index];
+  ring->events = calloc(TRACE_RING_EVENTS, sizeof(trace_event_t));
+  if(ring->events == NULL) return;
+
+  thread_ring = ring;
+  thread_track = TRACE_THREAD_TRACK + index;
+  track_names[thread_track] = name;
+}
+
+/**
+ * Name a track.
+ */
+void trace_name_track(int track, const char* name) {
+  if(trace_enabled && track >= 0 && track < TRACE_MAX_TRACKS) {
+    track_names[track] = name;
+  }
+}
+
+/**
+ * Record the calling thread's events on another track from now on.
+ */
+void trace_set_track(int track) {
+  thread_track = track;
+}
+
+/**
+ * Get the time in nanoseconds that trace events are stamped with.
+ */
+uint64_t trace_now() {
+  return trace_enabled ? monotonic_ns() : 0;
+}
+
+/**
+ * Record something that took a span of time on a track.
+ */
+void trace_span_on(int track, const char* name, uint64_t start, uint64_t end,
+                   const char* arg_name, int64_t arg) {
+  trace_ring_t* ring = thread_ring;
+  if(ring == NULL) return;
+
+  size_t count = atomic_load_explicit(&ring->count, memory_order_relaxed);
+  trace_event_t* event = &ring->events[count & (TRACE_RING_EVENTS - 1)];
+  event->start = start;
+  event->duration = end > start ? end - start : 0;
+  event->name = name;
+  event->arg_name = arg_name;
+  event->arg = arg;
+  event->track = track;
+  atomic_store_explicit(&ring->count, count + 1, memory_order_release);
+}
+
+/**
+ * Record something that has just finished on the calling thread's track.
+ */
+void trace_span(const char* name, uint64_t start, const char* arg_name, int64_t arg) {
+  if(thread_ring == NULL) return;
+  trace_span_on(thread_track, name, start, monotonic_ns(), arg_name, arg);
+}
+
+/**
+ * Write every recorded event to the trace file.
+ */
+void trace_write() {
+  FILE* file = fopen(trace_path, "w");
+  if(file == NULL) {
+    perror("Failed to write trace");
+    return;
+  }
+
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  bool first = true;
+
+  // Name each track that has a name
+  for(int track=0; track<TRACE_MAX_TRACKS; track++) {
+    if(track_names[track] == NULL) continue;
+    fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            first ? "" : ",\n", track, track_names[track]);
+    first = false;
+  }
+
+  // Write the events each thread still has
+  int count = atomic_load(&num_rings);
+  if(count > TRACE_MAX_THREADS) count = TRACE_MAX_THREADS;
+  for(int i=0; i<count; i++) {
+    trace_ring_t* ring = &rings[i];
+    if(ring->events == NULL) continue;
+
+    size_t end = atomic_load_explicit(&ring->count, memory_order_acquire);
+    size_t start = end > TRACE_RING_EVENTS ? end - TRACE_RING_EVENTS : 0;
+    for(size_t n=start; n<end; n++) {
+      trace_event_t* event = &ring->events[n & (TRACE_RING_EVENTS - 1)];
+      if(event->name == NULL || event->start < trace_start) continue;
+
+      fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+              first ? "" : ",\n", event->name, event->track,
+              (event->start - trace_start) / 1000.0, event->duration / 1000.0);
+      if(event->arg_name != NULL) {
+        fprintf(file, ",\"args\":{\"%s\":%lld}", event->arg_name, (long long)event->arg);
+      }
+      fprintf(file, "}");
+      first = false;
+    }
+  }
+
+  fprintf(file, "\n]}\n");
+  fclose(file);
+}
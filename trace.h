@@ -0,0 +1,91 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Most threads that can record events
+#define TRACE_MAX_THREADS 8
+
+// Number of events each thread keeps. Older events are overwritten once a
+// thread's ring is full. This must be a power of two.
+#define TRACE_RING_EVENTS 131072
+
+// Tracks below this are scheduler tasks, and threads get the tracks after it
+#define TRACE_THREAD_TRACK 1000
+
+// Most tracks that can be given names
+#define TRACE_MAX_TRACKS (TRACE_THREAD_TRACK + TRACE_MAX_THREADS)
+
+// Is tracing turned on? Every other trace function does nothing if not.
+extern bool trace_enabled;
+
+/**
+ * Turn tracing on. Events are written to a file in Chrome's trace event
+ * format when the program exits, which chrome://tracing and Perfetto can
+ * open.
+ *
+ * \param path  The file to write the trace to
+ */
+void trace_open(const char* path);
+
+/**
+ * Write the trace to another file at exit, such as a file of its own for a
+ * process forked after tracing was turned on.
+ *
+ * \param path  The file to write the trace to
+ */
+void trace_set_path(const char* path);
+
+/**
+ * Give the calling thread its own ring of events. A thread's events are only
+ * recorded after it calls this, so no memory is allocated while tracing.
+ *
+ * \param name  The name shown for the thread's track
+ */
+void trace_thread(const char* name);
+
+/**
+ * Name a track, such as one for a scheduler task.
+ */
+void trace_name_track(int track, const char* name);
+
+/**
+ * Record the calling thread's events on another track from now on. The
+ * scheduler uses this to show each task on a track of its own.
+ */
+void trace_set_track(int track);
+
+/**
+ * Get the time in nanoseconds that trace events are stamped with, or zero if
+ * tracing is off.
+ */
+uint64_t trace_now();
+
+/**
+ * Record something that took a span of time on a track.
+ *
+ * \param track     The track to show it on
+ * \param name      What happened, which must be a string constant
+ * \param start     When it started, from trace_now
+ * \param end       When it finished
+ * \param arg_name  The name of a value to show with it, or NULL for none
+ * \param arg       The value
+ */
+void trace_span_on(int track, const char* name, uint64_t start, uint64_t end,
+                   const char* arg_name, int64_t arg);
+
+/**
+ * Record something that started at a given time and has just finished, on
+ * the calling thread's current track.
+ */
+void trace_span(const char* name, uint64_t start, const char* arg_name, int64_t arg);
+
+/**
+ * Write every recorded event to the trace file. This runs when the program
+ * exits, while other threads may still be recording, so their most recent
+ * events may be missing or torn.
+ */
+void trace_write();
+
+#endif
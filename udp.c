@@ -0,0 +1,75 @@
+#include "udp.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "util.h"
+
+/**
+ * Get the number of bytes of a packet that are sent.
+ */
+size_t udp_input_size(const udp_input_t* packet) {
+  return offsetof(udp_input_t, commands) + packet->count * sizeof(client_msg_t);
+}
+
+/**
+ * Start numbering a player's commands.
+ */
+void udp_inputs_init(udp_inputs_t* inputs, uint64_t token) {
+  memset(inputs, 0, sizeof(udp_inputs_t));
+  inputs->packet.magic = PROTOCOL_MAGIC;
+  inputs->packet.token = token;
+  inputs->packet.first_seq = 1;
+  inputs->next_seq = 1;
+}
+
+/**
+ * Add a command to the next packet.
+ */
+void udp_inputs_add(udp_inputs_t* inputs, const client_msg_t* msg) {
+  udp_input_t* packet = &inputs->packet;
+  if(packet->count == UDP_REDUNDANCY) {
+    memmove(&packet->commands[0], &packet->commands[1], (UDP_REDUNDANCY - 1) * sizeof(client_msg_t));
+    packet->count--;
+    packet->first_seq++;
+  }
+
+  // An empty packet starts with the new command
+  if(packet->count == 0) packet->first_seq = inputs->next_seq;
+  packet->commands[packet->count++] = *msg;
+  inputs->next_seq++;
+}
+
+/**
+ * Stop sending the commands the server has applied.
+ */
+void udp_inputs_ack(udp_inputs_t* inputs, uint32_t ack) {
+  udp_input_t* packet = &inputs->packet;
+  if(packet->count == 0 || ack < packet->first_seq) return;
+
+  uint32_t done = ack - packet->first_seq + 1;
+  if(done > packet->count) done = packet->count;
+  memmove(&packet->commands[0], &packet->commands[done], (packet->count - done) * sizeof(client_msg_t));
+  packet->count -= done;
+  packet->first_seq += done;
+}
+
+/**
+ * Send the packet of unacknowledged commands without blocking.
+ */
+bool udp_inputs_send(udp_inputs_t* inputs, int fd) {
+  inputs->sent_us = time_us();
+  size_t length = udp_input_size(&inputs->packet);
+  return send(fd, &inputs->packet, length, MSG_DONTWAIT) == (ssize_t)length;
+}
+
+/**
+ * Check that a datagram a player sent is a well-formed input packet. Token 0
+ * is never given out, so a packet carrying it is rejected too.
+ */
+bool udp_input_valid(const udp_input_t* packet, size_t length) {
+  return length >= offsetof(udp_input_t, commands) && packet->magic == PROTOCOL_MAGIC &&
+         packet->token != 0 && packet->count <= UDP_REDUNDANCY &&
+         length == udp_input_size(packet);
+}
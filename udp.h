@@ -0,0 +1,79 @@
+#ifndef UDP_H
+#define UDP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "area.h"
+#include "protocol.h"
+
+// Largest datagram the server sends: a message holding a full area of the
+// board, behind the datagram's own header
+#define UDP_DATAGRAM_MAX (sizeof(udp_header_t) + sizeof(msg_header_t) + AREA_PAYLOAD_MAX)
+
+// A board update has to fit in a single datagram
+_Static_assert(UDP_DATAGRAM_MAX <= 65507, "The area sent to clients is too big for UDP");
+
+// Players resend commands the server hasn't acknowledged this often, in
+// milliseconds, even when they have nothing new to send
+#define UDP_RESEND_INTERVAL 10
+
+/**
+ * The commands a player using UDP has sent that the server hasn't
+ * acknowledged yet. Every packet repeats all of them.
+ */
+typedef struct udp_inputs {
+  udp_input_t packet;   //< The next packet, holding every unacknowledged command
+  uint32_t next_seq;    //< The sequence number the next command gets
+  uint64_t sent_us;     //< When the packet was last sent, from time_us
+} udp_inputs_t;
+
+/**
+ * Get the number of bytes of an input packet that are sent, which leaves out
+ * the commands it doesn't hold.
+ */
+size_t udp_input_size(const udp_input_t* packet);
+
+/**
+ * Start numbering a player's commands.
+ *
+ * \param inputs  The player's commands
+ * \param token   The session token the server gave the player
+ */
+void udp_inputs_init(udp_inputs_t* inputs, uint64_t token);
+
+/**
+ * Add a command to the next packet. If the packet is already full, its
+ * oldest command is given up on, having been sent UDP_REDUNDANCY times.
+ */
+void udp_inputs_add(udp_inputs_t* inputs, const client_msg_t* msg);
+
+/**
+ * Stop sending the commands the server has applied.
+ *
+ * \param inputs  The player's commands
+ * \param ack     The ack from a datagram the server sent
+ */
+void udp_inputs_ack(udp_inputs_t* inputs, uint32_t ack);
+
+/**
+ * Send the packet of unacknowledged commands without blocking.
+ *
+ * \param inputs  The player's commands
+ * \param fd      A UDP socket connected to the server
+ *
+ * \returns       false if the packet could not be sent.
+ */
+bool udp_inputs_send(udp_inputs_t* inputs, int fd);
+
+/**
+ * Check that a datagram a player sent is a well-formed input packet. Token 0
+ * is never given out, so a packet carrying it is rejected too.
+ *
+ * \param packet  The datagram
+ * \param length  The number of bytes received
+ */
+bool udp_input_valid(const udp_input_t* packet, size_t length);
+
+#endif
@@ -0,0 +1,227 @@
+#include "uring.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#if defined(__linux__)
+
+#include <linux/io_uring.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Everything needed to use an io_uring without liburing. The kernel shares
+// both queues with us: we add to the tail of the submission queue and it
+// takes from the head, and the other way around for completions.
+struct uring {
+  int fd;
+
+  // The submission queue, and the entries its array points into
+  _Atomic unsigned* sq_head;
+  _Atomic unsigned* sq_tail;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  unsigned* sq_array;
+  struct io_uring_sqe* sqes;
+
+  // The completion queue
+  _Atomic unsigned* cq_head;
+  _Atomic unsigned* cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe* cqes;
+
+  // Operations queued since the last submit, and operations submitted that
+  // haven't finished
+  unsigned queued;
+  unsigned in_flight;
+
+  // The shared memory, so it can be unmapped
+  void* rings;
+  size_t rings_size;
+  size_t sqes_size;
+};
+
+/**
+ * Set up an io_uring.
+ */
+uring_t* uring_open(unsigned entries) {
+  uring_t* ring = calloc(1, sizeof(uring_t));
+  if(ring == NULL) return NULL;
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+  if(ring->fd == -1) {
+    free(ring);
+    return NULL;
+  }
+
+  // Both queues live in one mapping on every kernel new enough to matter
+  if(!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+    close(ring->fd);
+    free(ring);
+    errno = ENOSYS;
+    return NULL;
+  }
+
+  size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  ring->rings_size = sq_size > cq_size ? sq_size : cq_size;
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  ring->rings = mmap(NULL, ring->rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     ring->fd, IORING_OFF_SQ_RING);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    ring->fd, IORING_OFF_SQES);
+  if(ring->rings == MAP_FAILED || ring->sqes == MAP_FAILED) {
+    int error = errno;
+    if(ring->rings != MAP_FAILED) munmap(ring->rings, ring->rings_size);
+    if(ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+    close(ring->fd);
+    free(ring);
+    errno = error;
+    return NULL;
+  }
+
+  char* rings = ring->rings;
+  ring->sq_head = (_Atomic unsigned*)(rings + params.sq_off.head);
+  ring->sq_tail = (_Atomic unsigned*)(rings + params.sq_off.tail);
+  ring->sq_mask = *(unsigned*)(rings + params.sq_off.ring_mask);
+  ring->sq_entries = params.sq_entries;
+  ring->sq_array = (unsigned*)(rings + params.sq_off.array);
+
+  ring->cq_head = (_Atomic unsigned*)(rings + params.cq_off.head);
+  ring->cq_tail = (_Atomic unsigned*)(rings + params.cq_off.tail);
+  ring->cq_mask = *(unsigned*)(rings + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe*)(rings + params.cq_off.cqes);
+  return ring;
+}
+
+/**
+ * Queue a writev on a file descriptor.
+ */
+bool uring_writev(uring_t* ring, int fd, const struct iovec* iov, unsigned count, uint64_t user_data) {
+  if(ring->queued == ring->sq_entries) return false;
+
+  // Only we write the tail, and the kernel has taken everything we submitted
+  unsigned tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+  unsigned index = tail & ring->sq_mask;
+  struct io_uring_sqe* sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_WRITEV;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)iov;
+  sqe->len = count;
+  sqe->user_data = user_data;
+  ring->sq_array[index] = index;
+
+  // Publish the entry to the kernel
+  atomic_store_explicit(ring->sq_tail, tail + 1, memory_order_release);
+  ring->queued++;
+  return true;
+}
+
+/**
+ * Hand the result of each finished operation to done, if there is one.
+ */
+static void uring_reap(uring_t* ring, uring_done_fn done) {
+  unsigned head = atomic_load_explicit(ring->cq_head, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(ring->cq_tail, memory_order_acquire);
+  while(head != tail) {
+    struct io_uring_cqe* cqe = &ring->cqes[head & ring->cq_mask];
+    if(done != NULL) done(cqe->user_data, cqe->res);
+    head++;
+    ring->in_flight--;
+  }
+  atomic_store_explicit(ring->cq_head, head, memory_order_release);
+}
+
+/**
+ * Wait for every submitted operation to finish.
+ *
+ * \returns   false if waiting failed, leaving some unfinished.
+ */
+static bool uring_wait(uring_t* ring, uring_done_fn done) {
+  while(ring->in_flight > 0) {
+    int rc = syscall(__NR_io_uring_enter, ring->fd, 0, ring->in_flight, IORING_ENTER_GETEVENTS, NULL, 0);
+    if(rc == -1 && errno != EINTR) return false;
+    uring_reap(ring, done);
+  }
+  return true;
+}
+
+/**
+ * Carry out every queued operation and wait for them all to finish.
+ */
+bool uring_submit(uring_t* ring, uring_done_fn done) {
+  ring->in_flight += ring->queued;
+  ring->queued = 0;
+
+  while(ring->in_flight > 0) {
+    // Submit whatever the kernel hasn't taken yet, and wait for the rest
+    unsigned head = atomic_load_explicit(ring->sq_head, memory_order_acquire);
+    unsigned tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+    int rc = syscall(__NR_io_uring_enter, ring->fd, tail - head, ring->in_flight, IORING_ENTER_GETEVENTS, NULL, 0);
+    if(rc == -1 && errno != EINTR) {
+      int error = errno;
+
+      // Take back what the kernel never saw, since its data won't last, and
+      // report that it never started
+      head = atomic_load_explicit(ring->sq_head, memory_order_acquire);
+      for(unsigned i=head; i!=tail; i++) {
+        done(ring->sqes[ring->sq_array[i & ring->sq_mask]].user_data, -ECANCELED);
+        ring->in_flight--;
+      }
+      atomic_store_explicit(ring->sq_tail, head, memory_order_relaxed);
+
+      // Whatever the kernel did take is still to be reported
+      uring_reap(ring, done);
+      uring_wait(ring, done);
+      errno = error;
+      return false;
+    }
+    uring_reap(ring, done);
+  }
+  return true;
+}
+
+/**
+ * Tear down an io_uring.
+ */
+void uring_close(uring_t* ring) {
+  // The kernel may still be writing from memory the caller is about to reuse
+  uring_wait(ring, NULL);
+
+  munmap(ring->sqes, ring->sqes_size);
+  munmap(ring->rings, ring->rings_size);
+  close(ring->fd);
+  free(ring);
+}
+
+#else
+
+// Other systems have no io_uring, so it is never used there
+struct uring {
+  int unused;
+};
+
+uring_t* uring_open(unsigned entries) {
+  errno = ENOSYS;
+  return NULL;
+}
+
+bool uring_writev(uring_t* ring, int fd, const struct iovec* iov, unsigned count, uint64_t user_data) {
+  return false;
+}
+
+bool uring_submit(uring_t* ring, uring_done_fn done) {
+  return false;
+}
+
+void uring_close(uring_t* ring) {
+}
+
+#endif
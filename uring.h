@@ -0,0 +1,65 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/**
+ * An io_uring, which takes a batch of operations and carries them all out
+ * with a single system call. It is only available on Linux.
+ */
+typedef struct uring uring_t;
+
+/// This is the type of a function told the result of each finished operation:
+/// the user data it was queued with, and the number of bytes written, or a
+/// negative errno value
+typedef void (*uring_done_fn)(uint64_t user_data, int result);
+
+/**
+ * Set up an io_uring.
+ *
+ * \param entries   The most operations that can be queued at once, which
+ *                  must be a power of two
+ *
+ * \returns         The new ring, or NULL with errno set if io_uring is not
+ *                  available.
+ */
+uring_t* uring_open(unsigned entries);
+
+/**
+ * Queue a writev on a file descriptor. Nothing happens until uring_submit.
+ *
+ * \param ring        The ring
+ * \param fd          The file descriptor to write to
+ * \param iov         The data to write, which must stay where it is until
+ *                    uring_submit returns
+ * \param count       The number of entries in iov
+ * \param user_data   Passed to the done function with the result
+ *
+ * \returns           false if the ring already holds as many operations as
+ *                    it can.
+ */
+bool uring_writev(uring_t* ring, int fd, const struct iovec* iov, unsigned count, uint64_t user_data);
+
+/**
+ * Carry out every queued operation and wait for them all to finish. On
+ * non-blocking sockets, writes finish right away, so this doesn't block.
+ *
+ * \param ring    The ring
+ * \param done    Called with the result of each operation
+ *
+ * \returns       false if the system call failed. Operations the kernel
+ *                hadn't taken are then dropped, and reported with -ECANCELED.
+ *                The rest are waited for and reported as usual, unless
+ *                waiting fails too, in which case they never are. The ring
+ *                shouldn't be used again.
+ */
+bool uring_submit(uring_t* ring, uring_done_fn done);
+
+/**
+ * Tear down an io_uring, once any operations still in flight have finished.
+ */
+void uring_close(uring_t* ring);
+
+#endif
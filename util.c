@@ -1,10 +1,14 @@
 #define _GNU_SOURCE
 
+#include <limits.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/resource.h>
 #include <sys/time.h>
 #include <time.h>
+#include <unistd.h>
 
 /**
  * Sleep for a given number of milliseconds
@@ -21,15 +25,162 @@ void sleep_ms(size_t ms) {
 }
 
 /**
- * Get the time in milliseconds since UNIX epoch
+ * Get the time in nanoseconds from the system's monotonic clock. Unlike the
+ * wall clock this never jumps when the time is adjusted, and every process
+ * on a machine sees the same clock, so it can time messages over loopback.
+ */
+uint64_t time_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Get a monotonic time in milliseconds
  */
 size_t time_ms() {
+  return time_ns() / 1000000;
+}
+
+/**
+ * Get a monotonic time in microseconds
+ */
+uint64_t time_us() {
+  return time_ns() / 1000;
+}
+
+/**
+ * Get the time in milliseconds since UNIX epoch
+ */
+uint64_t wall_time_ms() {
   struct timeval tv;
   if(gettimeofday(&tv, NULL) == -1) {
     perror("gettimeofday");
     exit(2);
   }
-  
+
   // Convert timeval values to milliseconds
-  return tv.tv_sec*1000 + tv.tv_usec/1000;
+  return (uint64_t)tv.tv_sec*1000 + tv.tv_usec/1000;
+}
+
+/**
+ * Get the next value from a small pseudo-random generator (splitmix64). Unlike
+ * rand(), the whole generator is the value at state, so it can be saved and
+ * restored to replay a match exactly.
+ * \param   state   The generator state, which is advanced
+ */
+uint32_t rng_next(uint64_t* state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return (z ^ (z >> 31)) >> 32;
+}
+
+/**
+ * Get a random 64-bit value from the operating system's secure random source.
+ * If that is not available, fall back to mixing the time and process id.
+ */
+uint64_t random_token() {
+  uint64_t token;
+  FILE* urandom = fopen("/dev/urandom", "rb");
+  if(urandom != NULL) {
+    size_t read = fread(&token, sizeof(token), 1, urandom);
+    fclose(urandom);
+    if(read == 1) return token;
+  }
+
+  uint64_t state = (wall_time_ms() << 20) ^ getpid();
+  return ((uint64_t)rng_next(&state) << 32) | rng_next(&state);
+}
+
+/**
+ * Raise the soft limit on open files to the hard limit, so a server can hold
+ * many connections at once.
+ */
+void raise_fd_limit() {
+  struct rlimit limit;
+  if(getrlimit(RLIMIT_NOFILE, &limit) == -1) {
+    perror("getrlimit");
+    return;
+  }
+
+  limit.rlim_cur = limit.rlim_max;
+#if defined(OPEN_MAX)
+  // Some systems report an unlimited hard limit but refuse values above this
+  if(limit.rlim_cur > OPEN_MAX) limit.rlim_cur = OPEN_MAX;
+#endif
+  if(setrlimit(RLIMIT_NOFILE, &limit) == -1) {
+    perror("setrlimit");
+  }
+}
+
+/**
+ * Get the number of write calls and bytes written by this process so far.
+ * These come from /proc/self/io, which only exists on Linux.
+ * \param   calls   The number of write system calls is written here
+ * \param   bytes   The number of bytes written is written here
+ * \returns         false if the counts are not available.
+ */
+bool write_counts(size_t* calls, size_t* bytes) {
+  FILE* io = fopen("/proc/self/io", "r");
+  if(io == NULL) return false;
+
+  bool found_calls = false;
+  bool found_bytes = false;
+  char line[64];
+  while(fgets(line, sizeof(line), io) != NULL) {
+    if(sscanf(line, "syscw: %zu", calls) == 1) found_calls = true;
+    if(sscanf(line, "wchar: %zu", bytes) == 1) found_bytes = true;
+  }
+  fclose(io);
+  return found_calls && found_bytes;
+}
+
+#if defined(DEBUG_ALLOC) && defined(__GLIBC__)
+// glibc's own allocator, which the functions below pass every call on to
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+
+// Number of allocations made by each thread
+static _Thread_local uint64_t thread_allocs = 0;
+
+// In debug builds, these replace malloc, calloc, and realloc for the whole
+// program, including libraries like ncurses, so every allocation is counted
+void* malloc(size_t size) {
+  thread_allocs++;
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+  thread_allocs++;
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+  thread_allocs++;
+  return __libc_realloc(ptr, size);
+}
+
+/**
+ * Get the number of times this thread has called malloc, calloc, or realloc.
+ */
+uint64_t alloc_count() {
+  return thread_allocs;
+}
+
+/**
+ * Check whether allocations are being counted.
+ */
+bool alloc_counting() {
+  return true;
+}
+#else
+uint64_t alloc_count() {
+  return 0;
+}
+
+bool alloc_counting() {
+  return false;
 }
+#endif
@@ -1,13 +1,44 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
 // Sleep for a given number of milliseconds
 void sleep_ms(size_t ms);
 
-// Get the time in milliseconds since UNIX epoch
+// Get a monotonic time in nanoseconds, comparable between processes on one machine.
+// The monotonic clock never jumps when the wall clock is adjusted, so use it
+// for anything timed.
+uint64_t time_ns();
+
+// Get a monotonic time in milliseconds
 size_t time_ms();
 
+// Get a monotonic time in microseconds
+uint64_t time_us();
+
+// Get the time in milliseconds since UNIX epoch, for timestamps
+uint64_t wall_time_ms();
+
+// Get the next value from a pseudo-random generator whose entire state is *state
+uint32_t rng_next(uint64_t* state);
+
+// Get a random 64-bit value that is hard to guess, for use as a secret
+uint64_t random_token();
+
+// Get the number of write calls and bytes written by this process so far
+bool write_counts(size_t* calls, size_t* bytes);
+
+// Raise the open file limit as high as this process is allowed
+void raise_fd_limit();
+
+// Get the number of times this thread has called malloc, calloc, or realloc.
+// Only builds with -DDEBUG_ALLOC on glibc count them; others always get zero.
+uint64_t alloc_count();
+
+// Check whether this build counts allocations
+bool alloc_counting();
+
 #endif